@@ -4,18 +4,237 @@
 #include <string>     // For strings.
 #include <sstream>    // For streams
 #include <random>     // For nonce generation
-#include <ctime>      // To seed the RNG.
+#include <vector>     // For the streaming buffer.
+#include <limits>     // To stream until the end of the file.
+#include <memory>     // For std::unique_ptr
+#include <fcntl.h>    // To open files for streaming.
+#include <sys/stat.h> // To find how long a file is.
+#include <sys/mman.h> // To map files.
 
 #include "aes.h"      // For our AES Implementation
+#include "uring.h"    // To keep reads and writes in flight while streaming.
+
+
+/**
+ * @brief The files being streamed, and where we are in each.
+ * @var in: The file to read from.
+ * @var out: The file to write to, once it's opened.
+ * @var from: Where the next read starts.
+ * @var to: Where the next write starts.
+ * @var slots: The buffers, each a multiple of 16 bytes, with the last block kept free for ECB's padding.
+ * With a ring, there are three, so that one can be read into and another written from while the third is
+ * encrypted; without, there is just the one.
+ * @var ring: The ring, if the kernel has io_uring.
+ * @var registered: Whether the slots are registered with the ring.
+ */
+struct files {
+  int in = -1, out = -1;
+  uint64_t from = 0, to = 0;
+  std::vector<std::vector<char>> slots;
+  std::unique_ptr<uring::ring> ring;
+  bool registered = false;
+
+  ~files() {
+    if (in != -1) close(in);
+    if (out != -1) close(out);
+  }
+};
+
+
+/**
+ * @brief A file mapped into memory.
+ * @var data: Where it starts, or nullptr if it's empty.
+ * @var size: How many bytes are mapped.
+ * @remarks The mapping is undone when this is destroyed.
+ */
+struct mapping {
+  std::byte* data = nullptr;
+  size_t size = 0;
+
+  /**
+   * @brief Map a file.
+   * @param file: The file.
+   * @param size: How much of it to map.
+   * @param writable: Whether to map it for writing, so that what's written lands in the file.
+   * @throws std::runtime_error If the file couldn't be mapped.
+   */
+  mapping(const int& file, const size_t& size, const bool& writable) : size(size) {
+    if (size == 0) return;
+    auto* at = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+    if (at == MAP_FAILED) throw std::runtime_error("Failed to map the file!");
+    data = static_cast<std::byte*>(at);
+
+    // We go through it once, front to back, so the kernel can read ahead and drop what we're done with.
+    madvise(at, size, MADV_SEQUENTIAL);
+  }
+
+  mapping(const mapping&) = delete;
+  mapping& operator=(const mapping&) = delete;
+  ~mapping() {if (data != nullptr) munmap(data, size);}
+
+  // The mapping, as a span.
+  std::span<std::byte> bytes() const {return {data, size};}
+};
+
+
+/**
+ * @brief Read from the infile, where we left off.
+ * @param f: The files.
+ * @param data: Where to read to.
+ * @param length: How many bytes to read.
+ * @returns How many bytes were read, which is only short of length if the file ended.
+ * @throws std::runtime_error If the file couldn't be read.
+ */
+size_t read_at(files& f, char* data, const size_t& length) {
+  size_t done = 0;
+  while (done < length) {
+    const auto n = pread(f.in, data + done, length - done, f.from + done);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) throw std::runtime_error("Failed to read the input file!");
+    if (n == 0) break;
+    done += n;
+  }
+  f.from += done;
+  return done;
+}
+
+
+/**
+ * @brief Write to the outfile, where we left off.
+ * @param f: The files.
+ * @param data: What to write.
+ * @param length: How many bytes to write.
+ * @throws std::runtime_error If the file couldn't be written.
+ * @remarks Without a ring, the outfile may be something like a pipe, so we just write in order.
+ */
+void write_at(files& f, const char* data, const size_t& length) {
+  for (size_t done = 0; done < length;) {
+    const auto n = f.ring ? pwrite(f.out, data + done, length - done, f.to + done) : write(f.out, data + done, length - done);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0) throw std::runtime_error("Failed to write the output file!");
+    done += n;
+  }
+  f.to += length;
+}
+
+
+/**
+ * @brief Run part of a file through a function, a buffer at a time.
+ * @tparam F: A function that transforms bytes in place, given a pointer, how many bytes there are, and whether
+ * they're the last; it returns how many bytes to write.
+ * @param f: The files, which are read from f.from, and written to from f.to.
+ * @param length: How many bytes to read, at most.
+ * @param write: Whether to write the bytes once they're done.
+ * @param process: The function.
+ * @throws std::runtime_error If a file couldn't be read or written, or process throws.
+ * @remarks Every buffer but the last is full, so only the last can end short of a block. The last is
+ * always processed, even if it's empty, since ECB still pads an empty message.
+ * @remarks With a ring, this is a pipeline: while one slot is processed, the next is already being read,
+ * and the one before is still being written, so the disk and the cipher work at the same time. process
+ * still sees the buffers one at a time, in order.
+ */
+template <typename F> void pump(files& f, uint64_t length, const bool& write, F process) {
+  struct stat info;
+  if (fstat(f.in, &info) == -1) throw std::runtime_error("Failed to read the input file!");
+  length = std::min<uint64_t>(length, uint64_t(info.st_size) > f.from ? info.st_size - f.from : 0);
+
+  const size_t room = f.slots[0].size() - 16;
+  const uint64_t pieces = std::max<uint64_t>(1, (length + room - 1) / room);
+  auto size = [&length, &room](const uint64_t& x) {return std::min<uint64_t>(room, length - x * room);};
+
+  if (!f.ring) {
+    auto* bytes = f.slots[0].data();
+    for (uint64_t x = 0; x < pieces; ++x) {
+      if (read_at(f, bytes, size(x)) != size(x)) throw std::runtime_error("The input file ended early!");
+      const size_t written = process(reinterpret_cast<uint8_t*>(bytes), size(x), x + 1 == pieces);
+      if (write) write_at(f, bytes, written);
+    }
+    return;
+  }
+
+  // Piece x goes through slot x % stages. Requests are tagged with the piece, and whether they're a write.
+  auto& ring = *f.ring;
+  const size_t stages = f.slots.size();
+  const uint64_t start = f.from;
+  std::vector<uint64_t> done(stages, 0), owed(stages, 0), offset(stages, 0);
+  std::vector<bool> busy(stages, false);
+  size_t flight = 0;
+
+  auto read = [&](const uint64_t& x) {
+    const auto s = x % stages;
+    ring.read(f.in, f.slots[s].data() + done[s], owed[s] - done[s], offset[s] + done[s], x << 1, f.registered ? s : -1);
+    ++flight;
+  };
+  auto store = [&](const uint64_t& x) {
+    const auto s = x % stages;
+    ring.write(f.out, f.slots[s].data() + done[s], owed[s] - done[s], offset[s] + done[s], x << 1 | 1, f.registered ? s : -1);
+    ++flight;
+  };
+  auto start_read = [&](const uint64_t& x) {
+    const auto s = x % stages;
+    done[s] = 0, owed[s] = size(x), offset[s] = start + x * room, busy[s] = true;
+    read(x);
+  };
+
+  // Take a single completion, and pick up where a short read or write left off.
+  auto complete = [&]() {
+    uint64_t user;
+    const auto result = ring.wait(user);
+    --flight;
+
+    const auto x = user >> 1, s = x % stages;
+    if (result < 0 || (result == 0 && done[s] < owed[s])) {
+      if (user & 1) throw std::runtime_error("Failed to write the output file!");
+      throw std::runtime_error(result < 0 ? "Failed to read the input file!" : "The input file ended early!");
+    }
+    done[s] += result;
+    if (done[s] < owed[s]) user & 1 ? store(x) : read(x);
+    else busy[s] = false;
+  };
+
+  try {
+    for (uint64_t x = 0; x < std::min<uint64_t>(stages - 1, pieces); ++x) start_read(x);
+    ring.submit();
+
+    for (uint64_t x = 0; x < pieces; ++x) {
+      const auto s = x % stages;
+      while (busy[s]) complete();
+
+      const size_t written = process(reinterpret_cast<uint8_t*>(f.slots[s].data()), size(x), x + 1 == pieces);
+      if (write && written) {
+        done[s] = 0, owed[s] = written, offset[s] = f.to, busy[s] = true;
+        f.to += written;
+        store(x);
+      }
+
+      // The slot the next read goes into was last written from; that has to finish first.
+      if (const auto next = x + stages - 1; next < pieces) {
+        while (busy[next % stages]) complete();
+        start_read(next);
+      }
+      ring.submit();
+    }
+    while (flight) complete();
+  }
+
+  // The kernel may still be using the slots, so wait for it before letting anyone else have them.
+  catch (std::runtime_error&) {
+    try {
+      uint64_t user;
+      for (; flight; --flight) ring.wait(user);
+    }
+    catch (std::runtime_error&) {}
+    throw;
+  }
+  f.from = start + length;
+}
+
 
 // Main must be explicitly written like this to receive command line arguments.
 // argc is the number of arguments (The program name itself is considered an argument)
 // argv is the list of arguments themselves.
 int main(int argc, char* argv[]) {
 
-  // Seed for the Nonce.
-  std::srand(std::time(0));
-
   // Collect command line arguments.
   std::map<std::string, std::string> arguments;
   for (size_t x = 0; x < argc; ++x) {
@@ -30,7 +249,7 @@ int main(int argc, char* argv[]) {
   // Print the help screen if the user requests it.
   if (arguments.count("--help")) {
     std::stringstream help;
-    help << "Usage: aes (--infile=/path/to/file) (--outfile=/path/to/file) (--keyfile=/path/to/file) [--mode=MODE] (--verbose)\n"
+    help << "Usage: aes (--infile=/path/to/file) (--outfile=/path/to/file) (--keyfile=/path/to/file) [--mode=MODE] (--chunk=BYTES) (--verbose)\n"
         << "--infile: The path to the file. If not provided, read from standard input\n"
         << "--outfile: The path to write to. If not provided, write to standard output\n"
         << "--keyfile: The path to load the key. If not provided, user will be prompted\n"
@@ -38,7 +257,12 @@ int main(int argc, char* argv[]) {
         << "  DEC-192-ECB: Decrypt the infile with AES-ECB with a 192 bit key\n"
         << "  ENC-128-CTR: Encrypt the infile with AES-CTR with a 128 bit key\n"
         << "  Valid options for each field are: ENC/DEC, 128/192/256, ECB/CTR/GCM\n"
-        << "--verbose: Print verbose information to console\n";
+        << "--chunk: How many bytes each thread encrypts at a time in CTR/GCM. 0 uses a single thread. Defaults to 1048576\n"
+        << "--verbose: Print verbose information to console\n"
+        << "--mmap: With both an --infile and an --outfile, in CTR or ECB, map both files into memory, and encrypt\n"
+        << "straight from one into the other\n"
+        << "Given both an --infile and an --outfile, without --verbose, the file is streamed through a buffer at a time,\n"
+        << "rather than being read into memory all at once.\n";
     std::cout << help.str() << std::endl;
     return 0;
   }
@@ -74,6 +298,15 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
+  // Set how the work is split across threads.
+  if (arguments.count("--chunk")) {
+    try {aes::chunk = std::stoull(arguments["--chunk"]);}
+    catch (std::exception&) {
+      std::cerr << "Invalid chunk size: " << arguments["--chunk"] << std::endl;
+      return -1;
+    }
+  }
+
   std::string input;
 
   // Get the key.
@@ -99,8 +332,195 @@ int main(int argc, char* argv[]) {
   for (size_t x = 0; x < keys; ++x)
     key[x] = *reinterpret_cast<uint64_t*>(&input[x * sizeof(uint64_t)]);
 
+  // Expand the key once, for whichever mode we use.
+  const auto ctx = aes::context(key, rounds);
+
   // Get the input. We initialize the Nonce here, even though ECB doesn't use it, and DEC overwrites it.
-  uint64_t nonce = std::rand();
+  // Every bit of it is random, since two files under the same key must never share one.
+  std::random_device entropy;
+  uint64_t nonce = static_cast<uint64_t>(entropy()) << 32 | entropy();
+
+  // Map both files, and run the cipher straight from one into the other, with each thread taking its own slice.
+  // The nonce occupies the first 8 bytes of the ciphertext's file, exactly as it does otherwise.
+  struct stat info;
+  if (arguments.count("--mmap") && arguments.count("--infile") && arguments.count("--outfile") && mode != "GCM") {
+    try {
+      files f;
+      f.in = ::open(arguments["--infile"].c_str(), O_RDONLY | O_CLOEXEC);
+      if (f.in == -1 || fstat(f.in, &info) == -1) throw std::runtime_error("Failed to open the input file!");
+      const size_t length = info.st_size;
+      if (operation == "DEC" && length < sizeof(uint64_t)) throw std::runtime_error("The input file is too short!");
+
+      // The output is as long as the input in CTR. ECB pads, and we only know how much once it's decrypted.
+      const size_t header = operation == "ENC" ? sizeof(uint64_t) : 0;
+      const size_t body = operation == "ENC" ? (mode == "ECB" ? length / 16 * 16 + 16 : length) : length - sizeof(uint64_t);
+      f.out = ::open(arguments["--outfile"].c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (f.out == -1) throw std::runtime_error("Failed to open the output file!");
+
+      // Running out of disk halfway through a mapping raises SIGBUS rather than an error, so we claim the
+      // space up front, where it can still fail gracefully.
+      if (header + body > 0 && posix_fallocate(f.out, 0, header + body) != 0) throw std::runtime_error("Failed to allocate the output file!");
+
+      size_t written = 0;
+      {
+        const mapping in(f.in, length, false), out(f.out, header + body, true);
+        auto source = in.bytes(), destination = out.bytes();
+        if (operation == "ENC") std::copy_n(reinterpret_cast<const std::byte*>(&nonce), sizeof(uint64_t), destination.begin());
+        else std::copy_n(source.begin(), sizeof(uint64_t), reinterpret_cast<std::byte*>(&nonce));
+        source = source.subspan(sizeof(uint64_t) - header);
+        destination = destination.subspan(header);
+
+        if (mode == "CTR") written = aes::Ctr(source, destination, ctx, nonce);
+        else if (operation == "ENC") written = aes::Cipher(source, destination, ctx);
+        else written = aes::InvCipher(source, destination, ctx);
+      }
+
+      // Drop ECB's padding once it's decrypted.
+      if (written != body && ftruncate(f.out, header + written) == -1) throw std::runtime_error("Failed to write the output file!");
+    }
+
+    catch (std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
+    return 0;
+  }
+
+  // With both files, and nothing to print, we never need the whole file in memory. The output is the same.
+  // We read by offset, so the infile has to be a file, rather than something like a pipe.
+  if (arguments.count("--infile") && arguments.count("--outfile") && !arguments.count("--verbose") && stat(arguments["--infile"].c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+    files f;
+    f.in = ::open(arguments["--infile"].c_str(), O_RDONLY | O_CLOEXEC);
+    if (f.in == -1) {
+      std::cerr << "Failed to open the input file!" << std::endl;
+      return -1;
+    }
+
+    // Enough for every thread to get a chunk of keystream at once, and a block to spare for padding.
+    const size_t slot = (pool::shared().size() * std::max<size_t>(aes::chunk, 1 << 16) + 15) / 16 * 16 + 16;
+    if (uring::supported()) {
+      try {f.ring = std::make_unique<uring::ring>(8);}
+      catch (std::runtime_error&) {}
+    }
+    f.slots.assign(f.ring ? 3 : 1, std::vector<char>(slot));
+
+    // Registering is only an optimization, and the kernel may refuse if it would pin too much memory.
+    if (f.ring) {
+      std::vector<iovec> buffers;
+      for (auto& s : f.slots) buffers.push_back({.iov_base = s.data(), .iov_len = s.size()});
+      try {
+        f.ring->register_buffers(buffers);
+        f.registered = true;
+      }
+      catch (std::runtime_error&) {}
+    }
+
+    // The outfile isn't touched until we know we'll write to it; GCM decryption writes elsewhere first.
+    auto open = [&f, &arguments]() {
+      f.out = ::open(arguments["--outfile"].c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (f.out == -1) throw std::runtime_error("Failed to open the output file!");
+
+      // Writes in the ring go by offset, which something like a pipe doesn't have.
+      struct stat out;
+      if (fstat(f.out, &out) == -1 || !S_ISREG(out.st_mode)) f.ring.reset();
+    };
+
+    const auto all = std::numeric_limits<uint64_t>::max();
+
+    // ECB adds its padding to the last buffer, and removes it when decrypting; the rest are whole blocks.
+    try {
+
+      // When decrypting, the nonce is at the start of the file, and the counter starts from it.
+      if (operation == "DEC") {
+        nonce = 0;
+        read_at(f, reinterpret_cast<char*>(&nonce), sizeof(uint64_t));
+      }
+
+      // The output is as long as the input in CTR and GCM; only the last piece can be short of a block.
+      auto ctr = aes::stream(ctx, nonce);
+      auto counter = [&ctr](uint8_t* bytes, const size_t& length, bool) {
+        ctr.update(bytes, length / 16);
+        if (length % 16) ctr.update_last(&bytes[length / 16 * 16], length % 16);
+        return length;
+      };
+
+      if (operation == "ENC") {
+        open();
+        write_at(f, reinterpret_cast<char*>(&nonce), sizeof(uint64_t));
+
+        if (mode == "ECB") pump(f, all, true, [&ctx](uint8_t* bytes, const size_t& length, const bool& last) {
+          const auto data = std::as_writable_bytes(std::span(bytes, length + 16));
+          if (last) return aes::Cipher(data.first(length), data, ctx);
+          aes::ecb::spread(bytes, bytes, length / 16, [&ctx](const uint8_t* i, uint8_t* o, const size_t& n) {aes::encrypt(ctx, i, o, n);});
+          return length;
+        });
+        else if (mode == "CTR") pump(f, all, true, counter);
+        else if (mode == "GCM") {
+          auto gcm = aes::gcm::stream(ctx, nonce);
+          pump(f, all, true, [&gcm](uint8_t* bytes, const size_t& length, bool) {
+            gcm.encrypt(bytes, length / 16);
+            if (length % 16) gcm.encrypt_last(&bytes[length / 16 * 16], length % 16);
+            return length;
+          });
+          const auto tag = gcm.tag();
+          write_at(f, reinterpret_cast<const char*>(tag.data()), tag.size());
+        }
+      }
+
+      else if (operation == "DEC") {
+        if (mode != "GCM") open();
+
+        if (mode == "ECB") pump(f, all, true, [&ctx](uint8_t* bytes, const size_t& length, const bool& last) {
+          const auto data = std::as_writable_bytes(std::span(bytes, length));
+          if (last) return aes::InvCipher(data, data, ctx);
+          aes::ecb::spread(bytes, bytes, length / 16, [&ctx](const uint8_t* i, uint8_t* o, const size_t& n) {aes::decrypt(ctx, i, o, n);});
+          return length;
+        });
+        else if (mode == "CTR") pump(f, all, true, counter);
+
+        // GCM refuses to release anything until the tag matches, so we decrypt into a file of our own next
+        // to the outfile, and only move it over the outfile once the tag matches; otherwise, it's removed.
+        // The file is read just once, and the outfile is never left with a forgery in it.
+        else if (mode == "GCM") {
+          if (uint64_t(info.st_size) < sizeof(uint64_t) + 16) throw std::runtime_error("Message does not match! Refusing to decrypt!");
+          const uint64_t cipher = info.st_size - sizeof(uint64_t) - 16;
+
+          // Something like a pipe can't be replaced by renaming over it.
+          const auto& path = arguments["--outfile"];
+          struct stat out;
+          if (stat(path.c_str(), &out) == 0 && !S_ISREG(out.st_mode)) throw std::runtime_error("GCM decryption needs the output to be a regular file!");
+
+          auto temporary = path + ".XXXXXX";
+          f.out = mkostemp(temporary.data(), O_CLOEXEC);
+          if (f.out == -1) throw std::runtime_error("Failed to open the output file!");
+          try {
+            if (fchmod(f.out, 0644) == -1) throw std::runtime_error("Failed to open the output file!");
+
+            auto gcm = aes::gcm::stream(ctx, nonce);
+            pump(f, cipher, true, [&gcm](uint8_t* bytes, const size_t& length, bool) {
+              gcm.decrypt(bytes, length / 16);
+              if (length % 16) gcm.decrypt_last(&bytes[length / 16 * 16], length % 16);
+              return length;
+            });
+
+            aes::block tag;
+            read_at(f, reinterpret_cast<char*>(tag.data()), tag.size());
+            if (!aes::gcm::equal(tag.data(), gcm.tag().data())) throw std::runtime_error("Message does not match! Refusing to decrypt!");
+            if (std::rename(temporary.c_str(), path.c_str()) == -1) throw std::runtime_error("Failed to write the output file!");
+          }
+          catch (std::runtime_error&) {
+            unlink(temporary.c_str());
+            throw;
+          }
+        }
+      }
+    }
+    catch (std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
+    return 0;
+  }
 
   // Get our infile
   if (arguments.count("--infile")) {
@@ -137,9 +557,9 @@ int main(int argc, char* argv[]) {
 
     // Generate the ciphertext.
     std::string cipher;
-    if (mode == "ECB") cipher = aes::Cipher(input, key, rounds);
-    else if (mode == "CTR") cipher = aes::Ctr(input, key, rounds, nonce);
-    else if (mode == "GCM") cipher = aes::gcm::Enc(input, key, rounds, nonce);
+    if (mode == "ECB") cipher = aes::Cipher(input, ctx);
+    else if (mode == "CTR") cipher = aes::Ctr(input, ctx, nonce);
+    else if (mode == "GCM") cipher = aes::gcm::Enc(input, ctx, nonce);
 
     // If there is no outfile, or there is one but we want verbose output, print the values.
     if (!arguments.count("--outfile") || arguments.count("--verbose")) {
@@ -164,9 +584,15 @@ int main(int argc, char* argv[]) {
 
     // Generate the plaintext.
     std::string plain;
-    if (mode == "ECB") plain = aes::InvCipher(input, key, rounds);
-    else if (mode == "CTR") plain = aes::Ctr(input, key, rounds, nonce);
-    else if (mode == "GCM") plain = aes::gcm::Dec(input, key, rounds, nonce);
+    try {
+      if (mode == "ECB") plain = aes::InvCipher(input, ctx);
+      else if (mode == "CTR") plain = aes::Ctr(input, ctx, nonce);
+      else if (mode == "GCM") plain = aes::gcm::Dec(input, ctx, nonce);
+    }
+    catch (std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
 
     // If there isn't an outfile, or there is one but we are verbose, print values to console.
     if (!arguments.count("--outfile") || arguments.count("--verbose")) {
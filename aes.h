@@ -6,6 +6,32 @@
 #include <bitset>   // For raw bit access.
 #include <bit>      // For rotl
 #include <array>    // For the shared key array.
+#include <algorithm> // For std::copy and std::min
+#include <span>     // For pieces of a message.
+#include <cstring>  // For std::memmove
+#include <new>      // For aligned allocation.
+#include <type_traits> // To check state_array stays trivially copyable.
+#include <memory>   // For the schedules a context shares.
+#include <mutex>    // To build each of them once.
+
+#include "pool.h"   // To spread CTR across threads.
+#include "trace.h"  // For counting where the time goes.
+
+// The hardware backend uses the CPU's own AES instructions, if it has them.
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+  #define AES_HARDWARE __attribute__((target("aes,sse4.1")))
+  // The bitsliced engine shuffles bytes constantly, which SSSE3 does in one instruction; pick it at load time.
+  #define AES_BITSLICE __attribute__((target_clones("ssse3", "default")))
+#elif defined(__aarch64__)
+  #include <arm_neon.h>
+  #include <sys/auxv.h>
+  #include <asm/hwcap.h>
+  #define AES_HARDWARE __attribute__((target("+crypto")))
+#endif
+#if !defined(AES_BITSLICE)
+  #define AES_BITSLICE
+#endif
 
 /**
  * @brief The namespace containing AES encryption/decryption functions.
@@ -46,7 +72,7 @@ namespace aes {
      * @remarks Most implementations would avoid this, and simply compute a 256x256 lookup
      * table containing all values, like how SubBytes works.
      */
-    uint8_t mult(uint8_t a, uint8_t b) {
+    constexpr uint8_t mult(uint8_t a, uint8_t b) {
       // This function looks confusing, and that's because it is, but here's the rundown:
       // Addition in a finite field of characteristic 2 (GF(2**X)) is simply XOR.
       // This is nice, because we avoid carries and XOR is fast.
@@ -103,7 +129,7 @@ namespace aes {
     * But for the sake of simplicity (And since there's only 256 values to check),
     * We can just brute force it by checking against every value.
     */
-    uint8_t inverse(uint8_t a) {
+    constexpr uint8_t inverse(uint8_t a) {
       for (size_t x = 0; x < 256; ++x) {
         if (mult(a, x) == 1) return x;
       }
@@ -112,6 +138,108 @@ namespace aes {
   }
 
 
+  /**
+   * @brief Precomputed substitution tables.
+   * @remarks Every figure in this namespace is computed by the compiler, using the very same
+   * gf::inverse and affine transformation as the reference SubBytes. The result is exactly
+   * Table 4 (And Table 6) of the Reference, but we never had to copy it by hand.
+   */
+  namespace sbox {
+
+    /**
+     * @brief The affine transformation applied after taking the inverse in SubBytes.
+     * @param i: The multiplicative inverse of the byte.
+     * @returns The substituted byte.
+     * @remarks This is the same expression as state_array::SubBytes, just without std::bitset,
+     * which cannot be used at compile time.
+     */
+    constexpr uint8_t affine(const uint8_t& i) {
+      uint8_t result = 0;
+      for (int x = 0; x < 8; ++x) {
+        const uint8_t bit = (i >> x) ^ (i >> (x + 4) % 8) ^ (i >> (x + 5) % 8) ^ (i >> (x + 6) % 8) ^ (i >> (x + 7) % 8) ^ (0b01100011 >> x);
+        result |= (bit & 1) << x;
+      }
+      return result;
+    }
+
+
+    /**
+     * @brief Undo the affine transformation; see state_array::InvSubBytes
+     * @param byte: The substituted byte.
+     * @returns The multiplicative inverse of the original byte.
+     */
+    constexpr uint8_t inv_affine(const uint8_t& byte) {
+      return std::rotl(byte, 1) ^ std::rotl(byte, 3) ^ std::rotl(byte, 6) ^ 0b00000101;
+    }
+
+
+    /**
+     * @brief The forward S-box, indexed by the input byte.
+     */
+    constexpr std::array<uint8_t, 256> forward = [] {
+      std::array<uint8_t, 256> table = {0};
+      for (size_t x = 0; x < 256; ++x) table[x] = affine(gf::inverse(x));
+      return table;
+    }();
+
+
+    /**
+     * @brief The inverse S-box, indexed by the substituted byte.
+     */
+    constexpr std::array<uint8_t, 256> inverse = [] {
+      std::array<uint8_t, 256> table = {0};
+      for (size_t x = 0; x < 256; ++x) table[x] = gf::inverse(inv_affine(x));
+      return table;
+    }();
+
+    // If these fail, the tables do not match the Reference.
+    static_assert(forward[0x00] == 0x63 && forward[0x53] == 0xed && forward[0xff] == 0x16);
+    static_assert(inverse[0x63] == 0x00 && inverse[0xed] == 0x53 && inverse[0x16] == 0xff);
+  }
+
+
+  /**
+   * @brief The implementations available for the AES transformations.
+   * @var REFERENCE: Calculate every substitution by hand, exactly as the Reference describes.
+   * @var TABLE: Look substitutions up in the precomputed sbox tables.
+   * @var TTABLE: Run each block through every round at once with the ttable engine.
+   * @var HARDWARE: Use the AES instructions of the CPU (AES-NI, or the ARMv8 Crypto Extensions).
+   * @var BITSLICE: Run eight blocks at once through boolean circuits, without any table lookups.
+   * @remarks REFERENCE exists to show how AES works, and to check the other backends against.
+   */
+  typedef enum {REFERENCE, TABLE, TTABLE, HARDWARE, BITSLICE} backend;
+
+
+  /**
+   * @brief Check whether the CPU can run the HARDWARE backend.
+   * @returns True if the AES instructions are available.
+   */
+  bool supported() {
+  #if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse4.1");
+  #elif defined(__aarch64__) && defined(__linux__)
+    return getauxval(AT_HWCAP) & HWCAP_AES;
+  #else
+    return false;
+  #endif
+  }
+
+
+  /**
+   * @brief The backend that is currently in use.
+   * @remarks This is chosen when the program starts, and picks the hardware if it can. Otherwise, it picks
+   * BITSLICE, whose rounds run in constant time, unlike the lookups of TTABLE; see bitslice for what else
+   * still doesn't.
+   * @warning Selecting HARDWARE on a CPU that does not support it will crash the program.
+   */
+  backend engine = supported() ? HARDWARE : BITSLICE;
+
+
+  // Whether the engine works on whole blocks directly, rather than through a state.
+  inline bool bulk() {return engine == TTABLE || engine == HARDWARE || engine == BITSLICE;}
+
+
   /**
    * @brief Manage the key.
    */
@@ -155,6 +283,12 @@ namespace aes {
       // Get the bytes
       auto* bytes = reinterpret_cast<const uint8_t*>(&word);
 
+      // Outside the reference backend, just use the table.
+      if (engine != REFERENCE) {
+        for (size_t x = 0; x < 4; ++x) dest[x] = sbox::forward[bytes[x]];
+        return *reinterpret_cast<uint32_t*>(&dest[0]);
+      }
+
       for (size_t x = 0; x < 4; ++x) {
         // See state_array::SubBytes for an explanation of what this does.
         const uint8_t byte = bytes[x];
@@ -234,9 +368,47 @@ namespace aes {
       }
       return w;
     }
+
+
+    /**
+     * @brief Expand a key for a given number of rounds.
+     * @param k: The key.
+     * @param Nr: The number of rounds.
+     * @returns The key schedule.
+     * @throws std::runtime_error If the Nr rounds is not 10,12,14.
+     */
+    std::vector<uint32_t> Schedule(const std::array<uint64_t, 4>& k, const uint64_t& Nr) {
+      switch (Nr) {
+        case 10: return Expansion(k, 4);
+        case 12: return Expansion(k, 6);
+        case 14: return Expansion(k, 8);
+        default: throw std::runtime_error("Invalid key size:" + std::to_string(Nr));
+      }
+    }
   }
 
 
+  /**
+   * @brief An allocator that aligns what it allocates, by default to a cache line.
+   * @tparam T: The type being allocated.
+   * @tparam Align: The alignment, in bytes.
+   * @remarks A state keeps its blocks in one of these, so that the first block starts a cache line,
+   * and every block can be loaded as a single aligned 128-bit value.
+   */
+  template <typename T, size_t Align = 64> struct aligned {
+    typedef T value_type;
+    template <typename U> struct rebind {typedef aligned<U, Align> other;};
+
+    aligned() {}
+    template <typename U> aligned(const aligned<U, Align>&) {}
+
+    T* allocate(const size_t& n) {return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));}
+    void deallocate(T* p, const size_t&) {::operator delete(p, std::align_val_t(Align));}
+
+    template <typename U> bool operator==(const aligned<U, Align>&) const {return true;}
+  };
+
+
   /**
    * @brief The state array is a 4x4 byte matrix to which
    * AES operations are performed; also called a block.
@@ -245,12 +417,13 @@ namespace aes {
    * state_array[1] = [4,5,6,7]
    * @remarks See Figure 1 of the Reference.
    */
-  class state_array {
+  class alignas(16) state_array {
   private:
 
     // The state array is fixed in size; usually, we can assume
     // that char is a byte, but we'll use the explicit, fixed width
     // uint8 to ensure that each entry in the array is 8 bits.
+    // array[i / 4][i % 4] is byte i of the block, so in memory, this is just the 16 bytes in order.
     std::array<std::array<uint8_t, 4>, 4> array;
 
   public:
@@ -293,14 +466,9 @@ namespace aes {
     }
 
 
-    // Copy constructor.
-    state_array(const state_array& arr) {
-      for (uint8_t row = 0; row < 4; ++row) {
-        for (uint8_t col = 0; col < 4; ++col) {
-          array[row][col] = arr.array[row][col];
-        }
-      }
-    }
+    // Copy constructor. Leaving this to the compiler keeps state_array trivially copyable, so copies are a single move.
+    state_array(const state_array& arr) = default;
+    state_array& operator=(const state_array& arr) = default;
 
 
     // Default constructor, populated with 0s.
@@ -317,14 +485,23 @@ namespace aes {
     auto& get() {return array;}
     const auto& get() const {return array;}
 
+    // The block as 16 bytes, in order.
+    uint8_t* data() {return &array[0][0];}
+    const uint8_t* data() const {return &array[0][0];}
+
+
+    // The block as two 64 bit words, which the compiler can load as one 128-bit value.
+    std::array<uint64_t, 2> words() const {return std::bit_cast<std::array<uint64_t, 2>>(array);}
+    void set_words(const std::array<uint64_t, 2>& words) {array = std::bit_cast<decltype(array)>(words);}
+
 
     // Helper function for GCM to XOR two blocks together.
     void xor_arr(const state_array& arr) {
-      for (uint8_t row = 0; row < 4; ++row) {
-        for (uint8_t col = 0; col < 4; ++col) {
-          array[col][row] ^= arr.array[col][row];
-        }
-      }
+      auto a = words();
+      const auto b = arr.words();
+      a[0] ^= b[0];
+      a[1] ^= b[1];
+      set_words(a);
     }
 
 
@@ -377,13 +554,13 @@ namespace aes {
      * @returns The string.
      */
     std::string unravel() const {
-      std::stringstream out;
+      std::string out(16, '\0');
       for (uint8_t row = 0; row < 4; ++row) {
         for (uint8_t col = 0; col < 4; ++col) {
-          out << array[row][col];
+          out[4 * row + col] = array[row][col];
         }
       }
-      return out.str();
+      return out;
     }
 
 
@@ -415,8 +592,14 @@ namespace aes {
      * Table 4 of the Reference provides said table, which we can use for O(1) efficiency.
      * To better understand the process, here we manually calculate each byte, at the expense of speed.
      * @remarks This step of AES provides non-linearity, and ensures that The resultant byte is not the same as the input.
+     * @remarks Unless the REFERENCE engine is selected, we do use the table, sbox::forward.
      */
     void SubBytes() {
+      if (engine != REFERENCE) {
+        for (auto& column : array) for (auto& byte : column) byte = sbox::forward[byte];
+        return;
+      }
+
       for (uint8_t row = 0; row < 4; ++row) {
         for (uint8_t col = 0; col < 4; ++col) {
 
@@ -455,8 +638,14 @@ namespace aes {
      * @remarks As a testament to the ubiquity and performance of using a lookup table over manual calculation:
      * The Reference does not provide formulas for this stage, and I couldn't find any implementation that doesn't just use
      * InvSBox.
+     * @remarks Unless the REFERENCE engine is selected, we do too: sbox::inverse.
      */
     void InvSubBytes() {
+      if (engine != REFERENCE) {
+        for (auto& column : array) for (auto& byte : column) byte = sbox::inverse[byte];
+        return;
+      }
+
       for (uint8_t row = 0; row < 4; ++row) {
         for (uint8_t col = 0; col < 4; ++col) {
           const uint8_t byte = array[col][row];
@@ -609,12 +798,21 @@ namespace aes {
   };
 
 
+  // The blocks are laid out back to back, so a state_array can be treated as an aligned 16 byte block.
+  static_assert(sizeof(state_array) == 16 && alignof(state_array) == 16);
+  static_assert(std::is_trivially_copyable_v<state_array>);
+
+
   /**
    * @brief An arbitrary collection of state arrays.
+   * @remarks The arrays are one contiguous, cache-aligned buffer, which data() exposes as plain bytes.
    */
   class state {
+  public:
+    typedef std::vector<state_array, aligned<state_array>> storage;
+
   private:
-    std::vector<state_array> arrays;
+    storage arrays;
     std::vector<uint32_t> expanded;
     std::array<uint64_t, 4> key = {0};
     uint64_t rounds = 0;
@@ -626,14 +824,7 @@ namespace aes {
      * @param Nr: The number of rounds.
      * @throws std::runtime_error If the Nr rounds is not 10,12,14.
      */
-    void Schedule(const std::array<uint64_t, 4>& k, const uint64_t& Nr) {
-      switch (Nr) {
-        case 10: expanded = key::Expansion(k, 4); break;
-        case 12: expanded = key::Expansion(k, 6); break;
-        case 14: expanded = key::Expansion(k, 8); break;
-        default: throw std::runtime_error("Invalid key size:" + std::to_string(Nr));
-      }
-    }
+    void Schedule(const std::array<uint64_t, 4>& k, const uint64_t& Nr) {expanded = key::Schedule(k, Nr);}
 
 
   public:
@@ -643,43 +834,77 @@ namespace aes {
 
       // Get our key schedule.
       Schedule(k, Nr);
-      size_t x = 0;
 
-      // The state_array constructor takes a mutable reference to x,
-      // and will increment it automatically. Therefore, we just need
-      // to repeatedly construct state_arrays until the string has been exhausted.
-      while (x < in.length()) {arrays.emplace_back(state_array(in, x));}
+      // We could repeatedly construct state_arrays until the string has been exhausted,
+      // but since the arrays are contiguous, that's the same as copying the string straight in.
+      fill(std::as_bytes(std::span(in)));
 
       key = k;
       rounds = Nr;
     }
 
 
+    // Construct a state from a input string, with a key schedule that has already been expanded.
+    state(const std::string& in, const std::vector<uint32_t>& schedule, const uint64_t& Nr) {
+      fill(std::as_bytes(std::span(in)));
+      expanded = schedule;
+      rounds = Nr;
+    }
+
+
     // Construct a state from a collection of state_arrays.
     state(const std::vector<state_array>& arrs, const std::array<uint64_t, 4>& k, const uint64_t& Nr) {
       Schedule(k, Nr);
-      arrays = arrs;
+      arrays.assign(arrs.begin(), arrs.end());
       key = k;
       rounds = Nr;
     }
 
 
+    // Construct a state from a collection of state_arrays, with a key schedule that has already been expanded.
+    state(const std::vector<state_array>& arrs, const std::vector<uint32_t>& schedule, const uint64_t& Nr) {
+      arrays.assign(arrs.begin(), arrs.end());
+      expanded = schedule;
+      rounds = Nr;
+    }
+
+
+    // Construct a state from raw bytes, with a key schedule that has already been expanded.
+    state(std::span<const std::byte> in, const std::vector<uint32_t>& schedule, const uint64_t& Nr) {
+      fill(in);
+      expanded = schedule;
+      rounds = Nr;
+    }
+
+
     // Getters
     auto& get_arrays() {return arrays;}
     const auto& get_arrays() const {return arrays;}
     const auto& get_key() {return key;}
     const auto& get_rounds() {return rounds;}
 
+    // The blocks, as one run of bytes.
+    uint8_t* data() {return arrays.empty() ? nullptr : arrays.front().data();}
+    const uint8_t* data() const {return arrays.empty() ? nullptr : arrays.front().data();}
+    size_t size() const {return 16 * arrays.size();}
+
+
+    /**
+     * @brief Replace the blocks with bytes, padding the last with 0s.
+     * @param in: The bytes.
+     */
+    void fill(std::span<const std::byte> in) {
+      arrays.assign((in.size() + 15) / 16, state_array());
+      if (!in.empty()) std::memcpy(data(), in.data(), in.size());
+    }
+
 
     /**
      * @brief Unravel a state into a character string.
      * @returns A string.
      */
     std::string unravel() const {
-      std::stringstream out;
-      for (const auto& array : arrays)
-        out << array.unravel();
-      return out.str();
+      return std::string(reinterpret_cast<const char*>(data()), size());
     }
 
 
@@ -705,140 +930,1708 @@ namespace aes {
 
 
   /**
-   * @brief Encrypt a message with AES
+   * @brief Pad a string with 0s until it fills a whole number of blocks.
    * @param in: The input string.
-   * @param k: The key
-   * @param Nr: The number of rounds we should run (Determine how much of the key is used).
-   * @remarks This function is intentionally a verbatim translation of the
-   * pseudo-code outlined in Algorithm 1 of the Reference.
-   * @warning This function, on its own is no different from ECB!
+   * @returns The padded string.
+   * @remarks This is exactly what constructing a state does to its input.
    */
-  std::string Cipher(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t& Nr) {
-    auto s = state(in, k, Nr);
-    s.AddRoundKey(0);
-
-    for (size_t x = 0; x < Nr - 1; ++x) {
-      s.SubBytes();
-      s.ShiftRows();
-      s.MixColumns();
-      s.AddRoundKey(x + 1);
-    }
+  std::string pad(const std::string& in) {
+    auto out = in;
+    out.resize((in.length() + 15) / 16 * 16, '\0');
+    return out;
+  }
 
-    s.SubBytes();
-    s.ShiftRows();
-    s.AddRoundKey(Nr - 1);
 
-    return s.unravel();
+  /**
+   * @brief Copy a message into a buffer, padded with 0s until it fills a whole number of blocks.
+   * @param in: The message.
+   * @param out: The buffer. It may be the same memory as in, to work in place.
+   * @param extra: How many more bytes the caller needs after the padded message.
+   * @returns The padded length.
+   * @throws std::runtime_error If out is too small.
+   */
+  size_t pad(std::span<const std::byte> in, std::span<std::byte> out, const size_t& extra = 0) {
+    const size_t length = (in.size() + 15) / 16 * 16;
+    if (out.size() < length + extra) throw std::runtime_error("Output buffer is too small!");
+    if (out.data() != in.data()) std::memmove(out.data(), in.data(), in.size());
+    std::fill(out.begin() + in.size(), out.begin() + length, std::byte{0});
+    return length;
   }
 
 
   /**
-   * @brief Decrypt a message with AES
-   * @param in: The input string.
-   * @param k: The key
-   * @param Nr: The number of rounds to run.
-   * @remarks This function is intentionally a verbatim translation of the
-   * pseudo-code outlined in Algorithm 3 of the Reference.
-   * @warning This function, on its own is no different from ECB!
+   * @brief PKCS#7 padding, which ECB uses so that decrypting returns exactly the message.
+   * @remarks Padding with 0s can't be undone, since the message might end in 0s itself. PKCS#7 instead
+   * adds between 1 and 16 bytes, each holding how many were added, so a message that already fills its
+   * blocks gets a whole block more. CTR and GCM don't need any of this; they just drop the keystream
+   * they don't use.
    */
-  std::string InvCipher(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t& Nr) {
-    auto s = state(in, k, Nr);
+  namespace pkcs7 {
 
-    // Because the AddRoundKey is literally just XOR, running it again, but in reverse (Nr-1 -> 0),
-    // undoes the operation, so we don't need a dedicated InvAddRoundKey like the other
-    // steps.
-    s.AddRoundKey(Nr - 1);
+    /**
+     * @brief Copy a message into a buffer, and pad it.
+     * @param in: The message.
+     * @param out: The buffer. It may be the same memory as in, to work in place.
+     * @returns The padded length, which is always more than in.
+     * @throws std::runtime_error If out is too small.
+     */
+    size_t pad(std::span<const std::byte> in, std::span<std::byte> out) {
+      const size_t length = in.size() / 16 * 16 + 16;
+      if (out.size() < length) throw std::runtime_error("Output buffer is too small!");
+      if (out.data() != in.data()) std::memmove(out.data(), in.data(), in.size());
+      std::fill(out.begin() + in.size(), out.begin() + length, std::byte(length - in.size()));
+      return length;
+    }
 
-    for (size_t x = Nr - 1; x >= 1; --x) {
-      s.InvShiftRows();
-      s.InvSubBytes();
-      s.AddRoundKey(x);
-      s.InvMixColumns();
+
+    /**
+     * @brief Pad a string.
+     * @param in: The message.
+     * @returns The padded string.
+     */
+    std::string pad(const std::string& in) {
+      std::string out(in.length() / 16 * 16 + 16, '\0');
+      pad(std::as_bytes(std::span(in)), std::as_writable_bytes(std::span(out)));
+      return out;
     }
 
-    s.InvShiftRows();
-    s.InvSubBytes();
-    s.AddRoundKey(0);
 
-    return s.unravel();
+    /**
+     * @brief Find where the padding starts.
+     * @param in: The padded message.
+     * @returns The length of the message without its padding.
+     * @throws std::runtime_error If in isn't whole blocks, or doesn't end in valid padding.
+     * @remarks Every byte of the last block is checked, whatever the padding claims, so how long this
+     * takes doesn't depend on where it's wrong.
+     */
+    size_t unpad(std::span<const std::byte> in) {
+      if (in.empty() || in.size() % 16 != 0) throw std::runtime_error("Invalid padding!");
+      const auto count = static_cast<uint8_t>(in.back());
+      uint8_t bad = count == 0 || count > 16;
+      for (size_t x = 1; x <= 16; ++x) {
+        if (x <= count) bad |= static_cast<uint8_t>(in[in.size() - x]) ^ count;
+      }
+      if (bad) throw std::runtime_error("Invalid padding!");
+      return in.size() - count;
+    }
   }
 
 
   /**
-   * @brief An implementation of AES in CTR mode.
-   * @param in: The input string.
-   * @param k: The key.
-   * @param Nr: The number of rounds to perform.
-   * @param nonce: The nonce value to use.
-   * @remark CTR mode generates a OTP that is then XOR'ed to the message. Therefore, Encryption/Decryption
-   * Uses the same function.
+   * @brief A faster engine that fuses SubBytes, ShiftRows and MixColumns into table lookups.
+   * @remarks The 2002 Paper describes this in its section on 32-bit platforms. Each column of the
+   * state is held as a single 32 bit word (Row 0 in the most significant byte), and because every
+   * step but AddRoundKey works byte-by-byte and is linear afterwards, the whole round collapses into
+   * four lookups and four XORs per column. Where state_array needs four passes over the block for
+   * every round, this engine keeps a block in four registers until all of its rounds are done.
+   * @remarks The tables are 4KB each, and which entry we touch depends on the data, so this is
+   * neither the smallest nor a constant-time implementation.
    */
-  std::string Ctr(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t Nr, uint64_t nonce) {
-    // We just use this to partition the input into individual state_arrays.
-    auto s = state(in, k, Nr);
+  namespace ttable {
 
-    // Go through each array.
-    for (auto& array: s.get_arrays()) {
+    /**
+     * @brief The encryption tables.
+     * @remarks Te[0][x] is the column MixColumns produces from SubBytes(x) sitting in row 0:
+     * {02, 01, 01, 03} * S[x]. The other three tables are that column rotated for the other rows.
+     */
+    constexpr std::array<std::array<uint32_t, 256>, 4> Te = [] {
+      std::array<std::array<uint32_t, 256>, 4> table = {};
+      for (size_t x = 0; x < 256; ++x) {
+        const uint32_t s = sbox::forward[x];
+        const uint32_t word = (uint32_t(gf::mult(0x2, s)) << 24) | (s << 16) | (s << 8) | gf::mult(0x3, s);
+        for (size_t row = 0; row < 4; ++row) table[row][x] = std::rotr(word, 8 * row);
+      }
+      return table;
+    }();
 
-      // Generate a Pad for it.
-      auto pad = state_array(Cipher(std::string(reinterpret_cast<char*>(&nonce), sizeof(uint64_t)), k, Nr));
 
-      // XOR
-      array.xor_arr(pad);
+    /**
+     * @brief The decryption tables.
+     * @remarks Td[0][x] is the column InvMixColumns produces from InvSubBytes(x) sitting in row 0:
+     * {0e, 09, 0d, 0b} * InvS[x].
+     */
+    constexpr std::array<std::array<uint32_t, 256>, 4> Td = [] {
+      std::array<std::array<uint32_t, 256>, 4> table = {};
+      for (size_t x = 0; x < 256; ++x) {
+        const uint8_t s = sbox::inverse[x];
+        const uint32_t word = (uint32_t(gf::mult(0xe, s)) << 24) | (uint32_t(gf::mult(0x9, s)) << 16) | (uint32_t(gf::mult(0xd, s)) << 8) | gf::mult(0xb, s);
+        for (size_t row = 0; row < 4; ++row) table[row][x] = std::rotr(word, 8 * row);
+      }
+      return table;
+    }();
 
-      // Increment the nonce for the next array.
-      nonce++;
+
+    // Read and write a column as a word, row 0 first.
+    inline uint32_t load(const uint8_t* bytes) {
+      return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | bytes[3];
+    }
+    inline void store(const uint32_t& word, uint8_t* bytes) {
+      bytes[0] = word >> 24; bytes[1] = word >> 16; bytes[2] = word >> 8; bytes[3] = word;
     }
 
-    // Unravel the state.
-    return s.unravel();
+
+    /**
+     * @brief Rearrange a key schedule into the columns the engine adds each round.
+     * @param expanded: The schedule from key::Schedule.
+     * @param Nr: The number of rounds.
+     * @returns Nr + 1 round keys, four columns each.
+     * @remarks state_array::AddRoundKey adds byte c of key word r to column c, row r, so each
+     * round key is the transpose of its four words.
+     * @remarks Cipher finishes with AddRoundKey(Nr - 1) instead of Nr, so the final round key
+     * is a copy of the one before it.
+     */
+    std::vector<uint32_t> encryption(const std::vector<uint32_t>& expanded, const uint64_t& Nr) {
+      std::vector<uint32_t> ek(4 * (Nr + 1), 0);
+      for (size_t round = 0; round <= Nr; ++round) {
+        const size_t source = round == Nr ? Nr - 1 : round;
+        for (size_t col = 0; col < 4; ++col) {
+          for (size_t row = 0; row < 4; ++row)
+            ek[4 * round + col] |= ((expanded[4 * source + row] >> (8 * col)) & 0xff) << (24 - 8 * row);
+        }
+      }
+      return ek;
+    }
+
+
+    /**
+     * @brief Generate the key schedule for the Equivalent Inverse Cipher.
+     * @param ek: The encryption schedule.
+     * @param Nr: The number of rounds.
+     * @returns The decryption schedule.
+     * @remarks See 5.3.5 of the Reference. InvCipher runs AddRoundKey before InvMixColumns, but
+     * since InvMixColumns is linear, we can swap the two if we run the key through InvMixColumns
+     * as well. Then decryption has the same shape as encryption, and can use the same lookups.
+     * @remarks Td[0][S[x]] is exactly InvMixColumns of x in row 0, so the tables do it for us.
+     */
+    std::vector<uint32_t> decryption(const std::vector<uint32_t>& ek, const uint64_t& Nr) {
+      std::vector<uint32_t> dk(ek.size(), 0);
+      for (size_t round = 0; round <= Nr; ++round) {
+        for (size_t col = 0; col < 4; ++col) {
+          uint32_t word = ek[4 * (Nr - round) + col];
+
+          // The first and last key never go through InvMixColumns.
+          if (round != 0 && round != Nr) {
+            word =
+              Td[0][sbox::forward[word >> 24]] ^ Td[1][sbox::forward[(word >> 16) & 0xff]] ^
+              Td[2][sbox::forward[(word >> 8) & 0xff]] ^ Td[3][sbox::forward[word & 0xff]];
+          }
+          dk[4 * round + col] = word;
+        }
+      }
+      return dk;
+    }
+
+
+    /**
+     * @brief Encrypt a run of blocks.
+     * @param ek: The schedule from ttable::encryption.
+     * @param Nr: The number of rounds.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks to encrypt.
+     */
+    void encrypt(const std::vector<uint32_t>& ek, const uint64_t& Nr, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      for (size_t b = 0; b < blocks; ++b, in += 16, out += 16) {
+        const uint32_t* rk = ek.data();
+
+        // AddRoundKey(0)
+        uint32_t
+          s0 = load(in) ^ rk[0], s1 = load(in + 4) ^ rk[1],
+          s2 = load(in + 8) ^ rk[2], s3 = load(in + 12) ^ rk[3];
+
+        // Row r of column c comes from column c + r (ShiftRows), and each table handles one row.
+        for (size_t round = 1; round < Nr; ++round) {
+          rk += 4;
+          const uint32_t
+            t0 = Te[0][s0 >> 24] ^ Te[1][(s1 >> 16) & 0xff] ^ Te[2][(s2 >> 8) & 0xff] ^ Te[3][s3 & 0xff] ^ rk[0],
+            t1 = Te[0][s1 >> 24] ^ Te[1][(s2 >> 16) & 0xff] ^ Te[2][(s3 >> 8) & 0xff] ^ Te[3][s0 & 0xff] ^ rk[1],
+            t2 = Te[0][s2 >> 24] ^ Te[1][(s3 >> 16) & 0xff] ^ Te[2][(s0 >> 8) & 0xff] ^ Te[3][s1 & 0xff] ^ rk[2],
+            t3 = Te[0][s3 >> 24] ^ Te[1][(s0 >> 16) & 0xff] ^ Te[2][(s1 >> 8) & 0xff] ^ Te[3][s2 & 0xff] ^ rk[3];
+          s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+        }
+
+        // The last round has no MixColumns, so we just use the S-box.
+        rk += 4;
+        const auto& S = sbox::forward;
+        store(((uint32_t(S[s0 >> 24]) << 24) | (uint32_t(S[(s1 >> 16) & 0xff]) << 16) | (uint32_t(S[(s2 >> 8) & 0xff]) << 8) | S[s3 & 0xff]) ^ rk[0], out);
+        store(((uint32_t(S[s1 >> 24]) << 24) | (uint32_t(S[(s2 >> 16) & 0xff]) << 16) | (uint32_t(S[(s3 >> 8) & 0xff]) << 8) | S[s0 & 0xff]) ^ rk[1], out + 4);
+        store(((uint32_t(S[s2 >> 24]) << 24) | (uint32_t(S[(s3 >> 16) & 0xff]) << 16) | (uint32_t(S[(s0 >> 8) & 0xff]) << 8) | S[s1 & 0xff]) ^ rk[2], out + 8);
+        store(((uint32_t(S[s3 >> 24]) << 24) | (uint32_t(S[(s0 >> 16) & 0xff]) << 16) | (uint32_t(S[(s1 >> 8) & 0xff]) << 8) | S[s2 & 0xff]) ^ rk[3], out + 12);
+      }
+    }
+
+
+    /**
+     * @brief Decrypt a run of blocks.
+     * @param dk: The schedule from ttable::decryption.
+     * @param Nr: The number of rounds.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks to decrypt.
+     * @remarks Identical to encrypt, but InvShiftRows takes row r of column c from column c - r.
+     */
+    void decrypt(const std::vector<uint32_t>& dk, const uint64_t& Nr, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      for (size_t b = 0; b < blocks; ++b, in += 16, out += 16) {
+        const uint32_t* rk = dk.data();
+        uint32_t
+          s0 = load(in) ^ rk[0], s1 = load(in + 4) ^ rk[1],
+          s2 = load(in + 8) ^ rk[2], s3 = load(in + 12) ^ rk[3];
+
+        for (size_t round = 1; round < Nr; ++round) {
+          rk += 4;
+          const uint32_t
+            t0 = Td[0][s0 >> 24] ^ Td[1][(s3 >> 16) & 0xff] ^ Td[2][(s2 >> 8) & 0xff] ^ Td[3][s1 & 0xff] ^ rk[0],
+            t1 = Td[0][s1 >> 24] ^ Td[1][(s0 >> 16) & 0xff] ^ Td[2][(s3 >> 8) & 0xff] ^ Td[3][s2 & 0xff] ^ rk[1],
+            t2 = Td[0][s2 >> 24] ^ Td[1][(s1 >> 16) & 0xff] ^ Td[2][(s0 >> 8) & 0xff] ^ Td[3][s3 & 0xff] ^ rk[2],
+            t3 = Td[0][s3 >> 24] ^ Td[1][(s2 >> 16) & 0xff] ^ Td[2][(s1 >> 8) & 0xff] ^ Td[3][s0 & 0xff] ^ rk[3];
+          s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+        }
+
+        rk += 4;
+        const auto& S = sbox::inverse;
+        store(((uint32_t(S[s0 >> 24]) << 24) | (uint32_t(S[(s3 >> 16) & 0xff]) << 16) | (uint32_t(S[(s2 >> 8) & 0xff]) << 8) | S[s1 & 0xff]) ^ rk[0], out);
+        store(((uint32_t(S[s1 >> 24]) << 24) | (uint32_t(S[(s0 >> 16) & 0xff]) << 16) | (uint32_t(S[(s3 >> 8) & 0xff]) << 8) | S[s2 & 0xff]) ^ rk[1], out + 4);
+        store(((uint32_t(S[s2 >> 24]) << 24) | (uint32_t(S[(s1 >> 16) & 0xff]) << 16) | (uint32_t(S[(s0 >> 8) & 0xff]) << 8) | S[s3 & 0xff]) ^ rk[2], out + 8);
+        store(((uint32_t(S[s3 >> 24]) << 24) | (uint32_t(S[(s2 >> 16) & 0xff]) << 16) | (uint32_t(S[(s1 >> 8) & 0xff]) << 8) | S[s0 & 0xff]) ^ rk[3], out + 12);
+      }
+    }
   }
 
 
+  // A single block, in the same order state_array::unravel writes its bytes.
+  typedef std::array<uint8_t, 16> block;
+
+
   /**
-   * @brief Functions related to AES-GCM.
-   * @remarks These functions have been created in reference to:
-   * https://nvlpubs.nist.gov/nistpubs/Legacy/SP/nistspecialpublication800-38d.pdf
-   * Herein referred to as "The Reference" (The AES reference is not
-   * Used here).
+   * @brief The engine behind the HARDWARE backend.
+   * @remarks Modern CPUs have dedicated instructions for AES: AESENC runs SubBytes, ShiftRows,
+   * MixColumns and AddRoundKey on a block in one go. They are far faster than anything we can write
+   * ourselves, and since they don't look anything up in memory, they can't leak the key through
+   * the cache either.
+   * @remarks x86 uses AES-NI, and ARMv8 the Crypto Extensions. The latter split the round
+   * differently: AESE runs AddRoundKey first, then SubBytes and ShiftRows, and MixColumns is its
+   * own instruction.
+   * @remarks The round keys are the same as the ttable engine's, just stored as bytes.
    */
-  namespace gcm {
+  namespace hardware {
+  #if defined(AES_HARDWARE)
 
     /**
-     * @brief The Nonce Increment Function.
-     * @param the state array used as the counter.
-     * @remarks GCM uses a "more sophisticated" means of stepping the
-     * Counter that is passed to AES with the Key to generate the Pad.
-     * @remarks See 6.2 of the Reference.
-     * @remarks I couldn't find a reason for why the increment is performed
-     * This way. By only incrementing the first four bytes, it technically
-     * limits the size of the message to 4294967296 blocks, and we then repeat
-     * A nonce, which would be disaterous. That value is equal to 64GB. My best
-     * Guess is that a more performant implementation (One that wouldn't need to
-     * deconstruct the last four bytes into a new number), would be able to just cast
-     * The last bits, treat it like the very fast uint32_t directly, and increment
-     * it with instructions that are blazingly fast with this datatype (int defaults
-     * to 32bit specifically because it's fast, even faster than the native register
-     * size of 64bit. You can see this by using uint_fast32_t, which C++ mandates as
-     * an integer at least 32 bits, but can be faster if performance will improve
-     * (See https://en.cppreference.com/w/cpp/types/integer). Yet, on every computer
-     * I've personally used, it will always be a 32 bit value, not a 64 bit, which
-     * is neat).
+     * @brief Substitute the bytes of a key-schedule word.
+     * @param word: The word.
+     * @returns The substituted word, identical to key::SubWord
+     * @remarks AESKEYGENASSIST returns SubWord of the second word of its input in its first.
+     * ARM has no such instruction, but if all four columns are the same word, AESE's ShiftRows
+     * moves nothing, and we're left with SubWord.
      */
-     void increment(state_array& X) {
-       // Get the underlying array.
-       auto& array = X.get();
+    AES_HARDWARE inline uint32_t SubWord(const uint32_t& word) {
+    #if defined(__x86_64__) || defined(__i386__)
+      return _mm_cvtsi128_si32(_mm_aeskeygenassist_si128(_mm_set_epi32(0, 0, word, 0), 0));
+    #else
+      return vgetq_lane_u32(vreinterpretq_u32_u8(vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(word)), vdupq_n_u8(0))), 0);
+    #endif
+    }
 
-       // The state array is always 128 bits, so len(X) = 128/8 = 16.
-       // While the Reference makes the increment function generic in
-       // Terms of the s value, it is always used with s=32 within GCM,
-       // which is 4 bytes.
-       //
-       // The incrementing function takes the len(X) - s Most
-       // Significant Bits (The first 12 bytes), and does nothing.
-       //
-       // Then, it takes the s least significant bits (the last 4)
-       // Bytes, casts it into a integer, adds one, and then applies
+
+    /**
+     * @brief Expand a key for the hardware engine.
+     * @param k: The key.
+     * @param Nr: The number of rounds.
+     * @returns Nr + 1 round keys.
+     * @remarks This is the same loop as key::Expansion, only stopping at the last word that
+     * Cipher actually uses.
+     * @throws std::runtime_error If the Nr rounds is not 10,12,14.
+     */
+    AES_HARDWARE std::vector<block> encryption(const std::array<uint64_t, 4>& k, const uint64_t& Nr) {
+      if (Nr != 10 && Nr != 12 && Nr != 14) throw std::runtime_error("Invalid key size:" + std::to_string(Nr));
+      const uint64_t Nk = Nr == 10 ? 4 : Nr == 12 ? 6 : 8;
+
+      std::vector<uint32_t> w(4 * Nr + 4, 0);
+      for (size_t x = 0; x < Nk; ++x) w[x] = x % 2 ? k[x / 2] >> 32 : k[x / 2] & 0xffffffff;
+      for (size_t i = Nk; i < 4 * Nr; ++i) {
+        uint32_t temp = w[i - 1];
+        if (i % Nk == 0) temp = SubWord(key::RotWord(temp)) ^ key::Rcon[i / Nk];
+        else if (Nk > 6 && i % Nk == 4) temp = SubWord(temp);
+        w[i] = w[i - Nk] ^ temp;
+      }
+
+      // Lay the words out like AddRoundKey would.
+      auto ek = ttable::encryption(w, Nr);
+      std::vector<block> keys(Nr + 1);
+      for (size_t x = 0; x < ek.size(); ++x) ttable::store(ek[x], &keys[x / 4][4 * (x % 4)]);
+      return keys;
+    }
+
+
+    /**
+     * @brief Generate the key schedule for the Equivalent Inverse Cipher.
+     * @param ek: The encryption schedule.
+     * @returns The decryption schedule.
+     * @remarks See ttable::decryption; AESIMC is InvMixColumns on its own.
+     */
+    AES_HARDWARE std::vector<block> decryption(const std::vector<block>& ek) {
+      const size_t Nr = ek.size() - 1;
+      std::vector<block> dk(ek.size());
+      for (size_t round = 0; round <= Nr; ++round) {
+        const auto& source = ek[Nr - round];
+        if (round == 0 || round == Nr) {dk[round] = source; continue;}
+      #if defined(__x86_64__) || defined(__i386__)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dk[round].data()), _mm_aesimc_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source.data()))));
+      #else
+        vst1q_u8(dk[round].data(), vaesimcq_u8(vld1q_u8(source.data())));
+      #endif
+      }
+      return dk;
+    }
+
+
+  #if defined(__x86_64__) || defined(__i386__)
+
+    /**
+     * @brief Encrypt a run of blocks.
+     * @param ek: The schedule from hardware::encryption.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks to encrypt.
+     * @remarks AESENC takes several cycles to finish, but the CPU can start a new one every cycle,
+     * so we keep eight independent blocks in flight at once, and only then move on to the next round.
+     */
+    AES_HARDWARE void encrypt(const std::vector<block>& ek, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      const size_t Nr = ek.size() - 1;
+      __m128i rk[15];
+      for (size_t r = 0; r <= Nr; ++r) rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ek[r].data()));
+
+      size_t b = 0;
+      for (; b + 8 <= blocks; b += 8, in += 128, out += 128) {
+        __m128i s[8];
+        #pragma GCC unroll 8
+        for (size_t x = 0; x < 8; ++x) s[x] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in) + x), rk[0]);
+        for (size_t r = 1; r < Nr; ++r) {
+          #pragma GCC unroll 8
+          for (size_t x = 0; x < 8; ++x) s[x] = _mm_aesenc_si128(s[x], rk[r]);
+        }
+        #pragma GCC unroll 8
+        for (size_t x = 0; x < 8; ++x) _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + x, _mm_aesenclast_si128(s[x], rk[Nr]));
+      }
+
+      // Whatever doesn't fill a group of eight.
+      for (; b < blocks; ++b, in += 16, out += 16) {
+        __m128i s = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), rk[0]);
+        for (size_t r = 1; r < Nr; ++r) s = _mm_aesenc_si128(s, rk[r]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_aesenclast_si128(s, rk[Nr]));
+      }
+    }
+
+
+    /**
+     * @brief Decrypt a run of blocks.
+     * @param dk: The schedule from hardware::decryption.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks to decrypt.
+     */
+    AES_HARDWARE void decrypt(const std::vector<block>& dk, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      const size_t Nr = dk.size() - 1;
+      __m128i rk[15];
+      for (size_t r = 0; r <= Nr; ++r) rk[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dk[r].data()));
+
+      size_t b = 0;
+      for (; b + 8 <= blocks; b += 8, in += 128, out += 128) {
+        __m128i s[8];
+        #pragma GCC unroll 8
+        for (size_t x = 0; x < 8; ++x) s[x] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in) + x), rk[0]);
+        for (size_t r = 1; r < Nr; ++r) {
+          #pragma GCC unroll 8
+          for (size_t x = 0; x < 8; ++x) s[x] = _mm_aesdec_si128(s[x], rk[r]);
+        }
+        #pragma GCC unroll 8
+        for (size_t x = 0; x < 8; ++x) _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + x, _mm_aesdeclast_si128(s[x], rk[Nr]));
+      }
+
+      for (; b < blocks; ++b, in += 16, out += 16) {
+        __m128i s = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), rk[0]);
+        for (size_t r = 1; r < Nr; ++r) s = _mm_aesdec_si128(s, rk[r]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_aesdeclast_si128(s, rk[Nr]));
+      }
+    }
+
+  #else
+
+    // See the x86 versions above for documentation.
+    AES_HARDWARE void encrypt(const std::vector<block>& ek, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      const size_t Nr = ek.size() - 1;
+      uint8x16_t rk[15];
+      for (size_t r = 0; r <= Nr; ++r) rk[r] = vld1q_u8(ek[r].data());
+
+      size_t b = 0;
+      for (; b + 8 <= blocks; b += 8, in += 128, out += 128) {
+        uint8x16_t s[8];
+        #pragma GCC unroll 8
+        for (size_t x = 0; x < 8; ++x) s[x] = vld1q_u8(in + 16 * x);
+        for (size_t r = 0; r < Nr - 1; ++r) {
+          #pragma GCC unroll 8
+          for (size_t x = 0; x < 8; ++x) s[x] = vaesmcq_u8(vaeseq_u8(s[x], rk[r]));
+        }
+        #pragma GCC unroll 8
+        for (size_t x = 0; x < 8; ++x) vst1q_u8(out + 16 * x, veorq_u8(vaeseq_u8(s[x], rk[Nr - 1]), rk[Nr]));
+      }
+
+      for (; b < blocks; ++b, in += 16, out += 16) {
+        uint8x16_t s = vld1q_u8(in);
+        for (size_t r = 0; r < Nr - 1; ++r) s = vaesmcq_u8(vaeseq_u8(s, rk[r]));
+        vst1q_u8(out, veorq_u8(vaeseq_u8(s, rk[Nr - 1]), rk[Nr]));
+      }
+    }
+
+    AES_HARDWARE void decrypt(const std::vector<block>& dk, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      const size_t Nr = dk.size() - 1;
+      uint8x16_t rk[15];
+      for (size_t r = 0; r <= Nr; ++r) rk[r] = vld1q_u8(dk[r].data());
+
+      size_t b = 0;
+      for (; b + 8 <= blocks; b += 8, in += 128, out += 128) {
+        uint8x16_t s[8];
+        #pragma GCC unroll 8
+        for (size_t x = 0; x < 8; ++x) s[x] = vld1q_u8(in + 16 * x);
+        for (size_t r = 0; r < Nr - 1; ++r) {
+          #pragma GCC unroll 8
+          for (size_t x = 0; x < 8; ++x) s[x] = vaesimcq_u8(vaesdq_u8(s[x], rk[r]));
+        }
+        #pragma GCC unroll 8
+        for (size_t x = 0; x < 8; ++x) vst1q_u8(out + 16 * x, veorq_u8(vaesdq_u8(s[x], rk[Nr - 1]), rk[Nr]));
+      }
+
+      for (; b < blocks; ++b, in += 16, out += 16) {
+        uint8x16_t s = vld1q_u8(in);
+        for (size_t r = 0; r < Nr - 1; ++r) s = vaesimcq_u8(vaesdq_u8(s, rk[r]));
+        vst1q_u8(out, veorq_u8(vaesdq_u8(s, rk[Nr - 1]), rk[Nr]));
+      }
+    }
+
+  #endif
+  #else
+
+    // Without AES instructions, supported() is always false, and these are never called.
+    std::vector<block> encryption(const std::array<uint64_t, 4>&, const uint64_t&) {throw std::runtime_error("No AES instructions!");}
+    std::vector<block> decryption(const std::vector<block>&) {throw std::runtime_error("No AES instructions!");}
+    void encrypt(const std::vector<block>&, const uint8_t*, uint8_t*, const size_t&) {}
+    void decrypt(const std::vector<block>&, const uint8_t*, uint8_t*, const size_t&) {}
+
+  #endif
+  }
+
+
+  /**
+   * @brief A constant-time engine that bitslices eight blocks at once.
+   * @remarks Table lookups are fast, but which entry is read depends on the key and data, and so does how
+   * long the read takes, which leaks through the cache. Here, eight blocks are transposed so that each of
+   * eight slices holds a single bit of every byte, and every step of AES becomes the same sequence of
+   * boolean operations on those slices, whatever the data is.
+   * @remarks After the transposition, byte i of slice j holds bit j of byte i of all eight blocks. So
+   * ShiftRows, and the rotations in MixColumns, are just a shuffle of the bytes of each slice, exactly as
+   * if it were a block.
+   * @remarks SubBytes is a boolean circuit which computes the inverse in GF(2^8) and the affine transformation.
+   * @warning Only the rounds are constant-time. The key schedule is still key::Expansion, which looks up
+   * the S-box table with bytes of the key; context still derives GCM's H with ttable::encrypt; and GHASH
+   * still uses the tables of ghash::table, which are indexed by bytes of H and the ciphertext. Someone
+   * sharing our cache can time all three, and so learn about the key and H, just as they could with TTABLE.
+   */
+  namespace bitslice {
+
+    // 16 bytes, which GCC's vector extensions compile into SIMD registers where there are some.
+    typedef uint8_t slice __attribute__((vector_size(16)));
+
+    // Eight slices: bit j of every byte of eight blocks.
+    typedef std::array<slice, 8> planes;
+
+    // Everything here is forced inline, so that it's compiled for whichever target encrypt and decrypt are.
+
+    // How many blocks are sliced together.
+    constexpr size_t BLOCKS = 8;
+
+    // The byte shuffles. Each gives, for every byte of the result, which byte it comes from.
+    constexpr slice SHIFT = {0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11};
+    constexpr slice INV_SHIFT = {0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3};
+    constexpr slice ROT1 = {1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12};
+    constexpr slice ROT2 = {2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13};
+    constexpr slice ROT3 = {3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14};
+
+
+    // A slice with every byte set to x.
+    [[gnu::always_inline]] inline slice splat(const uint8_t& x) {return slice{} + x;}
+
+
+    // Shuffle the bytes of every slice.
+    [[gnu::always_inline]] inline planes shuffle(const planes& a, const slice& order) {
+      planes ret;
+      for (size_t x = 0; x < 8; ++x) ret[x] = __builtin_shuffle(a[x], order);
+      return ret;
+    }
+
+
+    // XOR two sets of slices.
+    [[gnu::always_inline]] inline planes operator^(const planes& a, const planes& b) {
+      planes ret;
+      for (size_t x = 0; x < 8; ++x) ret[x] = a[x] ^ b[x];
+      return ret;
+    }
+
+
+    /**
+     * @brief Swap bit j + n of a with bit j of b, for every bit j in m.
+     * @remarks Three rounds of these transpose an 8x8 matrix of bits: see transpose.
+     */
+    [[gnu::always_inline]] inline void swapmove(slice& a, slice& b, const uint8_t& n, const uint8_t& m) {
+      const slice t = ((a >> n) ^ b) & splat(m);
+      b ^= t;
+      a ^= t << n;
+    }
+
+
+    /**
+     * @brief Turn eight blocks into eight slices, or back again.
+     * @param p: The blocks, which become the slices.
+     * @remarks For each byte position, the eight blocks form an 8x8 matrix of bits, and we transpose it
+     * by swapping its off-diagonal halves, then quarters, then eighths. Doing it twice undoes it.
+     */
+    [[gnu::always_inline]] inline void transpose(planes& p) {
+      const uint8_t masks[3] = {0x55, 0x33, 0x0f};
+      for (size_t stage = 0; stage < 3; ++stage) {
+        const uint8_t n = 1 << stage;
+        for (size_t k = 0; k < 8; ++k) {
+          if (!(k & n)) swapmove(p[k], p[k + n], n, masks[stage]);
+        }
+      }
+    }
+
+
+    /**
+     * @brief SubBytes, as a circuit of 113 gates.
+     * @remarks This is the circuit of Boyar and Peralta (https://eprint.iacr.org/2011/332.pdf), which computes
+     * the inverse in GF(2^8) and the affine transformation together. Their x0 is the most significant bit.
+     */
+    [[gnu::always_inline]] inline planes SubBytes(const planes& q) {
+      const slice x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4], x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+      // The top linear transformation.
+      const slice y14 = x3 ^ x5, y13 = x0 ^ x6, y9 = x0 ^ x3, y8 = x0 ^ x5, t0 = x1 ^ x2, y1 = t0 ^ x7;
+      const slice y4 = y1 ^ x3, y12 = y13 ^ y14, y2 = y1 ^ x0, y5 = y1 ^ x6, y3 = y5 ^ y8, t1 = x4 ^ y12;
+      const slice y15 = t1 ^ x5, y20 = t1 ^ x1, y6 = y15 ^ x7, y10 = y15 ^ t0, y11 = y20 ^ y9, y7 = x7 ^ y11;
+      const slice y17 = y10 ^ y11, y19 = y10 ^ y8, y16 = t0 ^ y11, y21 = y13 ^ y16, y18 = x0 ^ y16;
+
+      // The non-linear middle, which is the inversion.
+      const slice t2 = y12 & y15, t3 = y3 & y6, t4 = t3 ^ t2, t5 = y4 & x7, t6 = t5 ^ t2, t7 = y13 & y16;
+      const slice t8 = y5 & y1, t9 = t8 ^ t7, t10 = y2 & y7, t11 = t10 ^ t7, t12 = y9 & y11, t13 = y14 & y17;
+      const slice t14 = t13 ^ t12, t15 = y8 & y10, t16 = t15 ^ t12, t17 = t4 ^ t14, t18 = t6 ^ t16, t19 = t9 ^ t14;
+      const slice t20 = t11 ^ t16, t21 = t17 ^ y20, t22 = t18 ^ y19, t23 = t19 ^ y21, t24 = t20 ^ y18;
+
+      const slice t25 = t21 ^ t22, t26 = t21 & t23, t27 = t24 ^ t26, t28 = t25 & t27, t29 = t28 ^ t22, t30 = t23 ^ t24;
+      const slice t31 = t22 ^ t26, t32 = t31 & t30, t33 = t32 ^ t24, t34 = t23 ^ t33, t35 = t27 ^ t33, t36 = t24 & t35;
+      const slice t37 = t36 ^ t34, t38 = t27 ^ t36, t39 = t29 & t38, t40 = t25 ^ t39;
+
+      const slice t41 = t40 ^ t37, t42 = t29 ^ t33, t43 = t29 ^ t40, t44 = t33 ^ t37, t45 = t42 ^ t41;
+      const slice z0 = t44 & y15, z1 = t37 & y6, z2 = t33 & x7, z3 = t43 & y16, z4 = t40 & y1, z5 = t29 & y7;
+      const slice z6 = t42 & y11, z7 = t45 & y17, z8 = t41 & y10, z9 = t44 & y12, z10 = t37 & y3, z11 = t33 & y4;
+      const slice z12 = t43 & y13, z13 = t40 & y5, z14 = t29 & y2, z15 = t42 & y9, z16 = t45 & y14, z17 = t41 & y8;
+
+      // The bottom linear transformation, which includes the affine transformation.
+      const slice t46 = z15 ^ z16, t47 = z10 ^ z11, t48 = z5 ^ z13, t49 = z9 ^ z10, t50 = z2 ^ z12, t51 = z2 ^ z5;
+      const slice t52 = z7 ^ z8, t53 = z0 ^ z3, t54 = z6 ^ z7, t55 = z16 ^ z17, t56 = z12 ^ t48, t57 = t50 ^ t53;
+      const slice t58 = z4 ^ t46, t59 = z3 ^ t54, t60 = t46 ^ t57, t61 = z14 ^ t57, t62 = t52 ^ t58, t63 = t49 ^ t58;
+      const slice t64 = z4 ^ t59, t65 = t61 ^ t62, t66 = z1 ^ t63;
+
+      const slice s0 = t59 ^ t63, s6 = t56 ^ ~t62, s7 = t48 ^ ~t60, t67 = t64 ^ t65, s3 = t53 ^ t66;
+      const slice s4 = t51 ^ t66, s5 = t47 ^ t65, s1 = t64 ^ ~s3, s2 = t55 ^ ~t67;
+      return {s7, s6, s5, s4, s3, s2, s1, s0};
+    }
+
+
+    // Undo the affine transformation of every byte. See sbox::inv_affine.
+    [[gnu::always_inline]] inline planes inv_affine(const planes& a) {
+      planes b;
+      for (size_t x = 0; x < 8; ++x) {
+        b[x] = a[(x + 2) % 8] ^ a[(x + 5) % 8] ^ a[(x + 7) % 8];
+        if ((0x05 >> x) & 1) b[x] = ~b[x];
+      }
+      return b;
+    }
+
+
+    // InvSubBytes. If S(x) = affine(inverse(x)), then inverse(x) = inv_affine(S(x)), and so the inverse of S is
+    // inverse(inv_affine(y)) = inv_affine(S(inv_affine(y))).
+    [[gnu::always_inline]] inline planes InvSubBytes(const planes& a) {return inv_affine(SubBytes(inv_affine(a)));}
+
+
+    // Multiply every byte by x (2), in GF(2^8).
+    [[gnu::always_inline]] inline planes xtime(const planes& a) {
+      return {a[7], a[0] ^ a[7], a[1], a[2] ^ a[7], a[3] ^ a[7], a[4], a[5], a[6]};
+    }
+
+
+    // MixColumns: 2 * a_r ^ 3 * a_r+1 ^ a_r+2 ^ a_r+3 = 2 * (a_r ^ a_r+1) ^ a_r+1 ^ a_r+2 ^ a_r+3
+    [[gnu::always_inline]] inline planes MixColumns(const planes& a) {
+      const auto r1 = shuffle(a, ROT1);
+      return xtime(a ^ r1) ^ r1 ^ shuffle(a, ROT2) ^ shuffle(a, ROT3);
+    }
+
+
+    // InvMixColumns is MixColumns, after adding 4 * (a_r ^ a_r+2) to every byte.
+    [[gnu::always_inline]] inline planes InvMixColumns(const planes& a) {
+      return MixColumns(a ^ xtime(xtime(a ^ shuffle(a, ROT2))));
+    }
+
+
+    /**
+     * @brief Slice the round keys.
+     * @param ek: The schedule from ttable::encryption.
+     * @param Nr: The number of rounds.
+     * @returns Nr + 1 round keys, with each bit spread across all eight blocks.
+     */
+    std::vector<planes> encryption(const std::vector<uint32_t>& ek, const uint64_t& Nr) {
+      std::vector<planes> ret(Nr + 1);
+      for (size_t round = 0; round <= Nr; ++round) {
+        uint8_t bytes[16];
+        for (size_t c = 0; c < 4; ++c) ttable::store(ek[4 * round + c], &bytes[4 * c]);
+        for (size_t bit = 0; bit < 8; ++bit) {
+          for (size_t x = 0; x < 16; ++x) ret[round][bit][x] = (bytes[x] >> bit) & 1 ? 0xff : 0;
+        }
+      }
+      return ret;
+    }
+
+
+    // Slice up to eight blocks, padding the batch with blocks of 0s so that every batch takes as long.
+    [[gnu::always_inline]] inline planes load(const uint8_t* in, const size_t& batch) {
+      planes p = {};
+      std::memcpy(p.data(), in, 16 * batch);
+      transpose(p);
+      return p;
+    }
+
+
+    // Turn slices back into blocks, keeping the first batch of them.
+    [[gnu::always_inline]] inline void store(planes p, uint8_t* out, const size_t& batch) {
+      transpose(p);
+      std::memcpy(out, p.data(), 16 * batch);
+    }
+
+
+    /**
+     * @brief Encrypt blocks.
+     * @param keys: The schedule from encryption.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks to encrypt.
+     */
+    AES_BITSLICE void encrypt(const std::vector<planes>& keys, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      const size_t Nr = keys.size() - 1;
+      for (size_t x = 0; x < blocks; x += BLOCKS) {
+        const size_t batch = std::min(BLOCKS, blocks - x);
+        auto p = load(&in[16 * x], batch) ^ keys[0];
+        for (size_t round = 1; round < Nr; ++round) p = MixColumns(shuffle(SubBytes(p), SHIFT)) ^ keys[round];
+        store(shuffle(SubBytes(p), SHIFT) ^ keys[Nr], &out[16 * x], batch);
+      }
+    }
+
+
+    /**
+     * @brief Decrypt blocks.
+     * @param keys: The schedule from encryption; decryption just walks it backwards.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks to decrypt.
+     */
+    AES_BITSLICE void decrypt(const std::vector<planes>& keys, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      const size_t Nr = keys.size() - 1;
+      for (size_t x = 0; x < blocks; x += BLOCKS) {
+        const size_t batch = std::min(BLOCKS, blocks - x);
+        auto p = InvSubBytes(shuffle(load(&in[16 * x], batch) ^ keys[Nr], INV_SHIFT));
+        for (size_t round = Nr - 1; round >= 1; --round) p = InvSubBytes(shuffle(InvMixColumns(p ^ keys[round]), INV_SHIFT));
+        store(p ^ keys[0], &out[16 * x], batch);
+      }
+    }
+  }
+
+
+  /**
+   * @brief A fast GHASH, used by every engine but the reference, which uses gcm::mult.
+   * @remarks GHASH multiplies in GF(2^128), where the first bit of a block is the coefficient of x^0; see 6.3
+   * of the GCM Reference. Multiplying by a fixed H is linear, so H times each of the sixteen values a nibble
+   * can take is precomputed (Shoup's 4-bit table), and a multiply becomes 32 lookups, each shifting the
+   * product along by four bits and folding what falls off the end back in with the reduction of that nibble.
+   * @remarks With HARDWARE, and a CPU with PCLMULQDQ, the product is taken with carry-less multiplies instead;
+   * see clmul.
+   * @remarks Four blocks of GHASH are
+   * (((Y ^ X0)H ^ X1)H ^ X2)H ^ X3)H = (Y ^ X0)H^4 ^ X1 H^3 ^ X2 H^2 ^ X3 H,
+   * so we also keep H^2, H^3 and H^4, and the four multiplies no longer wait on one another.
+   */
+  namespace ghash {
+
+    // How many blocks are folded together.
+    constexpr size_t FOLD = 4;
+
+
+    // What shifting each nibble off the end of a product adds back to its top: x^128 = x^7 + x^2 + x + 1.
+    constexpr uint64_t reduce[16] = {
+      0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+      0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0,
+    };
+
+
+    // A block as two big-endian words, so the first bit of the block is the top bit of hi.
+    struct element {
+      uint64_t hi = 0, lo = 0;
+
+      element() {}
+      element(const uint8_t* X) {
+        for (size_t x = 0; x < 8; ++x) {
+          hi = hi << 8 | X[x];
+          lo = lo << 8 | X[x + 8];
+        }
+      }
+
+      void store(uint8_t* X) const {
+        for (size_t x = 0; x < 8; ++x) {
+          X[x] = hi >> (56 - 8 * x);
+          X[x + 8] = lo >> (56 - 8 * x);
+        }
+      }
+
+      element& operator^=(const element& other) {
+        hi ^= other.hi;
+        lo ^= other.lo;
+        return *this;
+      }
+    };
+
+
+    /**
+     * @brief GHASH with PCLMULQDQ, which multiplies two 64 bit polynomials without carries in one instruction.
+     * @remarks The bits of a GHASH block run the other way to the polynomials PCLMULQDQ multiplies, so the
+     * bytes are swapped on the way in and out, and the product shifted one bit; see Gueron and Kounavis,
+     * "Intel Carry-Less Multiplication Instruction and its Usage for Computing the GCM Mode". The four
+     * products of a fold are added together before reducing, which is then done once rather than four times.
+     * @remarks ARM's PMULL isn't used yet; there, every engine uses the tables.
+     */
+    namespace clmul {
+    #if defined(__x86_64__) || defined(__i386__)
+
+      // Whether the CPU has PCLMULQDQ, and the byte shuffle to go with it.
+      bool supported() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+      }
+
+
+      // Load a block, with its bytes reversed.
+      __attribute__((target("pclmul,ssse3"))) inline __m128i load(const uint8_t* X) {
+        return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(X)), _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+      }
+
+
+      // Add a * b to the 256 bit product lo, hi, without reducing it.
+      __attribute__((target("pclmul,ssse3"))) inline void multiply(const __m128i& a, const __m128i& b, __m128i& lo, __m128i& hi) {
+        const auto middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+        lo = _mm_xor_si128(lo, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x00), _mm_slli_si128(middle, 8)));
+        hi = _mm_xor_si128(hi, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x11), _mm_srli_si128(middle, 8)));
+      }
+
+
+      // Shift a 256 bit product one bit toward hi, and reduce it to 128 bits.
+      __attribute__((target("pclmul,ssse3"))) inline __m128i modulo(__m128i lo, __m128i hi) {
+        auto carry_lo = _mm_srli_epi32(lo, 31), carry_hi = _mm_srli_epi32(hi, 31);
+        lo = _mm_slli_epi32(lo, 1);
+        hi = _mm_slli_epi32(hi, 1);
+        const auto across = _mm_srli_si128(carry_lo, 12);
+        lo = _mm_or_si128(lo, _mm_slli_si128(carry_lo, 4));
+        hi = _mm_or_si128(_mm_or_si128(hi, _mm_slli_si128(carry_hi, 4)), across);
+
+        auto a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+        const auto b = _mm_srli_si128(a, 4);
+        lo = _mm_xor_si128(lo, _mm_slli_si128(a, 12));
+        a = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+        return _mm_xor_si128(hi, _mm_xor_si128(lo, _mm_xor_si128(a, b)));
+      }
+
+
+      /**
+       * @brief Hash blocks into Y.
+       * @param Y: The running hash.
+       * @param powers: H, H^2, H^3 and H^4.
+       * @param bytes: The blocks.
+       * @param blocks: How many blocks there are.
+       */
+      __attribute__((target("pclmul,ssse3"))) void update(block& Y, const std::array<block, FOLD>& powers, const uint8_t* bytes, const size_t& blocks) {
+        const auto mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        __m128i H[FOLD];
+        for (size_t x = 0; x < FOLD; ++x) H[x] = load(powers[x].data());
+        auto y = load(Y.data());
+
+        size_t x = 0;
+        for (; x + FOLD <= blocks; x += FOLD) {
+          auto lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+          multiply(_mm_xor_si128(y, load(&bytes[16 * x])), H[FOLD - 1], lo, hi);
+          for (size_t z = 1; z < FOLD; ++z) multiply(load(&bytes[16 * (x + z)]), H[FOLD - 1 - z], lo, hi);
+          y = modulo(lo, hi);
+        }
+        for (; x < blocks; ++x) {
+          auto lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+          multiply(_mm_xor_si128(y, load(&bytes[16 * x])), H[0], lo, hi);
+          y = modulo(lo, hi);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(Y.data()), _mm_shuffle_epi8(y, mask));
+      }
+
+    #else
+
+      // Without PCLMULQDQ, supported() is always false, and this is never called.
+      bool supported() {return false;}
+      void update(block&, const std::array<block, FOLD>&, const uint8_t*, const size_t&) {}
+
+    #endif
+
+      // Whether HARDWARE hashes with clmul.
+      const bool available = supported();
+    }
+
+
+    /**
+     * @brief The tables for a hash subkey.
+     */
+    class table {
+    private:
+
+      // H, H^2, H^3 and H^4, for clmul.
+      std::array<block, FOLD> powers = {};
+
+      // For each power of H, that power times every nibble; the nibble's first bit is its top one.
+      std::array<std::array<element, 16>, FOLD> M = {};
+
+
+      // Multiply a block by a power of H, less one.
+      element times(const size_t& power, const uint8_t* X) const {
+        const auto& m = M[power];
+        element Z;
+        for (size_t x = 16; x-- > 0;) {
+          for (const uint8_t nibble : {static_cast<uint8_t>(X[x] & 0xf), static_cast<uint8_t>(X[x] >> 4)}) {
+            const auto rem = Z.lo & 0xf;
+            Z.lo = Z.hi << 60 | Z.lo >> 4;
+            Z.hi = Z.hi >> 4 ^ reduce[rem] << 48;
+            Z ^= m[nibble];
+          }
+        }
+        return Z;
+      }
+
+    public:
+
+      // An empty table, to be replaced once there is a subkey.
+      table() {}
+
+
+      /**
+       * @brief Build the tables.
+       * @param H: The hash subkey.
+       */
+      table(const state_array& H) {
+        std::copy_n(H.data(), 16, powers[0].begin());
+        for (size_t power = 0; power < FOLD; ++power) {
+          auto& m = M[power];
+
+          // The nibble 1000 is the block itself, and each bit after it is that times x, which is a shift toward
+          // the end, reducing what falls off.
+          m[8] = element(powers[power].data());
+          for (size_t x = 4; x > 0; x >>= 1) {
+            m[x] = m[2 * x];
+            const bool carry = m[x].lo & 1;
+            m[x].lo = m[x].hi << 63 | m[x].lo >> 1;
+            m[x].hi = m[x].hi >> 1 ^ (carry ? 0xe100000000000000 : 0);
+          }
+
+          // Every other nibble is the XOR of its bits.
+          for (size_t x = 2; x <= 8; x *= 2) {
+            for (size_t y = 1; y < x; ++y) {
+              m[x + y] = m[x];
+              m[x + y] ^= m[y];
+            }
+          }
+
+          // The next power is H times this one.
+          if (power + 1 < FOLD) times(0, powers[power].data()).store(powers[power + 1].data());
+        }
+      }
+
+
+      /**
+       * @brief Hash blocks into Y.
+       * @param Y: The running hash.
+       * @param bytes: The blocks.
+       * @param blocks: How many blocks there are.
+       */
+      void update(block& Y, const uint8_t* bytes, const size_t& blocks) const {
+        if (engine == HARDWARE && clmul::available) {
+          clmul::update(Y, powers, bytes, blocks);
+          return;
+        }
+
+        size_t x = 0;
+        for (; x + FOLD <= blocks; x += FOLD) {
+          block first;
+          for (size_t y = 0; y < 16; ++y) first[y] = Y[y] ^ bytes[16 * x + y];
+          auto Z = times(FOLD - 1, first.data());
+          for (size_t z = 1; z < FOLD; ++z) Z ^= times(FOLD - 1 - z, &bytes[16 * (x + z)]);
+          Z.store(Y.data());
+        }
+        for (; x < blocks; ++x) {
+          for (size_t y = 0; y < 16; ++y) Y[y] ^= bytes[16 * x + y];
+          times(0, Y.data()).store(Y.data());
+        }
+      }
+    };
+  }
+
+
+  /**
+   * @brief Everything that AES derives from a key, computed once.
+   * @remarks Constructing a state expands the key, and CTR and GCM run Cipher once for every
+   * block, so encrypting a single message used to expand the same key thousands of times. A
+   * context expands it once, and can be reused for every message under that key.
+   * @remarks Each engine has a schedule of its own, and building every one of them for every context
+   * is most of what a context costs, when only one engine is ever used. So the context builds the
+   * encryption schedule of the current engine straight away, and everything else the first time it's
+   * asked for, such as decrypting, GCM's H, or the engine being changed.
+   * @remarks Copies share what has been built, which never changes once it has been.
+   */
+  class context {
+  private:
+    std::array<uint64_t, 4> key = {0};
+    uint64_t rounds = 0;
+
+    /**
+     * @brief The schedules, each built once, by whichever thread asks for it first.
+     * @var expanded: The schedule from key::Schedule, used by the state.
+     * @var ek, dk: The encryption and decryption schedules of the ttable engine.
+     * @var hw_ek, hw_dk: The same, for the hardware engine.
+     * @var bs: The encryption schedule of the bitslice engine.
+     * @var H: The GCM hash subkey, which is a block of 0s encrypted under the key.
+     * @var hash: Its tables.
+     */
+    struct schedules {
+      std::once_flag state, table, hardware, sliced, hashed;
+      std::vector<uint32_t> expanded, ek, dk;
+      std::vector<block> hw_ek, hw_dk;
+      std::vector<bitslice::planes> bs;
+      state_array H;
+      ghash::table hash;
+    };
+    std::shared_ptr<schedules> built;
+
+
+    // The schedules, which an empty context doesn't have.
+    schedules& get() const {
+      if (!built) throw std::runtime_error("There is no key!");
+      return *built;
+    }
+
+  public:
+
+    // An empty context, to be replaced once there is a key.
+    context() {}
+
+
+    /**
+     * @brief Derive a context from a key.
+     * @param k: The key.
+     * @param Nr: The number of rounds.
+     * @throws std::runtime_error If the Nr rounds is not 10,12,14.
+     */
+    context(const std::array<uint64_t, 4>& k, const uint64_t& Nr) {
+      TRACE_SCOPE(SCHEDULE, 8 * Nr + 8);
+      if (Nr != 10 && Nr != 12 && Nr != 14) throw std::runtime_error("Invalid key size:" + std::to_string(Nr));
+      key = k;
+      rounds = Nr;
+      built = std::make_shared<schedules>();
+      switch (engine) {
+        case HARDWARE: if (supported()) get_hw_ek(); break;
+        case BITSLICE: get_bitslice(); break;
+        case TTABLE: get_ek(); break;
+        default: get_schedule(); break;
+      }
+    }
+
+
+    // Getters, which build what they return the first time they're called.
+    const auto& get_key() const {return key;}
+    const auto& get_rounds() const {return rounds;}
+    const std::vector<uint32_t>& get_schedule() const {
+      auto& s = get();
+      std::call_once(s.state, [this, &s]() {s.expanded = key::Schedule(key, rounds);});
+      return s.expanded;
+    }
+    const std::vector<uint32_t>& get_ek() const {
+      auto& s = get();
+      std::call_once(s.table, [this, &s]() {
+        s.ek = ttable::encryption(get_schedule(), rounds);
+        s.dk = ttable::decryption(s.ek, rounds);
+      });
+      return s.ek;
+    }
+    const std::vector<uint32_t>& get_dk() const {get_ek(); return get().dk;}
+    const std::vector<block>& get_hw_ek() const {
+      auto& s = get();
+      std::call_once(s.hardware, [this, &s]() {
+        if (!supported()) return;
+        s.hw_ek = hardware::encryption(key, rounds);
+        s.hw_dk = hardware::decryption(s.hw_ek);
+      });
+      return s.hw_ek;
+    }
+    const std::vector<block>& get_hw_dk() const {get_hw_ek(); return get().hw_dk;}
+    const std::vector<bitslice::planes>& get_bitslice() const {
+      auto& s = get();
+      std::call_once(s.sliced, [this, &s]() {s.bs = bitslice::encryption(get_ek(), rounds);});
+      return s.bs;
+    }
+    const state_array& get_H() const {
+      auto& s = get();
+      std::call_once(s.hashed, [this, &s]() {
+        const block zero = {};
+        if (engine == HARDWARE && supported()) hardware::encrypt(get_hw_ek(), zero.data(), s.H.data(), 1);
+        else ttable::encrypt(get_ek(), rounds, zero.data(), s.H.data(), 1);
+        s.hash = ghash::table(s.H);
+      });
+      return s.H;
+    }
+    const ghash::table& get_hash() const {get_H(); return get().hash;}
+  };
+
+
+  /**
+   * @brief How many bytes each thread works on at a time.
+   * @remarks ECB, CTR and GCM split anything larger than this across the thread pool. Smaller chunks
+   * balance better across threads, larger ones spend less time handing out work. 0 disables threading.
+   */
+  size_t chunk = 1 << 20;
+
+
+  /**
+   * @brief ECB with the bulk() engines, spread across the thread pool.
+   * @remarks Every block of ECB is independent, so each thread takes a chunk of blocks and runs them
+   * through every round with the engine's own multi-block kernel (eight blocks interleaved for HARDWARE
+   * and BITSLICE), rather than running each step over every block as the state does.
+   */
+  namespace ecb {
+
+    /**
+     * @brief Encrypt blocks on this thread.
+     * @param ctx: The context of the key.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks to encrypt.
+     * @warning The engine must be one of bulk().
+     */
+    void encrypt(const context& ctx, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      switch (engine) {
+        case TTABLE: ttable::encrypt(ctx.get_ek(), ctx.get_rounds(), in, out, blocks); break;
+        case HARDWARE: hardware::encrypt(ctx.get_hw_ek(), in, out, blocks); break;
+        case BITSLICE: bitslice::encrypt(ctx.get_bitslice(), in, out, blocks); break;
+        default: break;
+      }
+    }
+
+
+    /**
+     * @brief Decrypt blocks on this thread.
+     * @param ctx: The context of the key.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks to decrypt.
+     * @warning The engine must be one of bulk().
+     */
+    void decrypt(const context& ctx, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      switch (engine) {
+        case TTABLE: ttable::decrypt(ctx.get_dk(), ctx.get_rounds(), in, out, blocks); break;
+        case HARDWARE: hardware::decrypt(ctx.get_hw_dk(), in, out, blocks); break;
+        case BITSLICE: bitslice::decrypt(ctx.get_bitslice(), in, out, blocks); break;
+        default: break;
+      }
+    }
+
+
+    /**
+     * @brief Split blocks into chunks, and run each through a kernel on the thread pool.
+     * @tparam F: A function taking the input, the output, and how many blocks there are.
+     * @param in: The input blocks.
+     * @param out: Where to write the output (May be the same as in).
+     * @param blocks: How many blocks there are.
+     * @param kernel: The function.
+     */
+    template <typename F> void spread(const uint8_t* in, uint8_t* out, const size_t& blocks, F kernel) {
+      pool::parallel_for(blocks, chunk / 16, [in, out, &kernel](const size_t& begin, const size_t& end) {
+        kernel(&in[16 * begin], &out[16 * begin], end - begin);
+      });
+    }
+  }
+
+
+  /**
+   * @brief Encrypt every block of a state with AES, in place.
+   * @param s: The state, which carries its own key schedule.
+   * @remarks This function is intentionally a verbatim translation of the
+   * pseudo-code outlined in Algorithm 1 of the Reference.
+   */
+  void Cipher(state& s) {
+    const auto Nr = s.get_rounds();
+    s.AddRoundKey(0);
+
+    for (size_t x = 0; x < Nr - 1; ++x) {
+      s.SubBytes();
+      s.ShiftRows();
+      s.MixColumns();
+      s.AddRoundKey(x + 1);
+    }
+
+    s.SubBytes();
+    s.ShiftRows();
+    s.AddRoundKey(Nr - 1);
+  }
+
+
+  /**
+   * @brief Decrypt every block of a state with AES, in place.
+   * @param s: The state, which carries its own key schedule.
+   * @remarks This function is intentionally a verbatim translation of the
+   * pseudo-code outlined in Algorithm 3 of the Reference.
+   */
+  void InvCipher(state& s) {
+    const auto Nr = s.get_rounds();
+
+    // Because the AddRoundKey is literally just XOR, running it again, but in reverse (Nr-1 -> 0),
+    // undoes the operation, so we don't need a dedicated InvAddRoundKey like the other
+    // steps.
+    s.AddRoundKey(Nr - 1);
+
+    for (size_t x = Nr - 1; x >= 1; --x) {
+      s.InvShiftRows();
+      s.InvSubBytes();
+      s.AddRoundKey(x);
+      s.InvMixColumns();
+    }
+
+    s.InvShiftRows();
+    s.InvSubBytes();
+    s.AddRoundKey(0);
+  }
+
+
+  /**
+   * @brief Encrypt whole blocks with whichever engine is selected.
+   * @param ctx: The context of the key.
+   * @param in: The input blocks.
+   * @param out: Where to write the output (May be the same as in).
+   * @param blocks: How many blocks to encrypt.
+   */
+  void encrypt(const context& ctx, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+    TRACE_SCOPE(ENCRYPT, 16 * blocks);
+    if (bulk()) ecb::encrypt(ctx, in, out, blocks);
+    else {
+      auto s = state(std::span(reinterpret_cast<const std::byte*>(in), 16 * blocks), ctx.get_schedule(), ctx.get_rounds());
+      Cipher(s);
+      std::copy_n(s.data(), s.size(), out);
+    }
+  }
+
+
+  /**
+   * @brief Decrypt whole blocks with whichever engine is selected.
+   * @param ctx: The context of the key.
+   * @param in: The input blocks.
+   * @param out: Where to write the output (May be the same as in).
+   * @param blocks: How many blocks to decrypt.
+   */
+  void decrypt(const context& ctx, const uint8_t* in, uint8_t* out, const size_t& blocks) {
+    TRACE_SCOPE(ENCRYPT, 16 * blocks);
+    if (bulk()) ecb::decrypt(ctx, in, out, blocks);
+    else {
+      auto s = state(std::span(reinterpret_cast<const std::byte*>(in), 16 * blocks), ctx.get_schedule(), ctx.get_rounds());
+      InvCipher(s);
+      std::copy_n(s.data(), s.size(), out);
+    }
+  }
+
+
+  /**
+   * @brief Encrypt a message with AES
+   * @param in: The input string.
+   * @param ctx: The context of the key.
+   * @returns The ciphertext; the message with PKCS#7 padding, so between 1 and 16 bytes longer.
+   * @warning This function, on its own is no different from ECB!
+   */
+  std::string Cipher(const std::string& in, const context& ctx) {
+    TRACE_SCOPE(ENCRYPT, in.length());
+    auto out = pkcs7::pad(in);
+
+    // The faster engines do not need a state at all, and split the blocks across threads.
+    if (bulk()) {
+      auto* bytes = reinterpret_cast<uint8_t*>(out.data());
+      ecb::spread(bytes, bytes, out.length() / 16, [&ctx](const uint8_t* i, uint8_t* o, const size_t& n) {ecb::encrypt(ctx, i, o, n);});
+      return out;
+    }
+
+    auto s = state(out, ctx.get_schedule(), ctx.get_rounds());
+    Cipher(s);
+    return s.unravel();
+  }
+
+
+  /**
+   * @brief Encrypt a message with AES
+   * @param in: The input string.
+   * @param k: The key
+   * @param Nr: The number of rounds we should run (Determine how much of the key is used).
+   * @remarks If you are encrypting more than one message, build a context once instead.
+   */
+  std::string Cipher(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t& Nr) {return Cipher(in, context(k, Nr));}
+
+
+  /**
+   * @brief Decrypt a message with AES
+   * @param in: The input string.
+   * @param ctx: The context of the key.
+   * @returns The message, without its padding.
+   * @throws std::runtime_error If in doesn't end in valid padding once decrypted; see pkcs7::unpad.
+   * @warning This function, on its own is no different from ECB!
+   */
+  std::string InvCipher(const std::string& in, const context& ctx) {
+    TRACE_SCOPE(ENCRYPT, in.length());
+    if (in.empty() || in.length() % 16 != 0) throw std::runtime_error("Invalid padding!");
+
+    std::string out;
+    if (bulk()) {
+      out = in;
+      auto* bytes = reinterpret_cast<uint8_t*>(out.data());
+      ecb::spread(bytes, bytes, out.length() / 16, [&ctx](const uint8_t* i, uint8_t* o, const size_t& n) {ecb::decrypt(ctx, i, o, n);});
+    }
+    else {
+      auto s = state(in, ctx.get_schedule(), ctx.get_rounds());
+      InvCipher(s);
+      out = s.unravel();
+    }
+
+    out.resize(pkcs7::unpad(std::as_bytes(std::span(out))));
+    return out;
+  }
+
+
+  /**
+   * @brief Decrypt a message with AES
+   * @param in: The input string.
+   * @param k: The key
+   * @param Nr: The number of rounds to run.
+   */
+  std::string InvCipher(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t& Nr) {return InvCipher(in, context(k, Nr));}
+
+
+  /**
+   * @brief Encrypt a message with AES, into a buffer.
+   * @param in: The message.
+   * @param out: Where to write the ciphertext; at least in, rounded down to a whole block, plus one more block. It may be in itself.
+   * @param ctx: The context of the key.
+   * @returns How many bytes were written.
+   * @throws std::runtime_error If out is too small.
+   * @remarks Unlike the string functions, this allocates nothing; the faster engines work directly on out.
+   * @warning This function, on its own is no different from ECB!
+   */
+  size_t Cipher(std::span<const std::byte> in, std::span<std::byte> out, const context& ctx) {
+    TRACE_SCOPE(ENCRYPT, in.size());
+    const size_t whole = in.size() / 16, length = 16 * whole + 16;
+    if (out.size() < length) throw std::runtime_error("Output buffer is too small!");
+
+    // Whole blocks go straight from in to out; only the last, which holds the padding, is copied first.
+    block last;
+    pkcs7::pad(in.subspan(16 * whole), std::as_writable_bytes(std::span(last)));
+
+    auto* bytes = reinterpret_cast<uint8_t*>(out.data());
+    ecb::spread(reinterpret_cast<const uint8_t*>(in.data()), bytes, whole, [&ctx](const uint8_t* i, uint8_t* o, const size_t& n) {encrypt(ctx, i, o, n);});
+    encrypt(ctx, last.data(), &bytes[16 * whole], 1);
+    return length;
+  }
+
+
+  /**
+   * @brief Decrypt a message with AES, into a buffer.
+   * @param in: The ciphertext.
+   * @param out: Where to write the plaintext; at least as long as in. It may be in itself.
+   * @param ctx: The context of the key.
+   * @returns The length of the message, which is what remains of out once the padding is dropped.
+   * @throws std::runtime_error If out is too small, or in doesn't end in valid padding once decrypted.
+   */
+  size_t InvCipher(std::span<const std::byte> in, std::span<std::byte> out, const context& ctx) {
+    TRACE_SCOPE(ENCRYPT, in.size());
+    if (in.empty() || in.size() % 16 != 0) throw std::runtime_error("Invalid padding!");
+    if (out.size() < in.size()) throw std::runtime_error("Output buffer is too small!");
+    ecb::spread(reinterpret_cast<const uint8_t*>(in.data()), reinterpret_cast<uint8_t*>(out.data()), in.size() / 16, [&ctx](const uint8_t* i, uint8_t* o, const size_t& n) {decrypt(ctx, i, o, n);});
+    return pkcs7::unpad(out.first(in.size()));
+  }
+
+
+  // How many counter blocks are encrypted together.
+  constexpr size_t BATCH = 8;
+
+
+  /**
+   * @brief XOR blocks against the pads of their counter blocks.
+   * @tparam Counter: A function which writes the counter block for a given block index to a pointer.
+   * @param ctx: The context of the key.
+   * @param in: The blocks.
+   * @param out: Where to write the result (May be the same as in).
+   * @param blocks: How many blocks there are.
+   * @param counter: Produces the counter blocks.
+   * @remarks Counter blocks don't depend on one another, so we encrypt BATCH of them in one call,
+   * which lets the engine overlap their rounds, and then XOR those pads straight into the data.
+   * @remarks For the same reason, each chunk of the input can be handed to a different thread, which
+   * starts from the counter at its own offset. The output is the same as doing it on one thread.
+   */
+  template <typename Counter> void keystream(const context& ctx, const uint8_t* in, uint8_t* out, const size_t& blocks, Counter counter) {
+    auto run = [&ctx, in, out, &counter](const size_t& begin, const size_t& end) {
+      uint8_t pads[16 * BATCH];
+      for (size_t x = begin; x < end; x += BATCH) {
+        const size_t batch = std::min(BATCH, end - x);
+        for (size_t y = 0; y < batch; ++y) counter(x + y, &pads[16 * y]);
+        encrypt(ctx, pads, pads, batch);
+        for (size_t y = 0; y < 16 * batch; ++y) out[16 * x + y] = in[16 * x + y] ^ pads[y];
+      }
+    };
+
+    // A chunk must hold at least a block.
+    if (chunk < 16) run(0, blocks);
+    else pool::parallel_for(blocks, chunk / 16, run);
+  }
+
+
+  // XOR blocks against their pads, in place.
+  template <typename Counter> void keystream(const context& ctx, uint8_t* bytes, const size_t& blocks, Counter counter) {
+    keystream(ctx, bytes, bytes, blocks, counter);
+  }
+
+
+  /**
+   * @brief Gathers the pieces of a message into whole blocks, for the incremental interfaces.
+   * @remarks Anything short of a block waits for the next piece. Once the message is over, what's left
+   * goes through on its own, so the output is exactly as long as the input, just as it is for the
+   * whole-message functions.
+   */
+  class gatherer {
+  private:
+    block pending = {};
+    size_t have = 0;
+
+  public:
+
+    /**
+     * @brief Take the next piece of a message.
+     * @tparam F: A function that transforms blocks in place, given a pointer and how many blocks there are.
+     * @param in: The piece.
+     * @param out: Where every block is appended once it's been transformed.
+     * @param process: The function.
+     */
+    template <typename F> void update(std::span<const char> in, std::string& out, F process) {
+
+      // Finish the block left over from last time.
+      if (have > 0) {
+        const size_t take = std::min(in.size(), 16 - have);
+        std::copy_n(in.begin(), take, pending.begin() + have);
+        have += take;
+        in = in.subspan(take);
+        if (have < 16) return;
+
+        process(pending.data(), 1);
+        out.append(reinterpret_cast<const char*>(pending.data()), 16);
+        have = 0;
+      }
+
+      // Whole blocks are transformed where they land in out.
+      const size_t whole = in.size() / 16 * 16;
+      if (whole > 0) {
+        const size_t start = out.size();
+        out.append(in.data(), whole);
+        process(reinterpret_cast<uint8_t*>(out.data() + start), whole / 16);
+      }
+
+      // Keep the rest for next time.
+      std::copy(in.begin() + whole, in.end(), pending.begin());
+      have = in.size() - whole;
+    }
+
+
+    /**
+     * @brief End the message.
+     * @tparam F: A function that transforms the end of a message in place, given a pointer and how many bytes there are.
+     * @param out: Where what's left is appended, if there is anything.
+     * @param last: The function. The bytes it's given are padded with 0s to a whole block.
+     */
+    template <typename F> void finalize(std::string& out, F last) {
+      if (have == 0) return;
+      std::fill(pending.begin() + have, pending.end(), 0);
+      last(pending.data(), have);
+      out.append(reinterpret_cast<const char*>(pending.data()), have);
+      have = 0;
+    }
+  };
+
+
+  /**
+   * @brief AES-CTR over a message that arrives a piece at a time.
+   * @remarks Each update continues the counter from where the last one left off, so running a
+   * message through in pieces gives the same result as Ctr does for the whole thing.
+   */
+  class stream {
+  private:
+    const context& ctx;
+    uint64_t nonce;
+    gatherer pieces;
+
+  public:
+
+    /**
+     * @brief Start a message.
+     * @param ctx: The context of the key. It must outlive the stream.
+     * @param nonce: The nonce value to use.
+     */
+    stream(const context& ctx, const uint64_t& nonce) : ctx(ctx), nonce(nonce) {}
+
+
+    /**
+     * @brief Encrypt/Decrypt the next blocks of the message, in place.
+     * @param bytes: The blocks.
+     * @param blocks: How many blocks there are.
+     */
+    void update(uint8_t* bytes, const size_t& blocks) {update(bytes, bytes, blocks);}
+
+
+    /**
+     * @brief Encrypt/Decrypt the next blocks of the message, from one place into another.
+     * @param in: The blocks.
+     * @param out: Where to write the result (May be the same as in).
+     * @param blocks: How many blocks there are.
+     */
+    void update(const uint8_t* in, uint8_t* out, const size_t& blocks) {
+      keystream(ctx, in, out, blocks, [this](const size_t& x, uint8_t* counter) {
+        const uint64_t value = nonce + x;
+        std::fill(counter, counter + 16, 0);
+        std::copy_n(reinterpret_cast<const uint8_t*>(&value), sizeof(uint64_t), counter);
+      });
+      nonce += blocks;
+    }
+
+
+    /**
+     * @brief Encrypt/Decrypt the end of the message, in place.
+     * @param bytes: The last bytes of the message.
+     * @param length: How many there are; less than a block.
+     * @remarks The rest of the pad is thrown away, so the output is as long as the input.
+     * @warning Nothing may follow this in the message.
+     */
+    void update_last(uint8_t* bytes, const size_t& length) {
+      block tail = {};
+      std::copy_n(bytes, length, tail.begin());
+      update(tail.data(), 1);
+      std::copy_n(tail.begin(), length, bytes);
+    }
+
+
+    /**
+     * @brief Encrypt/Decrypt the next piece of the message, of any length.
+     * @param in: The piece.
+     * @param out: Where the output is appended, a block at a time.
+     * @returns The stream, to chain another piece.
+     * @remarks Bytes short of a block are held until the next piece, or finalize.
+     */
+    stream& update(std::span<const char> in, std::string& out) {
+      pieces.update(in, out, [this](uint8_t* bytes, const size_t& blocks) {update(bytes, blocks);});
+      return *this;
+    }
+
+
+    /**
+     * @brief End the message.
+     * @param out: Where the rest of the output is appended.
+     */
+    void finalize(std::string& out) {pieces.finalize(out, [this](uint8_t* bytes, const size_t& length) {update_last(bytes, length);});}
+  };
+
+
+  /**
+   * @brief AES in CTR mode, into a buffer.
+   * @param in: The input.
+   * @param out: Where to write the output; at least as long as in. It may be in itself.
+   * @param ctx: The context of the key.
+   * @param nonce: The nonce value to use.
+   * @returns How many bytes were written, which is always the length of in.
+   * @throws std::runtime_error If out is too small.
+   */
+  size_t Ctr(std::span<const std::byte> in, std::span<std::byte> out, const context& ctx, const uint64_t& nonce) {
+    TRACE_SCOPE(ENCRYPT, in.size());
+    if (out.size() < in.size()) throw std::runtime_error("Output buffer is too small!");
+
+    // Whole blocks go straight from in to out; only what's left over is copied first.
+    const auto* from = reinterpret_cast<const uint8_t*>(in.data());
+    auto* bytes = reinterpret_cast<uint8_t*>(out.data());
+    const size_t whole = in.size() / 16, rest = in.size() % 16;
+    auto ctr = stream(ctx, nonce);
+    ctr.update(from, bytes, whole);
+    if (rest) {
+      std::memmove(&bytes[16 * whole], &from[16 * whole], rest);
+      ctr.update_last(&bytes[16 * whole], rest);
+    }
+    return in.size();
+  }
+
+
+  /**
+   * @brief An implementation of AES in CTR mode.
+   * @param in: The input string.
+   * @param ctx: The context of the key.
+   * @param nonce: The nonce value to use.
+   * @remark CTR mode generates a OTP that is then XOR'ed to the message. Therefore, Encryption/Decryption
+   * Uses the same function.
+   * @remark The output is exactly as long as the input; whatever of the last pad isn't needed is dropped.
+   */
+  std::string Ctr(const std::string& in, const context& ctx, uint64_t nonce) {
+    TRACE_SCOPE(ENCRYPT, in.length());
+
+    // The faster engines encrypt the counters in batches, without building a state.
+    if (bulk()) {
+      auto out = in;
+      Ctr(std::as_bytes(std::span(out)), std::as_writable_bytes(std::span(out)), ctx, nonce);
+      return out;
+    }
+
+    // We just use this to partition the input into individual state_arrays.
+    auto s = state(in, ctx.get_schedule(), ctx.get_rounds());
+
+    // Go through each array.
+    for (auto& array: s.get_arrays()) {
+
+      // Generate a Pad for it.
+      auto pad = state(std::string(reinterpret_cast<char*>(&nonce), sizeof(uint64_t)), ctx.get_schedule(), ctx.get_rounds());
+      Cipher(pad);
+
+      // XOR
+      array.xor_arr(pad.get_arrays()[0]);
+
+      // Increment the nonce for the next array.
+      nonce++;
+    }
+
+    // Unravel the state, dropping the end of the last pad.
+    auto out = s.unravel();
+    out.resize(in.length());
+    return out;
+  }
+
+
+  /**
+   * @brief An implementation of AES in CTR mode.
+   * @param in: The input string.
+   * @param k: The key.
+   * @param Nr: The number of rounds to perform.
+   * @param nonce: The nonce value to use.
+   */
+  std::string Ctr(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t Nr, uint64_t nonce) {return Ctr(in, context(k, Nr), nonce);}
+
+
+  /**
+   * @brief Functions related to AES-GCM.
+   * @remarks These functions have been created in reference to:
+   * https://nvlpubs.nist.gov/nistpubs/Legacy/SP/nistspecialpublication800-38d.pdf
+   * Herein referred to as "The Reference" (The AES reference is not
+   * Used here).
+   */
+  namespace gcm {
+
+    /**
+     * @brief A 96 bit IV.
+     * @remarks This is the length the Reference recommends: J0 is then just the IV followed by a counter
+     * of 1, rather than a GHASH of it. See 7.1 of the Reference, and nonce.h for where they come from.
+     */
+    typedef std::array<uint8_t, 12> iv;
+
+
+    /**
+     * @brief The last block GHASH takes: the length of the additional data (we have none), and of the
+     * ciphertext, in bits, as big-endian 64 bit numbers.
+     * @param bytes: The length of the ciphertext, in bytes.
+     * @returns The block.
+     * @remarks Without it, a message and the same message with 0s on the end would hash the same, since
+     * the last block is padded with 0s. See 7.1 of the Reference.
+     */
+    inline block lengths(const uint64_t& bytes) {
+      block ret = {};
+      for (size_t x = 0; x < 8; ++x) ret[15 - x] = (8 * bytes) >> (8 * x);
+      return ret;
+    }
+
+
+    // The same, as a state_array, for the state-based path.
+    inline state_array lengths_array(const uint64_t& bytes) {
+      state_array ret;
+      const auto L = lengths(bytes);
+      std::copy(L.begin(), L.end(), ret.data());
+      return ret;
+    }
+
+
+    /**
+     * @brief Compare a tag against the one we computed.
+     * @param a: One tag.
+     * @param b: The other.
+     * @returns Whether they're the same.
+     * @remarks Comparing stops at the first byte that differs, so how long a forgery takes to be refused
+     * would tell an attacker how many bytes of it were right, and they could guess the tag a byte at a
+     * time. Here, every byte's difference goes into one accumulator, so it takes as long whatever they hold.
+     */
+    inline bool equal(const uint8_t* a, const uint8_t* b) {
+      uint8_t difference = 0;
+      for (size_t x = 0; x < 16; ++x) difference |= a[x] ^ b[x];
+      return difference == 0;
+    }
+
+    /**
+     * @brief The Nonce Increment Function.
+     * @param the state array used as the counter.
+     * @remarks GCM uses a "more sophisticated" means of stepping the
+     * Counter that is passed to AES with the Key to generate the Pad.
+     * @remarks See 6.2 of the Reference.
+     * @remarks I couldn't find a reason for why the increment is performed
+     * This way. By only incrementing the first four bytes, it technically
+     * limits the size of the message to 4294967296 blocks, and we then repeat
+     * A nonce, which would be disaterous. That value is equal to 64GB. My best
+     * Guess is that a more performant implementation (One that wouldn't need to
+     * deconstruct the last four bytes into a new number), would be able to just cast
+     * The last bits, treat it like the very fast uint32_t directly, and increment
+     * it with instructions that are blazingly fast with this datatype (int defaults
+     * to 32bit specifically because it's fast, even faster than the native register
+     * size of 64bit. You can see this by using uint_fast32_t, which C++ mandates as
+     * an integer at least 32 bits, but can be faster if performance will improve
+     * (See https://en.cppreference.com/w/cpp/types/integer). Yet, on every computer
+     * I've personally used, it will always be a 32 bit value, not a 64 bit, which
+     * is neat).
+     */
+     void increment(state_array& X) {
+       // Get the underlying array.
+       auto& array = X.get();
+
+       // The state array is always 128 bits, so len(X) = 128/8 = 16.
+       // While the Reference makes the increment function generic in
+       // Terms of the s value, it is always used with s=32 within GCM,
+       // which is 4 bytes.
+       //
+       // The incrementing function takes the len(X) - s Most
+       // Significant Bits (The first 12 bytes), and does nothing.
+       //
+       // Then, it takes the s least significant bits (the last 4)
+       // Bytes, casts it into a integer, adds one, and then applies
        // A modulus 2**s, and then brings it all back together.
        //
        // So, for the purpose of implementation, we just need to
@@ -905,30 +2698,24 @@ namespace aes {
       //
       state_array Z, V = Y;
 
-      // To iterate through X, we just do our normal row, col
-      // Iteration, and then for each value, we iterate 8 times
-      // For each bit.
-      for (size_t row = 0; row < 4; ++row) {
-        for (size_t col = 0; col < 4; ++col) {
-          uint8_t byte = X.get()[col][row];
-          for (size_t bit = 0; bit < 8; ++bit) {
-          // We can treat this as a boolean, as every non-zero
-          // value is "true".
-          bool x = byte & 0b10000000;
+      // To iterate through X, we go through each byte in order, and then for each
+      // value, we iterate 8 times for each bit, starting from the most significant,
+      // which is how the Reference numbers the bits of a block.
+      const auto* x = X.data();
+      auto* v = V.data();
+      for (size_t byte = 0; byte < 16; ++byte) {
+        for (size_t bit = 0; bit < 8; ++bit) {
 
           // If x_i = 1, Z+1 = Z ^ V. Otherwise, it is unchanged.
-          if (x) Z.xor_arr(V);
-
-          // If the least significant bit of V is 1, we
-          // Shift V, and then XOR it with R.
-          // Otherwise, we just Shift it.
-          V.shift_r(1);
-          if (V.get()[3][3] & 1 == 1)
-            V.xor_arr(R);
-
-          // Shift to the next bit.
-          byte << 1;
-          }
+          if (x[byte] >> (7 - bit) & 1) Z.xor_arr(V);
+
+          // If the least significant bit of V (the last bit of the last byte) is 1, we
+          // Shift V, and then XOR it with R. Otherwise, we just Shift it. We have to
+          // look before shifting, since the shift drops that bit.
+          const bool lsb = v[15] & 1;
+          for (size_t y = 15; y > 0; --y) v[y] = v[y] >> 1 | v[y - 1] << 7;
+          v[0] >>= 1;
+          if (lsb) V.xor_arr(R);
         }
       }
       return Z;
@@ -965,9 +2752,30 @@ namespace aes {
     }
 
 
+    /**
+     * @brief Calculate the GHASH for a state, with the subkey of a context.
+     * @param X: The state
+     * @param ctx: The context, holding the hash subkey.
+     * @returns The hash block.
+     * @remarks Every engine but the reference uses the context's tables; see aes::ghash.
+     */
+    state_array GHASH(const state& X, const context& ctx) {
+      if (engine == REFERENCE) return GHASH(X, ctx.get_H());
+
+      // The state's blocks are already contiguous bytes.
+      block Y = {};
+      ctx.get_hash().update(Y, X.data(), X.get_arrays().size());
+
+      state_array ret;
+      std::copy(Y.begin(), Y.end(), ret.data());
+      return ret;
+    }
+
+
     /**
      * @brief Apply AES-CTR to a message.
      * @param s: The state to operate on.
+     * @param ctx: The context of the key.
      * @param ICB: The initial vector, or nonce.
      * @returns The encrypted/decrypted state.
      * @remarks See 6.5 of the Reference, and Figure 2.
@@ -976,18 +2784,32 @@ namespace aes {
      * To GCM or CTR, but is just how we implemented it in this case), we increment by a special function, rather than
      * just adding one, and we return the state, rather than the unravelled string, so that we can compute the GHASH.
      */
-    state GCTR(state s, state_array ICB) {
+    state GCTR(state s, const context& ctx, state_array ICB) {
+
+      // The faster engines encrypt the counters in batches; see aes::keystream.
+      if (bulk()) {
+        block counter;
+        std::copy_n(ICB.data(), 16, counter.begin());
+
+        // increment() treats the last four bytes as a big-endian number, wrapping around, so the x'th
+        // counter is just that number plus x.
+        const uint32_t low = ttable::load(&counter[12]);
+        keystream(ctx, s.data(), s.get_arrays().size(), [&counter, low](const size_t& x, uint8_t* next) {
+          std::copy(counter.begin(), counter.end() - 4, next);
+          ttable::store(static_cast<uint32_t>(low + x), &next[12]);
+        });
+        return s;
+      }
+
       // Go through each array.
       for (auto& array: s.get_arrays()) {
 
         // Generate a Pad for it.
-        // I KNOW. Unravelling the ICB, and then generating a state is not the pinnacle of efficiency,
-        // but creating a separate Cipher for handling a state_array/state would length an already massive
-        // source file.
-        auto pad = state_array(Cipher(ICB.unravel(), s.get_key(), s.get_rounds()));
+        auto pad = state({ICB}, ctx.get_schedule(), ctx.get_rounds());
+        Cipher(pad);
 
         // XOR
-        array.xor_arr(pad);
+        array.xor_arr(pad.get_arrays()[0]);
 
         // Increment the nonce for the next array.
         increment(ICB);
@@ -996,21 +2818,367 @@ namespace aes {
     }
 
 
+    // GCTR for a state that carries its own key.
+    state GCTR(state s, state_array ICB) {return GCTR(s, context(s.get_key(), s.get_rounds()), ICB);}
+
+
+    /**
+     * @brief AES-GCM over a message that arrives a piece at a time.
+     * @remarks This carries the counter and the running GHASH from one piece to the next, so that
+     * a message never needs to be in memory all at once. The ciphertext and tag are the same as Enc.
+     * @remarks To check a message before releasing any of it, authenticate it all, compare the tag,
+     * and then decrypt it in a second pass with a fresh stream.
+     */
+    class stream {
+    private:
+      const context& ctx;
+
+      // J0, for the tag, the counter for the next block, and the running hash.
+      block J, counter, Y = {};
+
+      // How many bytes of ciphertext have been hashed, for the length block.
+      uint64_t hashed = 0;
+
+
+      // Hash blocks into a running hash.
+      void hash(block& running, const uint8_t* bytes, const size_t& blocks) const {
+        if (engine != REFERENCE) {
+          ctx.get_hash().update(running, bytes, blocks);
+          return;
+        }
+
+        state_array y, x;
+        std::copy(running.begin(), running.end(), y.data());
+        for (size_t b = 0; b < blocks; ++b) {
+          std::copy_n(&bytes[16 * b], 16, x.data());
+          y.xor_arr(x);
+          y = mult(y, ctx.get_H());
+        }
+        std::copy_n(y.data(), 16, running.begin());
+      }
+
+
+      // Like Enc, the message starts at J0 + 1.
+      void start() {
+        counter = J;
+        ttable::store(ttable::load(&counter[12]) + 1, &counter[12]);
+      }
+
+
+    public:
+
+      /**
+       * @brief Start a message.
+       * @param ctx: The context of the key. It must outlive the stream.
+       * @param nonce: The nonce IV.
+       */
+      stream(const context& ctx, const uint64_t& nonce) : ctx(ctx) {
+
+        // J0 is the GHASH of the nonce, as a block padded with 0s, and then its length.
+        block N = {};
+        std::copy_n(reinterpret_cast<const uint8_t*>(&nonce), sizeof(nonce), N.begin());
+        const auto L = lengths(sizeof(nonce));
+        J = {};
+        hash(J, N.data(), 1);
+        hash(J, L.data(), 1);
+        start();
+      }
+
+
+      /**
+       * @brief Start a message with a 96 bit IV.
+       * @param ctx: The context of the key. It must outlive the stream.
+       * @param nonce: The IV.
+       * @remarks J0 is the IV, then 0s, and a 1 in the last bit, with no GHASH at all.
+       */
+      stream(const context& ctx, const iv& nonce) : ctx(ctx) {
+        J = {};
+        std::copy(nonce.begin(), nonce.end(), J.begin());
+        J[15] = 1;
+        start();
+      }
+
+
+      /**
+       * @brief Encrypt the next blocks of the message, in place.
+       * @param bytes: The blocks.
+       * @param blocks: How many blocks there are.
+       */
+      void encrypt(uint8_t* bytes, const size_t& blocks) {
+        gctr(bytes, blocks);
+        authenticate(bytes, blocks);
+      }
+
+
+      /**
+       * @brief Decrypt the next blocks of the message, in place.
+       * @param bytes: The blocks.
+       * @param blocks: How many blocks there are.
+       * @warning This releases plaintext before the tag has been checked.
+       */
+      void decrypt(uint8_t* bytes, const size_t& blocks) {
+        authenticate(bytes, blocks);
+        gctr(bytes, blocks);
+      }
+
+
+      /**
+       * @brief GCTR the next blocks in place, without hashing them.
+       * @param bytes: The blocks.
+       * @param blocks: How many blocks there are.
+       * @remarks Once authenticate has checked a message, this decrypts it. See GCTR for the counters.
+       */
+      void gctr(uint8_t* bytes, const size_t& blocks) {
+        const uint32_t low = ttable::load(&counter[12]);
+        keystream(ctx, bytes, blocks, [this, low](const size_t& x, uint8_t* next) {
+          std::copy(counter.begin(), counter.end() - 4, next);
+          ttable::store(static_cast<uint32_t>(low + x), &next[12]);
+        });
+        ttable::store(static_cast<uint32_t>(low + blocks), &counter[12]);
+      }
+
+
+      /**
+       * @brief Hash the next blocks of ciphertext, without decrypting them.
+       * @param bytes: The blocks.
+       * @param blocks: How many blocks there are.
+       */
+      void authenticate(const uint8_t* bytes, const size_t& blocks) {
+        hash(Y, bytes, blocks);
+        hashed += 16 * blocks;
+      }
+
+
+      /**
+       * The end of a message is usually short of a block. The ciphertext is then exactly as long as the
+       * plaintext, and GCM hashes it as if it were padded with 0s; see 7.1 of the Reference. These
+       * each take that last piece, of less than a block, after which nothing may follow in the message.
+       */
+
+      // Encrypt the end of the message, in place.
+      void encrypt_last(uint8_t* bytes, const size_t& length) {
+        block tail = {};
+        std::copy_n(bytes, length, tail.begin());
+        gctr(tail.data(), 1);
+        std::fill(tail.begin() + length, tail.end(), 0);
+        hash(Y, tail.data(), 1);
+        hashed += length;
+        std::copy_n(tail.begin(), length, bytes);
+      }
+
+
+      // Decrypt the end of the message, in place.
+      void decrypt_last(uint8_t* bytes, const size_t& length) {
+        authenticate_last(bytes, length);
+        gctr_last(bytes, length);
+      }
+
+
+      // GCTR the end of the message in place, without hashing it.
+      void gctr_last(uint8_t* bytes, const size_t& length) {
+        block tail = {};
+        std::copy_n(bytes, length, tail.begin());
+        gctr(tail.data(), 1);
+        std::copy_n(tail.begin(), length, bytes);
+      }
+
+
+      // Hash the end of the ciphertext, without decrypting it.
+      void authenticate_last(const uint8_t* bytes, const size_t& length) {
+        block tail = {};
+        std::copy_n(bytes, length, tail.begin());
+        hash(Y, tail.data(), 1);
+        hashed += length;
+      }
+
+
+      /**
+       * @brief The tag for everything so far.
+       * @returns The hash block, as Enc appends it.
+       */
+      block tag() const {
+        block ret = Y;
+        const auto L = lengths(hashed);
+        hash(ret, L.data(), 1);
+        keystream(ctx, ret.data(), 1, [this](const size_t&, uint8_t* next) {std::copy(J.begin(), J.end(), next);});
+        return ret;
+      }
+    };
+
+
+    /**
+     * @brief Encrypt a message with AES-GCM, a piece at a time.
+     * @remarks For example: gcm::encryptor(ctx, nonce).update(first, cipher).update(second, cipher).finalize(cipher, tag);
+     * cipher + tag is then what Enc returns for first + second.
+     */
+    class encryptor {
+    private:
+      stream gcm;
+      gatherer pieces;
+
+    public:
+
+      /**
+       * @brief Start a message.
+       * @param ctx: The context of the key. It must outlive the encryptor.
+       * @param nonce: The nonce IV.
+       */
+      encryptor(const context& ctx, const uint64_t& nonce) : gcm(ctx, nonce) {}
+      encryptor(const context& ctx, const iv& nonce) : gcm(ctx, nonce) {}
+
+
+      /**
+       * @brief Encrypt the next piece of the message, of any length.
+       * @param in: The piece.
+       * @param out: Where the ciphertext is appended, a block at a time.
+       * @returns The encryptor, to chain another piece.
+       */
+      encryptor& update(std::span<const char> in, std::string& out) {
+        pieces.update(in, out, [this](uint8_t* bytes, const size_t& blocks) {gcm.encrypt(bytes, blocks);});
+        return *this;
+      }
+
+
+      /**
+       * @brief End the message.
+       * @param out: Where the rest of the ciphertext is appended.
+       * @param tag: Where the tag is written.
+       */
+      void finalize(std::string& out, block& tag) {
+        pieces.finalize(out, [this](uint8_t* bytes, const size_t& length) {gcm.encrypt_last(bytes, length);});
+        tag = gcm.tag();
+      }
+    };
+
+
+    /**
+     * @brief Decrypt a message with AES-GCM, a piece at a time.
+     * @remarks The ciphertext is everything Enc returns but the last 16 bytes, which are the tag.
+     * @warning Unlike Dec, plaintext is released before the tag is checked. Discard all of it if finalize throws.
+     */
+    class decryptor {
+    private:
+      stream gcm;
+      gatherer pieces;
+
+    public:
+
+      /**
+       * @brief Start a message.
+       * @param ctx: The context of the key. It must outlive the decryptor.
+       * @param nonce: The nonce IV.
+       */
+      decryptor(const context& ctx, const uint64_t& nonce) : gcm(ctx, nonce) {}
+      decryptor(const context& ctx, const iv& nonce) : gcm(ctx, nonce) {}
+
+
+      /**
+       * @brief Decrypt the next piece of the message, of any length.
+       * @param in: The piece of ciphertext.
+       * @param out: Where the plaintext is appended, a block at a time.
+       * @returns The decryptor, to chain another piece.
+       */
+      decryptor& update(std::span<const char> in, std::string& out) {
+        pieces.update(in, out, [this](uint8_t* bytes, const size_t& blocks) {gcm.decrypt(bytes, blocks);});
+        return *this;
+      }
+
+
+      /**
+       * @brief End the message, and check it.
+       * @param out: Where the rest of the plaintext is appended.
+       * @param tag: The tag sent with the message.
+       * @throws std::runtime_error if the message has been modified or an incorrect key was supplied.
+       */
+      void finalize(std::string& out, const block& tag) {
+        pieces.finalize(out, [this](uint8_t* bytes, const size_t& length) {gcm.decrypt_last(bytes, length);});
+        if (!equal(gcm.tag().data(), tag.data())) throw std::runtime_error("Message does not match! Refusing to decrypt!");
+      }
+    };
+
+
+    /**
+     * @brief Encrypt a message with AES-GCM, into a buffer.
+     * @param in: The message.
+     * @param out: Where to write the ciphertext and tag; at least 16 bytes longer than in. It may be in itself.
+     * @param ctx: The context of the key.
+     * @param nonce: The nonce IV; a uint64_t, or a 96 bit iv.
+     * @returns How many bytes were written, tag included.
+     * @throws std::runtime_error If out is too small.
+     */
+    template <typename Nonce> size_t Enc(std::span<const std::byte> in, std::span<std::byte> out, const context& ctx, const Nonce& nonce) {
+      TRACE_SCOPE(ENCRYPT, in.size());
+      if (out.size() < in.size() + 16) throw std::runtime_error("Output buffer is too small!");
+      if (out.data() != in.data()) std::memmove(out.data(), in.data(), in.size());
+
+      auto* bytes = reinterpret_cast<uint8_t*>(out.data());
+      const size_t whole = in.size() / 16;
+      auto gcm = stream(ctx, nonce);
+      gcm.encrypt(bytes, whole);
+      if (in.size() % 16) gcm.encrypt_last(&bytes[16 * whole], in.size() % 16);
+
+      const auto tag = gcm.tag();
+      std::copy(tag.begin(), tag.end(), &bytes[in.size()]);
+      return in.size() + 16;
+    }
+
+
+    /**
+     * @brief Decrypt a message with AES-GCM, into a buffer.
+     * @param in: The ciphertext, with the tag as its last 16 bytes.
+     * @param out: Where to write the plaintext; at least as long as in, less the tag. It may be in itself.
+     * @param ctx: The context of the key.
+     * @param nonce: The nonce value/IV; a uint64_t, or a 96 bit iv.
+     * @returns How many bytes were written.
+     * @throws std::runtime_error If out is too small, or the message has been modified or an incorrect key was supplied.
+     * @remarks As with Dec, the tag is checked before anything is written.
+     */
+    template <typename Nonce> size_t Dec(std::span<const std::byte> in, std::span<std::byte> out, const context& ctx, const Nonce& nonce) {
+      TRACE_SCOPE(ENCRYPT, in.size());
+      if (in.size() < 16) throw std::runtime_error("Message does not match! Refusing to decrypt!");
+      const auto cipher = in.first(in.size() - 16);
+      const auto* tag = reinterpret_cast<const uint8_t*>(in.data() + cipher.size());
+      const size_t whole = cipher.size() / 16, rest = cipher.size() % 16;
+
+      auto gcm = stream(ctx, nonce);
+      gcm.authenticate(reinterpret_cast<const uint8_t*>(cipher.data()), whole);
+      if (rest) gcm.authenticate_last(reinterpret_cast<const uint8_t*>(&cipher[16 * whole]), rest);
+      const auto expected = gcm.tag();
+      if (!equal(expected.data(), tag)) throw std::runtime_error("Message does not match! Refusing to decrypt!");
+
+      if (out.size() < cipher.size()) throw std::runtime_error("Output buffer is too small!");
+      if (out.data() != cipher.data()) std::memmove(out.data(), cipher.data(), cipher.size());
+      auto* bytes = reinterpret_cast<uint8_t*>(out.data());
+      gcm.gctr(bytes, whole);
+      if (rest) gcm.gctr_last(&bytes[16 * whole], rest);
+      return cipher.size();
+    }
+
+
     /*
      * @brief Encrypt a message with AES-GCM
      * @param in: The input string.
-     * @param k: The key.
-     * @param Nr: The number of rounds to perform.
+     * @param ctx: The context of the key.
      * @param nonce: The nonce IV.
-     * @returns An encrypted string, with the hash block attached to the end
+     * @returns An encrypted string as long as in, with the hash block attached to the end
      */
-    std::string Enc(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t Nr, uint64_t nonce) {
+    std::string Enc(const std::string& in, const context& ctx, uint64_t nonce) {
+      TRACE_SCOPE(ENCRYPT, in.length());
+
+      // The faster engines work on the bytes directly; see the span overload.
+      if (bulk()) {
+        std::string out(in.length() + 16, '\0');
+        Enc(std::as_bytes(std::span(in)), std::as_writable_bytes(std::span(out)), ctx, nonce);
+        return out;
+      }
 
-      // Generate our H hash subkey by encrypting a 0 block.
-      state_array H = Cipher("\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", k, Nr);
+      const auto& schedule = ctx.get_schedule();
+      const auto& Nr = ctx.get_rounds();
 
-      // Generate the J0 that we'll use as a counter, based on our IV/Nonce.
-      auto J = GHASH(state(std::string(reinterpret_cast<char*>(&nonce), sizeof(nonce)), k, Nr), H);
+      // Our H hash subkey is an encrypted 0 block; the context already has it, and its tables.
+      // Generate the J0 that we'll use as a counter, based on our IV/Nonce: since it isn't 96 bits,
+      // it's the GHASH of the nonce padded with 0s, followed by its length.
+      auto J = GHASH(state({state_array(std::string(reinterpret_cast<char*>(&nonce), sizeof(nonce))), lengths_array(sizeof(nonce))}, schedule, Nr), ctx);
 
       // This J is incremented for encrypting the message (We use J0 for the hash). This is so that
       // We can immediately check the hash on the decryption step, avoiding having to decrypt the message
@@ -1018,9 +3186,12 @@ namespace aes {
       auto Jc = J;
       increment(Jc);
 
-      // Encrypt our message.
-      auto cipher_state = state(in, k, Nr);
-      cipher_state = GCTR(cipher_state, Jc);
+      // Encrypt our message. The state pads it to whole blocks, so we drop what's past the end of the
+      // message, and build the state again, since the Reference hashes the ciphertext padded with 0s.
+      auto cipher = GCTR(state(in, schedule, Nr), ctx, Jc).unravel();
+      cipher.resize(in.length());
+      auto cipher_state = state(cipher, schedule, Nr);
+      cipher_state.get_arrays().push_back(lengths_array(cipher.length()));
 
       // Generate our Hash. Basically, we run GHASH to get a single block or state_array, and then turn that into
       // A "state" of 1 so that GCTR can encrypt it, and then pull out the singular block to get a state_array again.
@@ -1029,48 +3200,98 @@ namespace aes {
       // anything from destination IP, to Names (This data will be Authenticated, but must be sent in the clear)
       // . For this implementation the only AAD that we would consider is the Nonce, but since it's already
       // Included in the Hash via J, we just hash the cipher.
-      auto hash = GCTR(state({GHASH(cipher_state, H)}, k, Nr), J).get_arrays()[0];
+      auto hash = GCTR(state({GHASH(cipher_state, ctx)}, schedule, Nr), ctx, J).get_arrays()[0];
+
+      // Add the hash to the end of the cipher, and return it as one object.
+      return cipher + hash.unravel();
+    }
+
+
+    // Encrypt a message with AES-GCM, from the key.
+    std::string Enc(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t Nr, uint64_t nonce) {return Enc(in, context(k, Nr), nonce);}
+
 
-      // Add the hash to the end of the cipher_state, and return it as one object.
-      cipher_state.get_arrays().emplace_back(hash);
-      return cipher_state.unravel();
+    /**
+     * @brief Encrypt a message with AES-GCM, with a 96 bit IV.
+     * @param in: The input string.
+     * @param ctx: The context of the key.
+     * @param nonce: The IV.
+     * @returns An encrypted string as long as in, with the hash block attached to the end
+     * @remarks Every engine goes through the stream here; it already takes the reference path when asked.
+     */
+    std::string Enc(const std::string& in, const context& ctx, const iv& nonce) {
+      TRACE_SCOPE(ENCRYPT, in.length());
+      std::string out(in.length() + 16, '\0');
+      Enc(std::as_bytes(std::span(in)), std::as_writable_bytes(std::span(out)), ctx, nonce);
+      return out;
     }
 
 
     /**
      * @brief Decrypt a message with AES-GCM
      * @param in: The ciphertext.
-     * @param k: The key.
-     * @param Nr: The number of rounds to perform.
+     * @param ctx: The context of the key.
      * @param nonce: The nonce value/IV.
      * @returns The plaintext message.
      * @throws std::runtime_error if the message has been modified or an incorrect key was supplied.
      */
-    std::string Dec(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t Nr, uint64_t nonce) {
+    std::string Dec(const std::string& in, const context& ctx, uint64_t nonce) {
+      TRACE_SCOPE(ENCRYPT, in.length());
+      if (bulk()) {
+        auto out = in;
+        out.resize(Dec(std::as_bytes(std::span(out)), std::as_writable_bytes(std::span(out)), ctx, nonce));
+        return out;
+      }
+
+      if (in.length() < 16) throw std::runtime_error("Message does not match! Refusing to decrypt!");
 
-      // Generate our H hash subkey by encrypting a 0 block.
-      state_array H = Cipher("\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", k, Nr);
+      const auto& schedule = ctx.get_schedule();
+      const auto& Nr = ctx.get_rounds();
 
-      // Generate the J0 that we'll use as a counter, based on our IV/Nonce.
-      auto J = GHASH(state(std::string(reinterpret_cast<char*>(&nonce), sizeof(nonce)), k, Nr), H);
+      // Generate the J0 that we'll use as a counter, based on our IV/Nonce, as Enc does.
+      auto J = GHASH(state({state_array(std::string(reinterpret_cast<char*>(&nonce), sizeof(nonce))), lengths_array(sizeof(nonce))}, schedule, Nr), ctx);
 
-      // Get the cipher, and then pop the hash off the back.
-      auto cipher_state = state(in, k, Nr);
-      auto hash = cipher_state.get_arrays().back();
-      cipher_state.get_arrays().pop_back();
+      // Get the cipher, and then take the hash off the back. The hash covers the cipher's length too.
+      const auto length = in.length() - 16;
+      auto cipher_state = state(in.substr(0, length), schedule, Nr);
+      auto hashed = cipher_state;
+      hashed.get_arrays().push_back(lengths_array(length));
+      auto hash = state_array(in.substr(length));
 
       // Then, compute the hash using J.
-      hash = GCTR(state({hash}, k, Nr), J).get_arrays()[0];
+      hash = GCTR(state({hash}, schedule, Nr), ctx, J).get_arrays()[0];
 
       // If they don't match then either the key was wrong, or one of the blocks has been modified.
       // Either way, throw a runtime error.
-      if (hash.unravel() != GHASH(cipher_state, H).unravel()) {
+      if (!equal(hash.data(), GHASH(hashed, ctx).data())) {
         throw std::runtime_error("Message does not match! Refusing to decrypt!");
       }
 
       // If they do match, then increment J and proceed with decryption.
       increment(J);
-      return GCTR(cipher_state, J).unravel();
+      auto plain = GCTR(cipher_state, ctx, J).unravel();
+      plain.resize(length);
+      return plain;
+    }
+
+
+    // Decrypt a message with AES-GCM, from the key.
+    std::string Dec(const std::string& in, const std::array<uint64_t, 4>& k, const uint64_t Nr, uint64_t nonce) {return Dec(in, context(k, Nr), nonce);}
+
+
+    /**
+     * @brief Decrypt a message with AES-GCM, with a 96 bit IV.
+     * @param in: The ciphertext.
+     * @param ctx: The context of the key.
+     * @param nonce: The IV.
+     * @returns The plaintext message.
+     * @throws std::runtime_error if the message has been modified or an incorrect key was supplied.
+     */
+    std::string Dec(const std::string& in, const context& ctx, const iv& nonce) {
+      TRACE_SCOPE(ENCRYPT, in.length());
+      auto out = in;
+      out.resize(Dec(std::as_bytes(std::span(out)), std::as_writable_bytes(std::span(out)), ctx, nonce));
+      return out;
     }
   }
 }
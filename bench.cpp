@@ -0,0 +1,546 @@
+#include <iostream>   // For the results.
+#include <iomanip>    // For formatting them.
+#include <cstdlib>    // For malloc and free.
+#include <ctime>      // To seed the RNG.
+#include <chrono>     // For the time each benchmark takes.
+#include <string>     // For std::string
+#include <vector>     // For the buffers.
+#include <atomic>     // For the allocation counter.
+#include <new>        // To count allocations.
+#include <random>     // For random messages and keys.
+#include <stdexcept>  // For std::runtime_error
+#include <type_traits> // For what a benchmark returns.
+#include <sys/wait.h> // To wait on the loopback peer.
+
+#include "aes.h"      // For our AES Implementation
+#include "prime.h"    // For generating primes.
+#include "network.h"  // For the loopback.
+#include "nonce.h"    // For 96 bit IVs.
+#include "exchange.h" // For the key exchange.
+#include "trace.h"    // For the cycle counter, and the counters if built with TRACE.
+
+
+/*
+ * Every allocation made through new, counted, so that each benchmark can report how many it makes.
+ */
+std::atomic<uint64_t> allocations = 0;
+
+// Each replacement is kept out of line, so that GCC can't see malloc meet free across them and warn about a mismatch.
+#define REPLACEMENT __attribute__((noinline))
+
+REPLACEMENT void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto* p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+REPLACEMENT void* operator new(size_t size, std::align_val_t align) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  const auto a = static_cast<size_t>(align);
+  if (auto* p = std::aligned_alloc(a, (size + a - 1) / a * a)) return p;
+  throw std::bad_alloc();
+}
+REPLACEMENT void* operator new[](size_t size) {return operator new(size);}
+REPLACEMENT void* operator new[](size_t size, std::align_val_t align) {return operator new(size, align);}
+REPLACEMENT void operator delete(void* p) noexcept {std::free(p);}
+REPLACEMENT void operator delete[](void* p) noexcept {std::free(p);}
+REPLACEMENT void operator delete(void* p, size_t) noexcept {std::free(p);}
+REPLACEMENT void operator delete[](void* p, size_t) noexcept {std::free(p);}
+REPLACEMENT void operator delete(void* p, std::align_val_t) noexcept {std::free(p);}
+REPLACEMENT void operator delete[](void* p, std::align_val_t) noexcept {std::free(p);}
+REPLACEMENT void operator delete(void* p, size_t, std::align_val_t) noexcept {std::free(p);}
+REPLACEMENT void operator delete[](void* p, size_t, std::align_val_t) noexcept {std::free(p);}
+#undef REPLACEMENT
+
+
+// How long each benchmark runs for, in seconds, after a first call to warm up.
+double budget = 0.25;
+
+// The engines, and their names.
+constexpr aes::backend engines[] = {aes::REFERENCE, aes::TABLE, aes::TTABLE, aes::HARDWARE, aes::BITSLICE};
+constexpr const char* engine_names[] = {"REFERENCE", "TABLE", "TTABLE", "HARDWARE", "BITSLICE"};
+
+// Every engine this machine can run.
+std::vector<aes::backend> available() {
+  std::vector<aes::backend> ret;
+  for (const auto& e : engines) if (e != aes::HARDWARE || aes::supported()) ret.emplace_back(e);
+  return ret;
+}
+
+// The sizes of the bulk benchmarks.
+constexpr size_t sizes[] = {64, 1 << 10, 1 << 20, size_t(1) << 30};
+
+// The largest size to benchmark an engine at. The engines that go through a state would take hours over a GiB.
+size_t largest(const aes::backend& e) {
+  switch (e) {
+    case aes::REFERENCE: return 1 << 10;
+    case aes::TABLE: return 1 << 20;
+    default: return sizes[std::size(sizes) - 1];
+  }
+}
+
+std::mt19937_64 rng(std::time(0));
+
+// A random string.
+std::string random_string(const size_t& length) {
+  std::string ret(length, '\0');
+  for (auto& c : ret) c = static_cast<char>(rng());
+  return ret;
+}
+
+
+// A size, in the units it reads best in.
+std::string human(const size_t& bytes) {
+  if (bytes >= size_t(1) << 30) return std::to_string(bytes >> 30) + " GiB";
+  if (bytes >= 1 << 20) return std::to_string(bytes >> 20) + " MiB";
+  if (bytes >= 1 << 10) return std::to_string(bytes >> 10) + " KiB";
+  return std::to_string(bytes) + " B";
+}
+
+
+/**
+ * @brief Time a benchmark, and print what it cost.
+ * @param name: What's being measured.
+ * @param engine: The engine it's measured under, if it matters.
+ * @param bytes: How many bytes each call goes through, or 0 if it's measured per call.
+ * @param op: The call.
+ * @remarks op is called once to warm up, then as many times as fit in budget. Each line has the calls made, the cycles
+ * for each byte (or each call, if bytes is 0), the throughput, and the allocations each call made.
+ */
+template <typename F> void measure(const std::string& name, const std::string& engine, const size_t& bytes, F op) {
+
+  // Whatever op returns is kept, so that the compiler can't drop the call.
+  auto call = [&op]() {
+    if constexpr (std::is_void_v<decltype(op())>) op();
+    else {
+      auto result = op();
+      asm volatile("" : : "g"(&result) : "memory");
+    }
+  };
+  call();
+
+  size_t calls = 0;
+  const auto before = allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  const auto cycles = trace::cycles();
+  double elapsed = 0;
+  do {
+    call();
+    ++calls;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  } while (elapsed < budget);
+  const double spent = trace::cycles() - cycles, allocs = double(allocations.load() - before) / calls;
+
+  std::cout << std::left << std::setw(18) << name << std::setw(11) << engine << std::right << std::setw(8) << (bytes ? human(bytes) : "")
+            << std::setw(10) << calls << std::fixed << std::setprecision(2);
+  if (bytes) std::cout << std::setw(12) << spent / calls / bytes << " c/B" << std::setw(10) << bytes * calls / elapsed / (1 << 20) << " MiB/s";
+  else std::cout << std::setw(12) << spent / calls << " c/op" << std::setw(10) << elapsed / calls * 1e6 << " us/op";
+  std::cout << std::setw(9) << allocs << " allocs/op" << std::endl;
+}
+
+
+// How many checks have failed.
+size_t failures = 0;
+
+// Record a check.
+void check(const std::string& what, const bool& passed) {
+  if (!passed) {
+    std::cout << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+
+// A state_array from hex bytes, separated by spaces.
+aes::state_array from_hex(const std::string& hex) {
+  std::string bytes;
+  for (size_t x = 0; x < hex.length(); x += 3) bytes += static_cast<char>(std::stoi(hex.substr(x, 2), nullptr, 16));
+  return aes::state_array(bytes);
+}
+
+// Whether a state_array holds the same bytes as another.
+bool same(const aes::state_array& a, const aes::state_array& b) {
+  for (size_t x = 0; x < 16; ++x) if (a.get()[x / 4][x % 4] != b.get()[x / 4][x % 4]) return false;
+  return true;
+}
+
+
+/**
+ * @brief Check the pieces of AES and GCM against the known answers of FIPS-197 and the GCM specification.
+ * @remarks The key schedule and Cipher here have always differed from the standard (see key::Expansion), and
+ * are kept that way so that messages remain compatible; so the appendices' ciphertexts don't apply. What does
+ * apply are the S-box, the field multiply, and the round transforms, which are checked against round 1 of
+ * Appendix B for both engines that use a state, and GHASH, which is checked against Test Case 2 of the GCM
+ * specification for every way of computing it.
+ */
+void known_answers() {
+  check("S-box of 0x00", aes::sbox::forward[0x00] == 0x63);
+  check("S-box of 0x53", aes::sbox::forward[0x53] == 0xed);
+  check("Inverse S-box of 0xed", aes::sbox::inverse[0xed] == 0x53);
+  for (size_t x = 0; x < 256; ++x) check("Inverse S-box of the S-box", aes::sbox::inverse[aes::sbox::forward[x]] == x);
+
+  // 4.2 and 4.2.1
+  check("{57} * {83}", aes::gf::mult(0x57, 0x83) == 0xc1);
+  check("{57} * {13}", aes::gf::mult(0x57, 0x13) == 0xfe);
+
+  const auto input = from_hex("19 3d e3 be a0 f4 e2 2b 9a c6 8d 2a e9 f8 48 08"),
+    sub = from_hex("d4 27 11 ae e0 bf 98 f1 b8 b4 5d e5 1e 41 52 30"),
+    shift = from_hex("d4 bf 5d 30 e0 b4 52 ae b8 41 11 f1 1e 27 98 e5"),
+    mix = from_hex("04 66 81 e5 e0 cb 19 9a 48 f8 d3 7a 28 06 26 4c");
+
+  const auto previous = aes::engine;
+  for (const auto& e : {aes::REFERENCE, aes::TABLE}) {
+    aes::engine = e;
+    const std::string name = engine_names[e];
+    auto a = input;
+    a.SubBytes(); check(name + " SubBytes", same(a, sub));
+    a.ShiftRows(); check(name + " ShiftRows", same(a, shift));
+    a.MixColumns(); check(name + " MixColumns", same(a, mix));
+    a.InvMixColumns(); check(name + " InvMixColumns", same(a, shift));
+    a.InvShiftRows(); check(name + " InvShiftRows", same(a, sub));
+    a.InvSubBytes(); check(name + " InvSubBytes", same(a, input));
+  }
+
+  // GHASH(H, {}, C), where the hash takes C and then its length, of 128 bits.
+  const auto H = from_hex("66 e9 4b d4 ef 8a 2c 3b 88 4c fa 59 ca 34 2b 2e"),
+    C = from_hex("03 88 da ce 60 b6 a3 92 f3 28 c2 b9 71 b2 fe 78"),
+    expected = from_hex("f3 8c bb 1a d6 92 23 dc c3 45 7a e5 b6 b0 f8 85");
+  const auto L = aes::gcm::lengths_array(16);
+  auto Y = aes::gcm::mult(C, H);
+  Y.xor_arr(L);
+  check("GHASH with mult", same(aes::gcm::mult(Y, H), expected));
+
+  const aes::ghash::table table(H);
+  for (const auto& e : {aes::TABLE, aes::HARDWARE}) {
+    aes::engine = e;
+    aes::block hash = {};
+    table.update(hash, C.data(), 1);
+    table.update(hash, L.data(), 1);
+    check(std::string("GHASH with ") + engine_names[e] + " tables", std::equal(hash.begin(), hash.end(), expected.data()));
+  }
+  aes::engine = previous;
+}
+
+
+/**
+ * @brief Check the key exchange against a known answer, and that both sides of it agree.
+ * @remarks The known answer is 2**k in the 2048 bit group of RFC 3526, as computed by Python's pow. Both
+ * sides of each handshake are run here, without a network, to check that they end with the same key in
+ * every group; a peer answering in the wrong group, or hashing the secret differently, would not.
+ */
+void key_exchange() {
+  const auto k = bignum::number<2048>::hex("f0e1d2c3b4a5968778695a4b3c2d1e0f0123456789abcdeffedcba9876543210");
+  const auto expected = bignum::number<2048>::hex(
+    "fb1cc2c6 c7f66865 5d43e8c5 91258b17 2609891c 978ca095 f6c40165 19a5fc38 9c6ecdec 6af46499 7ebe1cc4 c950c599"
+    "37c1eb21 44aa0b18 d6c89d64 bdff8f02 a245553e 14b72679 5420813a 3d609e21 0bb5fd2d b1d3505f e1a35d00 1a4e8ec4"
+    "ec504657 56139372 bce1bf7b 538827c0 525965dd 52650c73 a1bb93b6 80d40f40 c4442c9c 1d2a7379 03f6e2c0 d38bb667"
+    "ed845403 c62c07f5 9f5eb291 34c43f6e cf315615 2f733f78 78f065c6 3c5ec6c2 6d66e2e2 83b64cc5 83ae5921 06f95807"
+    "c49241e8 91da219b 8867886b 43fa6a7f aa347109 315c743e 43e03bac 226ed0e5 16db25ba b95f477b be8dd669 18ce2b3b"
+    "ee3716a7 b3d597c8 d6e76e23 c969f759"
+  );
+  check("MODP 2048 2**k", exchange::compute_intermediary(exchange::modp<2048>::get(), k) == expected);
+
+  const auto previous = exchange::standard;
+  constexpr const char* names[] = {"GENERATED", "MODP2048", "MODP3072"};
+  for (const auto& group : {exchange::GENERATED, exchange::MODP2048, exchange::MODP3072}) {
+    exchange::standard = group;
+    try {
+      exchange::secret offering, answering;
+      const auto offer = offering.offer();
+      std::array<uint64_t, 4> answered;
+      const auto answer = answering.answer(offer, answered);
+      check(std::string("Handshake in ") + names[group], offering.finish(answer) == answered);
+    }
+    catch (std::runtime_error& err) {check(std::string("Handshake in ") + names[group] + ": " + err.what(), false);}
+  }
+  exchange::standard = previous;
+}
+
+
+/**
+ * @brief Check prime's arithmetic and primality test, and the groups it generates.
+ * @remarks is answers exactly below 2^64 only because of its choice of bases, so it's checked against the
+ * numbers most likely to fool it: Carmichael numbers, which pass Fermat's test for every base, and the
+ * smallest strong pseudoprimes to the first few primes as bases, up to the first nine. Those with a factor
+ * below 256 are caught by trial division, so most are chosen without one. raise is checked against plain
+ * arithmetic at twice the width, for moduli above 2^32, both odd (Montgomery's form) and even.
+ */
+void primes() {
+  for (const uint64_t p : {2ull, 3ull, 251ull, 257ull, 65537ull, 998244353ull, 1000000007ull, 2147483647ull, 4294967291ull,
+      4294967311ull, 2305843009213693951ull, 18446744073709551557ull})
+    check("Prime " + std::to_string(p), prime::is(p));
+
+  // Carmichael numbers, the last three of the form (6k + 1)(12k + 1)(18k + 1).
+  for (const uint64_t c : {561ull, 1105ull, 1729ull, 41041ull, 825265ull, 118901521ull, 172947529ull, 947813749259110849ull})
+    check("Carmichael number " + std::to_string(c), !prime::is(c));
+
+  // The smallest strong pseudoprimes to the first 1, 2, 3, 4, 5, 6, 7, and 9 primes, and a product of two large primes.
+  for (const uint64_t c : {2047ull, 1373653ull, 25326001ull, 3215031751ull, 2152302898747ull, 3474749660383ull,
+      341550071728321ull, 3825123056546413051ull, 18446743979220271189ull})
+    check("Strong pseudoprime " + std::to_string(c), !prime::is(c));
+
+  for (const uint64_t n : {0ull, 1ull, 4ull, 65536ull, 18446744073709551615ull}) check("Composite " + std::to_string(n), !prime::is(n));
+
+  for (size_t x = 0; x < 1000; ++x) {
+    const uint64_t mod = rng() | (uint64_t(1) << (32 + x % 32)), value = rng(), exp = rng();
+    prime::wide expected = 1, base = value % mod;
+    for (auto e = exp; e > 0; e >>= 1) {
+      if (e & 1) expected = expected * base % mod;
+      base = base * base % mod;
+    }
+    check("raise modulo " + std::to_string(mod), prime::raise(value, exp, mod) == static_cast<uint64_t>(expected));
+  }
+
+  for (size_t x = 0; x < 4; ++x) {
+    const auto [p, q] = prime::generate();
+    check("Safe prime " + std::to_string(p), p == 2 * q + 1 && prime::is(p) && prime::is(q));
+  }
+}
+
+
+/**
+ * @brief Check every engine gives what the REFERENCE does, for every key size and mode.
+ * @remarks The lengths cover empty messages, partial blocks, and whole ones. The chunk is made small while
+ * checking, so that the longest are split across threads without the REFERENCE taking minutes over them.
+ */
+void cross_check() {
+  const auto previous = aes::engine;
+  const auto chunk = aes::chunk;
+  aes::chunk = 1 << 10;
+  const size_t lengths[] = {0, 1, 15, 16, 17, 63, 64, 65, 1000, 4099, 3 * aes::chunk + 17};
+
+  for (const uint64_t Nr : {10, 12, 14}) {
+    const std::array<uint64_t, 4> key = {rng(), rng(), rng(), rng()};
+    const aes::context ctx(key, Nr);
+    const uint64_t nonce = rng();
+    const auto iv = nonce::make(rng(), rng());
+
+    for (const auto& length : lengths) {
+      const auto message = random_string(length);
+
+      aes::engine = aes::REFERENCE;
+      const auto ecb = aes::Cipher(message, ctx), ctr = aes::Ctr(message, ctx, nonce),
+        gcm = aes::gcm::Enc(message, ctx, nonce), gcm_iv = aes::gcm::Enc(message, ctx, iv);
+
+      for (const auto& e : available()) {
+        aes::engine = e;
+        const auto name = std::string(engine_names[e]) + " AES-" + std::to_string(32 * Nr - 192) + " " + std::to_string(length) + " B ";
+        try {
+          check(name + "ECB", aes::Cipher(message, ctx) == ecb && aes::InvCipher(ecb, ctx) == message);
+          check(name + "CTR", aes::Ctr(message, ctx, nonce) == ctr && aes::Ctr(ctr, ctx, nonce) == message);
+          check(name + "GCM", aes::gcm::Enc(message, ctx, nonce) == gcm && aes::gcm::Dec(gcm, ctx, nonce) == message);
+          check(name + "GCM IV", aes::gcm::Enc(message, ctx, iv) == gcm_iv && aes::gcm::Dec(gcm_iv, ctx, iv) == message);
+
+          // Changing any byte, of the ciphertext or the tag, must be caught.
+          for (const auto* sealed : {&gcm, &gcm_iv}) {
+            auto altered = *sealed;
+            altered[rng() % altered.length()] ^= 1 + rng() % 255;
+            bool caught = false;
+            try {sealed == &gcm ? aes::gcm::Dec(altered, ctx, nonce) : aes::gcm::Dec(altered, ctx, iv);}
+            catch (std::runtime_error&) {caught = true;}
+            check(name + (sealed == &gcm ? "GCM" : "GCM IV") + " altered", caught);
+          }
+
+          // The span overloads write in place.
+          std::string out = message;
+          out.resize(message.length() + 16);
+          auto bytes = std::as_writable_bytes(std::span(out));
+          aes::Ctr(bytes.first(length), bytes.first(length), ctx, nonce);
+          check(name + "CTR span", out.substr(0, length) == ctr);
+          out = message;
+          out.resize(message.length() + 16);
+          bytes = std::as_writable_bytes(std::span(out));
+          aes::gcm::Enc(bytes.first(length), bytes, ctx, iv);
+          check(name + "GCM span", out == gcm_iv);
+        }
+        catch (std::runtime_error& err) {check(name + err.what(), false);}
+      }
+    }
+  }
+  aes::engine = previous;
+  aes::chunk = chunk;
+
+  // The tables of GHASH, and the carry-less multiply, must reproduce mult exactly, for any subkey.
+  for (size_t x = 0; x < 16; ++x) {
+    const auto H = aes::state_array(random_string(16));
+    const auto message = random_string(16 * (x + 1));
+    const aes::ghash::table table(H);
+
+    const aes::context ctx({0, 0, 0, 0}, 10);
+    const auto reference = aes::gcm::GHASH(aes::state(std::as_bytes(std::span(message)), ctx.get_schedule(), 10), H);
+    for (const auto& e : {aes::TABLE, aes::HARDWARE}) {
+      aes::engine = e;
+      aes::block Y = {};
+      table.update(Y, reinterpret_cast<const uint8_t*>(message.data()), x + 1);
+      check(std::string("GHASH with ") + engine_names[e] + " tables over " + std::to_string(x + 1) + " blocks", std::equal(Y.begin(), Y.end(), reference.data()));
+    }
+  }
+  aes::engine = previous;
+}
+
+
+/**
+ * @brief Benchmark sending strings over the loopback.
+ * @param port: The port to listen on.
+ * @param ready: A pipe to tell the peer once we're listening.
+ * @remarks The peer receives every string and acknowledges each size, so the time is from the first send
+ * to the peer having everything.
+ */
+void loopback(const int& port, const int& ready) {
+  std::cout << "\nLoopback send_string/recv_string" << std::endl;
+  const char go = 1;
+  if (write(ready, &go, 1) != 1) return;
+  close(ready);
+  network::get_client(port);
+  if (network::connection == -1) {
+    check("Loopback connection", false);
+    return;
+  }
+
+  for (const auto& size : sizes) {
+    const auto message = random_string(size);
+    const size_t count = std::clamp<size_t>((64 << 20) / size, 1, 1 << 12);
+
+    const auto before = allocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    const auto cycles = trace::cycles();
+    bool sent = true;
+    for (size_t x = 0; x < count && sent; ++x) sent = network::send_string(message) == 0;
+    sent = sent && network::recv_packet(60).m == network::meta::ACK;
+    const double spent = trace::cycles() - cycles, elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double allocs = double(allocations.load() - before) / count;
+    check("Loopback " + human(size), sent);
+    if (!sent) return;
+
+    std::cout << std::left << std::setw(18) << "send_string" << std::setw(11) << "" << std::right << std::setw(8) << human(size)
+              << std::setw(10) << count << std::fixed << std::setprecision(2) << std::setw(12) << spent / count / size << " c/B"
+              << std::setw(10) << size * count / elapsed / (1 << 20) << " MiB/s" << std::setw(9) << allocs << " allocs/op" << std::endl;
+  }
+  close(network::connection);
+  network::connection = -1;
+}
+
+
+/**
+ * @brief The other end of the loopback.
+ * @param port: The port to connect to.
+ * @param ready: The pipe that says when the benchmark is listening.
+ * @returns The exit code for the peer.
+ */
+int peer(const int& port, const int& ready) {
+  char go = 0;
+  if (read(ready, &go, 1) != 1) return 0;
+  close(ready);
+
+  // The benchmark might not quite be listening yet.
+  for (size_t x = 0; x < 100 && network::connection == -1; ++x) {
+    network::get_server(port);
+    if (network::connection == -1) usleep(20000);
+  }
+  if (network::connection == -1) return 1;
+
+  try {
+    for (const auto& size : sizes) {
+      const size_t count = std::clamp<size_t>((64 << 20) / size, 1, 1 << 12);
+      for (size_t x = 0; x < count; ++x) if (network::recv_string(60).length() != size) return 1;
+      if (network::send_packet({.m = network::meta::ACK}) == -1) return 1;
+    }
+  }
+  catch (std::runtime_error&) {return 1;}
+  close(network::connection);
+  return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) budget = std::stod(argv[1]);
+
+  // The loopback peer is forked before anything starts a thread.
+  const int port = 40000 + getpid() % 20000;
+  int ready[2];
+  if (pipe(ready) == -1) throw std::runtime_error("Failed to create pipe!");
+  const auto child = fork();
+  if (child == 0) {
+    close(ready[1]);
+    _exit(peer(port, ready[0]));
+  }
+  close(ready[0]);
+
+  std::cout << "Known answers and cross-checks" << std::endl;
+  known_answers();
+  key_exchange();
+  primes();
+  cross_check();
+  std::cout << (failures ? std::to_string(failures) + " checks failed" : "Every check passed") << std::endl;
+  trace::reset();
+
+  std::cout << "\nKey schedule" << std::endl;
+  const std::array<uint64_t, 4> key = {rng(), rng(), rng(), rng()};
+  for (const uint64_t Nk : {4, 6, 8}) {
+    measure("key::Expansion", "Nk=" + std::to_string(Nk), 0, [&]() {return aes::key::Expansion(key, Nk);});
+  }
+  measure("context", "Nr=14", 0, [&]() {return aes::context(key, 14);});
+
+  const aes::context ctx(key, 14);
+  const uint64_t nonce = rng();
+  const auto iv = nonce::make(rng(), rng());
+
+  std::cout << "\nSingle block" << std::endl;
+  for (const auto& e : available()) {
+    aes::engine = e;
+    alignas(16) uint8_t block[16] = {};
+    measure("Cipher", engine_names[e], 16, [&]() {aes::encrypt(ctx, block, block, 1);});
+    measure("InvCipher", engine_names[e], 16, [&]() {aes::decrypt(ctx, block, block, 1);});
+  }
+
+  std::cout << "\nBulk" << std::endl;
+  {
+    std::vector<std::byte> in(sizes[std::size(sizes) - 1] + 16), out(in.size() + 16);
+    for (auto& b : in) b = static_cast<std::byte>(rng());
+    for (const auto& e : available()) {
+      aes::engine = e;
+      for (const auto& size : sizes) {
+        if (size > largest(e)) break;
+        const auto i = std::span(in).first(size), o = std::span(out);
+        measure("Ctr", engine_names[e], size, [&]() {aes::Ctr(i, o.first(size), ctx, nonce);});
+        measure("gcm::Enc", engine_names[e], size, [&]() {aes::gcm::Enc(i, o, ctx, iv);});
+        measure("gcm::Dec", engine_names[e], size, [&]() {aes::gcm::Dec(o.first(size + 16), i, ctx, iv);});
+      }
+    }
+  }
+
+  std::cout << "\nGHASH" << std::endl;
+  {
+    const auto H = aes::state_array(random_string(16));
+    auto X = aes::state_array(random_string(16));
+    measure("gcm::mult", "REFERENCE", 16, [&]() {X = aes::gcm::mult(X, H);});
+    const aes::ghash::table table(H);
+    for (const auto& size : {size_t(1) << 10, size_t(1) << 20}) {
+      const auto text = random_string(size);
+      const auto message = std::as_bytes(std::span(text));
+      const aes::state s(message, ctx.get_schedule(), 14);
+      measure("GHASH", "REFERENCE", size, [&]() {return aes::gcm::GHASH(s, H);});
+      aes::block Y = {};
+      aes::engine = aes::TABLE;
+      measure("GHASH", "TABLE", size, [&]() {table.update(Y, reinterpret_cast<const uint8_t*>(message.data()), size / 16); return Y;});
+      if (aes::ghash::clmul::available) {
+        aes::engine = aes::HARDWARE;
+        measure("GHASH", "HARDWARE", size, [&]() {table.update(Y, reinterpret_cast<const uint8_t*>(message.data()), size / 16); return Y;});
+      }
+    }
+  }
+
+  std::cout << "\nPrimes" << std::endl;
+  measure("prime::generate", "", 0, []() {return prime::generate();});
+
+  loopback(port, ready[1]);
+  int status = 0;
+  waitpid(child, &status, 0);
+  check("Loopback peer", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+#ifdef TRACE
+  std::cout << "\nTrace\n" << trace::report();
+#endif
+
+  if (network::sock != -1) close(network::sock);
+  return failures ? 1 : 0;
+}
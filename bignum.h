@@ -0,0 +1,374 @@
+#pragma once
+
+#include <cstdint>      // For fixed width integers.
+#include <array>        // For the words of a number.
+#include <vector>       // For the comb's table.
+#include <string_view>  // For reading numbers in hex.
+#include <algorithm>    // For std::reverse
+#include <stdexcept>    // For exceptions.
+#include <compare>      // For comparing numbers.
+
+/**
+ * @brief Numbers wider than any built-in type, for the standard Diffie-Hellman groups.
+ * @remarks prime.h works within 64 bits, which is all a group we generate ourselves needs. The groups
+ * other systems use are thousands of bits wide, so here a number is an array of 64 bit words, and the
+ * only arithmetic on offer is what a key exchange needs: multiplying, and raising, within a modulus.
+ * @remarks Everything is fixed width, set by a template parameter, so nothing is ever allocated while
+ * multiplying, and the compiler knows how long every loop is.
+ * @warning Like prime.h, none of this takes any care to run in constant time.
+ */
+namespace bignum {
+
+  // Twice the width of a word, so that multiplying two of them can't overflow.
+  typedef unsigned __int128 wide;
+
+
+  /**
+   * @brief An unsigned number.
+   * @tparam bits: How wide the number is. It must be a multiple of 64.
+   * @remarks The words are stored least significant first, which is the order arithmetic walks them in.
+   */
+  template <size_t bits> class number {
+    static_assert(bits % 64 == 0, "Numbers must be a whole number of words!");
+
+  public:
+    static constexpr size_t size = bits / 64;
+
+  private:
+    std::array<uint64_t, size> words = {};
+
+  public:
+    number() = default;
+    number(const uint64_t& value) {words[0] = value;}
+
+
+    /**
+     * @brief Read a number written in hex.
+     * @param digits: The digits, most significant first. Spaces are ignored.
+     * @returns The number.
+     * @throws std::runtime_error If there's anything other than a hex digit, or too many of them.
+     */
+    static number hex(std::string_view digits) {
+      number ret;
+      size_t place = 0;
+      for (auto x = digits.rbegin(); x != digits.rend(); ++x) {
+        if (*x == ' ') continue;
+
+        uint64_t value;
+        if (*x >= '0' && *x <= '9') value = *x - '0';
+        else if (*x >= 'a' && *x <= 'f') value = *x - 'a' + 10;
+        else if (*x >= 'A' && *x <= 'F') value = *x - 'A' + 10;
+        else throw std::runtime_error("Invalid hex digit!");
+
+        if (place == bits) throw std::runtime_error("Number is too wide!");
+        ret.words[place / 64] |= value << (place % 64);
+        place += 4;
+      }
+      return ret;
+    }
+
+
+    /**
+     * @brief Build a number from its words as they're sent.
+     * @param value: The words, most significant first.
+     * @returns The number.
+     * @remarks network::pack sends each word big-endian, in order, so sending the words this way sends
+     * the number as one big-endian string of bytes, which is how other systems expect to see it.
+     */
+    static number from(std::array<uint64_t, size> value) {
+      std::reverse(value.begin(), value.end());
+      number ret;
+      ret.words = value;
+      return ret;
+    }
+
+
+    // The number's words, most significant first; see from.
+    std::array<uint64_t, size> to() const {
+      auto ret = words;
+      std::reverse(ret.begin(), ret.end());
+      return ret;
+    }
+
+
+    // Get a single bit, where anything past the top is 0.
+    bool bit(const size_t& x) const {return x < bits && (words[x / 64] >> (x % 64) & 1);}
+
+
+    // How many bits are in use, up to the highest that's set.
+    size_t length() const {
+      for (size_t x = size; x > 0; --x) {
+        if (words[x - 1]) return 64 * x - __builtin_clzll(words[x - 1]);
+      }
+      return 0;
+    }
+
+
+    /**
+     * @brief Add another number, in place.
+     * @param other: The number to add.
+     * @returns The carry out of the top word.
+     */
+    uint64_t add(const number& other) {
+      uint64_t carry = 0;
+      for (size_t x = 0; x < size; ++x) {
+        const wide sum = static_cast<wide>(words[x]) + other.words[x] + carry;
+        words[x] = static_cast<uint64_t>(sum);
+        carry = static_cast<uint64_t>(sum >> 64);
+      }
+      return carry;
+    }
+
+
+    /**
+     * @brief Subtract another number, in place.
+     * @param other: The number to subtract.
+     * @returns The borrow out of the top word.
+     */
+    uint64_t subtract(const number& other) {
+      uint64_t borrow = 0;
+      for (size_t x = 0; x < size; ++x) {
+        const wide difference = static_cast<wide>(words[x]) - other.words[x] - borrow;
+        words[x] = static_cast<uint64_t>(difference);
+        borrow = static_cast<uint64_t>(difference >> 64) & 1;
+      }
+      return borrow;
+    }
+
+
+    // Compare, from the most significant word down.
+    auto operator<=>(const number& other) const {
+      for (size_t x = size; x > 0; --x) {
+        if (words[x - 1] != other.words[x - 1]) return words[x - 1] <=> other.words[x - 1];
+      }
+      return std::strong_ordering::equal;
+    }
+    bool operator==(const number& other) const = default;
+
+
+    // Access a word, least significant first.
+    uint64_t& operator[](const size_t& x) {return words[x];}
+    const uint64_t& operator[](const size_t& x) const {return words[x];}
+  };
+
+
+  /**
+   * @brief Arithmetic within an odd modulus, in Montgomery form.
+   * @tparam bits: How wide the numbers are.
+   * @remarks This is prime::montgomery, a word at a time: R is 2^bits, and each multiplication folds the
+   * reduction in as it goes, one word of the product at a time, so the full double-width product is never
+   * built. See Koc, Acar, and Kaliski, "Analyzing and Comparing Montgomery Multiplication Algorithms"
+   * (1996), where this is the CIOS method.
+   * @warning The modulus must be odd.
+   */
+  template <size_t bits> class montgomery {
+  public:
+    typedef bignum::number<bits> number;
+
+    // Raising uses a window of this many bits; see raise.
+    static constexpr size_t window = 5;
+
+  private:
+    static constexpr size_t size = number::size;
+
+    number n, r, r2;
+    uint64_t inverse;
+
+
+    // Double a number within the modulus, in place.
+    void twice(number& x) const {
+      const auto carry = x.add(x);
+      if (carry || x >= n) x.subtract(n);
+    }
+
+  public:
+
+    /**
+     * @brief Prepare for a modulus.
+     * @param n: The modulus, which must be odd.
+     * @throws std::runtime_error If it isn't.
+     */
+    montgomery(const number& n) : n(n) {
+      if (!n.bit(0)) throw std::runtime_error("Montgomery form needs an odd modulus!");
+
+      // -n^-1 % 2^64 for the lowest word, by Newton's method; see prime::montgomery.
+      uint64_t x = n[0];
+      for (size_t step = 0; step < 5; ++step) x *= 2 - n[0] * x;
+      inverse = -x;
+
+      // R % n and R^2 % n, by doubling 1 within the modulus. It's only done once per modulus.
+      r = 1;
+      if (r >= n) r.subtract(n);
+      for (size_t y = 0; y < bits; ++y) twice(r);
+      r2 = r;
+      for (size_t y = 0; y < bits; ++y) twice(r2);
+    }
+
+
+    /**
+     * @brief Multiply two numbers in the form.
+     * @param a: The first number, below the modulus.
+     * @param b: The second number, below the modulus.
+     * @returns a * b / R % n.
+     * @remarks For every word of b, we add a * b[i] to the running total, and then the multiple of n
+     * that clears its lowest word, which lets us shift the total down a word. After every word, the total
+     * is below 2n, so it's kept in two words more than a number.
+     */
+    number multiply(const number& a, const number& b) const {
+      std::array<uint64_t, size + 2> t = {};
+      for (size_t i = 0; i < size; ++i) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < size; ++j) {
+          const wide sum = static_cast<wide>(a[j]) * b[i] + t[j] + carry;
+          t[j] = static_cast<uint64_t>(sum);
+          carry = static_cast<uint64_t>(sum >> 64);
+        }
+        wide sum = static_cast<wide>(t[size]) + carry;
+        t[size] = static_cast<uint64_t>(sum);
+        t[size + 1] = static_cast<uint64_t>(sum >> 64);
+
+        const uint64_t m = t[0] * inverse;
+        sum = static_cast<wide>(m) * n[0] + t[0];
+        carry = static_cast<uint64_t>(sum >> 64);
+        for (size_t j = 1; j < size; ++j) {
+          sum = static_cast<wide>(m) * n[j] + t[j] + carry;
+          t[j - 1] = static_cast<uint64_t>(sum);
+          carry = static_cast<uint64_t>(sum >> 64);
+        }
+        sum = static_cast<wide>(t[size]) + carry;
+        t[size - 1] = static_cast<uint64_t>(sum);
+        t[size] = t[size + 1] + static_cast<uint64_t>(sum >> 64);
+      }
+
+      number ret;
+      for (size_t x = 0; x < size; ++x) ret[x] = t[x];
+      if (t[size] || ret >= n) ret.subtract(n);
+      return ret;
+    }
+
+
+    // Convert a number below the modulus into the form, and back out.
+    number to(const number& a) const {return multiply(a, r2);}
+    number from(const number& a) const {return multiply(a, 1);}
+
+
+    /**
+     * @brief Raise a number within the modulus.
+     * @param value: The value, below the modulus.
+     * @param exp: The exponent.
+     * @returns value ** exp % n.
+     * @remarks Rather than multiplying for every set bit of the exponent, as prime::raise does, we walk
+     * it a window at a time: each window starts and ends on a set bit, so its value is odd, and we keep
+     * value raised to every odd number that fits in one. Then every window costs its squarings, and just
+     * a single multiplication. A run of 0s between windows only costs squarings.
+     * @remarks See 14.85 of Menezes, van Oorschot, and Vanstone, "Handbook of Applied Cryptography."
+     */
+    number raise(const number& value, const number& exp) const {
+
+      // value, value^3, value^5, and so on.
+      std::array<number, 1 << (window - 1)> odd;
+      odd[0] = to(value);
+      const auto square = multiply(odd[0], odd[0]);
+      for (size_t x = 1; x < odd.size(); ++x) odd[x] = multiply(odd[x - 1], square);
+
+      auto ret = r;
+      for (size_t top = exp.length(); top > 0;) {
+        const size_t x = top - 1;
+        if (!exp.bit(x)) {
+          ret = multiply(ret, ret);
+          top = x;
+          continue;
+        }
+
+        // The window runs from x down to the lowest set bit within reach.
+        size_t y = x + 1 >= window ? x + 1 - window : 0;
+        while (!exp.bit(y)) ++y;
+
+        size_t index = 0;
+        for (size_t z = x + 1; z > y; --z) {
+          index = index << 1 | exp.bit(z - 1);
+          ret = multiply(ret, ret);
+        }
+        ret = multiply(ret, odd[index >> 1]);
+        top = y;
+      }
+      return from(ret);
+    }
+
+
+    // Getters.
+    const auto& modulus() const {return n;}
+    const auto& one() const {return r;}
+  };
+
+
+  /**
+   * @brief Raise a single, fixed base to any exponent, faster than montgomery::raise can.
+   * @tparam bits: How wide the numbers are.
+   * @remarks A Diffie-Hellman group always raises the same g, so it pays to do some of the work once.
+   * Split the exponent into teeth rows of span bits each, and stack them, so that each column holds one
+   * bit from every row. We keep g raised to every combination of the rows' first bits, which lets a whole
+   * column be handled with one multiplication, and the columns then only need span squarings between
+   * them: a 256 bit exponent with 8 teeth costs 32 squarings and 32 multiplications, rather than the
+   * 256 squarings of a window.
+   * @remarks See Lim and Lee, "More Flexible Exponentiation with Precomputation" (1994).
+   */
+  template <size_t bits> class comb {
+  public:
+    typedef bignum::number<bits> number;
+
+    // How many rows the exponent is split into. The table holds 2^teeth numbers.
+    static constexpr size_t teeth = 8;
+
+  private:
+    const montgomery<bits>& field;
+    number base;
+    size_t span;
+
+    // g raised to each combination of rows, in the form, where bit i of the index is row i.
+    std::vector<number> table;
+
+  public:
+
+    /**
+     * @brief Build the table for a base.
+     * @param field: The modulus to work in. It must outlive the comb.
+     * @param base: The base, below the modulus.
+     * @param exponent: How many bits the exponents will be. Anything longer is left to field.raise.
+     */
+    comb(const montgomery<bits>& field, const number& base, const size_t& exponent) :
+        field(field), base(base), span((exponent + teeth - 1) / teeth), table(1 << teeth) {
+
+      // Each row is span bits higher than the last, so its bit is worth base^(2^(i * span)).
+      auto power = field.to(base);
+      table[0] = field.one();
+      for (size_t i = 0; i < teeth; ++i) {
+        for (size_t j = 0; j < (size_t(1) << i); ++j) table[(size_t(1) << i) | j] = field.multiply(table[j], power);
+        for (size_t x = 0; x < span; ++x) power = field.multiply(power, power);
+      }
+    }
+
+    comb(const comb&) = delete;
+    comb& operator=(const comb&) = delete;
+
+
+    /**
+     * @brief Raise the base.
+     * @param exp: The exponent.
+     * @returns base ** exp % n.
+     */
+    number raise(const number& exp) const {
+      if (exp.length() > span * teeth) return field.raise(base, exp);
+
+      auto ret = field.one();
+      for (size_t column = span; column > 0; --column) {
+        ret = field.multiply(ret, ret);
+
+        size_t index = 0;
+        for (size_t i = 0; i < teeth; ++i) index |= size_t(exp.bit(i * span + column - 1)) << i;
+        if (index) ret = field.multiply(ret, table[index]);
+      }
+      return field.from(ret);
+    }
+  };
+}
@@ -3,9 +3,14 @@
 #include <numeric>
 #include <stdexcept>
 #include <iostream>
+#include <tuple>
+#include <functional>
+
+#include <openssl/evp.h>  // To hash the shared secret of a standard group.
 
 #include "network.h"
 #include "prime.h"
+#include "bignum.h"
 
 /**
  * @brief The namespace for Key-Exchange functions.
@@ -29,7 +34,8 @@
  * given only the intermediary value and the public p,g. This makes Diffie-Hellman a
  * one-way function.
  * @remarks In this implementation, The server will generate the public p and g, and will
- * send them alongside the intermediary to the other party.
+ * send them alongside the intermediary to the other party. Alternatively, it can use one of the
+ * standard groups of RFC 3526, which every implementation already knows; see exchange::standard.
  */
 namespace exchange {
 
@@ -56,6 +62,290 @@ namespace exchange {
   }
 
 
+  /**
+   * @brief Our intermediary value in a standard group.
+   * @tparam bits: The width of the group.
+   * @param group: The group.
+   * @param k: The private key.
+   * @returns g**k % p.
+   * @remarks g never changes within a group, so this uses the group's comb, rather than raising from scratch.
+   */
+  template <size_t bits> bignum::number<bits> compute_intermediary(const auto& group, const bignum::number<bits>& k) {
+    return group.base.raise(k);
+  }
+
+
+  /**
+   * @brief Generate the public values for an exchange.
+   * @returns The prime p, and the generator g.
+   * @remarks See 2.2 of the Reference.
+   */
+  std::pair<uint64_t, uint64_t> parameters() {
+    // Firstly, we generate our p, which will be our mod value
+    // (And public), and then generate a q value, which we'll
+    // use for g. These follows the relationship p = jq + 1,
+    // Where j = 2. See 2.2 of the Reference.
+    // This ensures that p is a "safe prime," which has the following
+    // helpful properties:
+    //  1. Every quadratic nonresidue is a primitive root (Which we need for g)
+    //  2. The least positive primitive root is a prime number.
+    // What does this mean? It basically lets us quickly find an associated g
+    // value, rather than going through an expensive algorithm to compute
+    // primitive roots for a number.
+    auto pair = prime::generate();
+    auto p = std::get<0>(pair);
+    auto q = std::get<1>(pair);
+
+    // Next, we calculate h, which we'll use to generate g.
+    // We simply need to find a number such that h^((p-1)/q) % p
+    // Is greater than one. (I think the Reference has a typo in
+    // this section were they are missing the raise ^).
+    //
+    // Any interesting tibit of knowledge for you:
+    // I've also found suggestions of generating g by omitting
+    // h, and simply taking the smallest primitive root of p.
+    // We take the smallest because g should usually be small.
+    // According to Wikipedia, this is:
+    // "Because of the random self-reducibility of the discrete
+    // logarithm problem a small g is equally secure as any other
+    // generator of the same group."
+    // - https://en.wikipedia.org/wiki/Diffie%E2%80%93Hellman_key_exchange
+    // That being said, I had an implementation to find a primitive
+    // root for a value p, which would ensure that g would be as small
+    // as possible, but it was so SLOW. This method is lightning quick
+    // Which is probably why the Reference suggests it. In fact,
+    // there are probably far more efficient ways of generating h,
+    // Since we're just brute forcing it here.
+    uint64_t h = 1;
+    while (prime::raise(h++, (p-1)/q, p) <= 1) {}
+
+    // With an h, we can generate g.
+    auto g = prime::raise(h, (p-1)/q, p);
+    return {p, g};
+  }
+
+
+  /**
+   * @brief Where handshakes get their public values.
+   * @remarks By default, they're generated on the spot; main points this at a store::cache, which has
+   * them ready. Whatever it is must be safe to call from any thread.
+   */
+  std::function<std::pair<uint64_t, uint64_t>()> supply = parameters;
+
+
+  /**
+   * @brief Which group a handshake uses.
+   * @var GENERATED: A group of our own, from supply, once for every word of the key.
+   * @var MODP2048: The 2048 bit group of RFC 3526, once for the whole key.
+   * @var MODP3072: The 3072 bit group of RFC 3526, once for the whole key.
+   */
+  typedef enum {GENERATED, MODP2048, MODP3072} group;
+
+
+  /**
+   * @brief The group the generating side of a handshake offers.
+   * @remarks The other side follows whichever group it's offered, so only the generating side needs to
+   * set this.
+   */
+  group standard = GENERATED;
+
+
+  /**
+   * @brief How many bits of private key we use in a standard group.
+   * @remarks The key must be twice as long as the strength we want, and 256 bits is more than either group
+   * can offer; see 8 of RFC 3526. Any longer would only make raising slower.
+   */
+  constexpr size_t exponent = 256;
+
+
+  /**
+   * @brief A standard group, ready to raise numbers in.
+   * @tparam bits: The width of the group.
+   * @remarks The groups are built the first time they're used, and kept for the life of the program, so
+   * the comb's table is only ever built once.
+   */
+  template <size_t bits> struct modp {
+    bignum::number<bits> p;
+    bignum::montgomery<bits> field;
+    bignum::comb<bits> base;
+
+    modp(const std::string_view& prime) : p(bignum::number<bits>::hex(prime)), field(p), base(field, 2, exponent) {}
+
+    // Get the group.
+    static const modp& get();
+  };
+
+
+  // RFC 3526's groups all use the generator 2; see 3 and 4 of it.
+  template <> const modp<2048>& modp<2048>::get() {
+    static const modp group(
+      "FFFFFFFF FFFFFFFF C90FDAA2 2168C234 C4C6628B 80DC1CD1 29024E08 8A67CC74 020BBEA6 3B139B22 514A0879 8E3404DD"
+      "EF9519B3 CD3A431B 302B0A6D F25F1437 4FE1356D 6D51C245 E485B576 625E7EC6 F44C42E9 A637ED6B 0BFF5CB6 F406B7ED"
+      "EE386BFB 5A899FA5 AE9F2411 7C4B1FE6 49286651 ECE45B3D C2007CB8 A163BF05 98DA4836 1C55D39A 69163FA8 FD24CF5F"
+      "83655D23 DCA3AD96 1C62F356 208552BB 9ED52907 7096966D 670C354E 4ABC9804 F1746C08 CA18217C 32905E46 2E36CE3B"
+      "E39E772C 180E8603 9B2783A2 EC07A28F B5C55DF0 6F4C52C9 DE2BCBF6 95581718 3995497C EA956AE5 15D22618 98FA0510"
+      "15728E5A 8AACAA68 FFFFFFFF FFFFFFFF"
+    );
+    return group;
+  }
+  template <> const modp<3072>& modp<3072>::get() {
+    static const modp group(
+      "FFFFFFFF FFFFFFFF C90FDAA2 2168C234 C4C6628B 80DC1CD1 29024E08 8A67CC74 020BBEA6 3B139B22 514A0879 8E3404DD"
+      "EF9519B3 CD3A431B 302B0A6D F25F1437 4FE1356D 6D51C245 E485B576 625E7EC6 F44C42E9 A637ED6B 0BFF5CB6 F406B7ED"
+      "EE386BFB 5A899FA5 AE9F2411 7C4B1FE6 49286651 ECE45B3D C2007CB8 A163BF05 98DA4836 1C55D39A 69163FA8 FD24CF5F"
+      "83655D23 DCA3AD96 1C62F356 208552BB 9ED52907 7096966D 670C354E 4ABC9804 F1746C08 CA18217C 32905E46 2E36CE3B"
+      "E39E772C 180E8603 9B2783A2 EC07A28F B5C55DF0 6F4C52C9 DE2BCBF6 95581718 3995497C EA956AE5 15D22618 98FA0510"
+      "15728E5A 8AAAC42D AD33170D 04507A33 A85521AB DF1CBA64 ECFB8504 58DBEF0A 8AEA7157 5D060C7D B3970F85 A6E1E4C7"
+      "ABF5AE8C DB0933D7 1E8C94E0 4A25619D CEE3D226 1AD2EE6B F12FFA06 D98A0864 D8760273 3EC86A64 521F2B18 177B200C"
+      "BBE11757 7A615D6C 770988C0 BAD946E2 08E24FA0 74E5AB31 43DB5BFC E0FD108E 4B82D120 A93AD2CA FFFFFFFF FFFFFFFF"
+    );
+    return group;
+  }
+
+
+  /**
+   * @brief Our half of a handshake: the private keys, and what's needed to finish once the peer answers.
+   * @remarks The generating side makes an offer, the other side answers it, and the generating side then
+   * finishes with the answer. Each step is a single packet, so this works the same whether the packets go
+   * through the blocking functions of network, as in handshake, or a session of the server.
+   * @remarks In a group of our own, the offer is p, g, and our intermediary, for every word of the key, and
+   * the answer is the peer's four intermediaries. In a standard group, each side sends its intermediary as
+   * one big-endian number, and the key is the SHA-256 of what they share. The answering side tells which it
+   * was offered by how many words there are.
+   */
+  class secret {
+  private:
+    group kind = GENERATED;
+    std::array<uint64_t, 12> sent = {};
+    std::array<uint64_t, 4> k;
+
+
+    // How many words are in a packet of them.
+    static size_t words(const network::packet& p) {
+      if constexpr (network::encoding<uint64_t>::binary) return p.data.length() / sizeof(uint64_t);
+      else {
+        std::istringstream in(p.data);
+        size_t ret = 0;
+        for (std::string word; in >> word;) ++ret;
+        return ret;
+      }
+    }
+
+
+    // Our private key in a standard group, from all four words of k.
+    template <size_t bits> bignum::number<bits> key() const {
+      bignum::number<bits> ret;
+      for (size_t x = 0; x < k.size(); ++x) ret[x] = k[x];
+      return ret;
+    }
+
+
+    // Our intermediary in a standard group, ready to send.
+    template <size_t bits> network::packet intermediary() const {
+      return network::pack(compute_intermediary(modp<bits>::get(), key<bits>()).to());
+    }
+
+
+    /**
+     * @brief Compute the key from the peer's intermediary in a standard group.
+     * @param p: The peer's intermediary.
+     * @returns The shared key.
+     * @throws std::runtime_error If the intermediary is malformed, or one no honest peer would send.
+     * @remarks 1 and p - 1 would force the shared secret to one of two values, whatever our key is.
+     */
+    template <size_t bits> std::array<uint64_t, 4> finish(const network::packet& p) const {
+      const auto& group = modp<bits>::get();
+      const auto a = bignum::number<bits>::from(network::unpack<std::array<uint64_t, bits / 64>>(p));
+      auto limit = group.p;
+      limit.subtract(1);
+      if (a <= 1 || a >= limit) throw std::runtime_error("Peer sent an invalid key!");
+
+      // The secret is far longer than the key, so we hash it down, as a big-endian string.
+      std::array<uint64_t, bits / 64> shared = group.field.raise(a, key<bits>()).to();
+      network::network_order<decltype(shared)>(reinterpret_cast<char*>(shared.data()));
+
+      unsigned char digest[EVP_MAX_MD_SIZE];
+      unsigned int length = 0;
+      if (!EVP_Digest(shared.data(), sizeof(shared), digest, &length, EVP_sha256(), nullptr))
+        throw std::runtime_error("Failed to hash the shared key!");
+
+      std::array<uint64_t, 4> ret = {};
+      for (size_t x = 0; x < 32; ++x) ret[x / 8] = ret[x / 8] << 8 | digest[x];
+      return ret;
+    }
+
+  public:
+
+    // Generate our private keys.
+    secret() {for (auto& x : k) x = prime::random();}
+
+
+    /**
+     * @brief Make the generating side's offer, in the group exchange::standard selects.
+     * @returns The packet to send.
+     * @remarks In a group of our own, this is where the slow part, supply, happens.
+     */
+    network::packet offer() {
+      kind = standard;
+      switch (kind) {
+        case MODP2048: return intermediary<2048>();
+        case MODP3072: return intermediary<3072>();
+        default: break;
+      }
+      for (size_t x = 0; x < 4; ++x) {
+        std::tie(sent[3 * x], sent[3 * x + 1]) = supply();
+        sent[3 * x + 2] = compute_intermediary(sent[3 * x], sent[3 * x + 1], k[x]);
+      }
+      return network::pack(sent);
+    }
+
+
+    /**
+     * @brief Answer the peer's offer.
+     * @param p: The offer.
+     * @param shared: Set to the shared key.
+     * @returns The packet to send back.
+     * @throws std::runtime_error If the offer is malformed.
+     */
+    network::packet answer(const network::packet& p, std::array<uint64_t, 4>& shared) {
+      switch (words(p)) {
+        case 2048 / 64: kind = MODP2048; shared = finish<2048>(p); return intermediary<2048>();
+        case 3072 / 64: kind = MODP3072; shared = finish<3072>(p); return intermediary<3072>();
+        default: break;
+      }
+
+      kind = GENERATED;
+      const auto offer = network::unpack<std::array<uint64_t, 12>>(p);
+      std::array<uint64_t, 4> answer;
+      for (size_t x = 0; x < 4; ++x) {
+        answer[x] = compute_intermediary(offer[3 * x], offer[3 * x + 1], k[x]);
+        shared[x] = prime::raise(offer[3 * x + 2], k[x], offer[3 * x]);
+      }
+      return network::pack(answer);
+    }
+
+
+    /**
+     * @brief Finish with the peer's answer to our offer.
+     * @param p: The answer.
+     * @returns The shared key.
+     * @throws std::runtime_error If the answer is malformed.
+     */
+    std::array<uint64_t, 4> finish(const network::packet& p) const {
+      switch (kind) {
+        case MODP2048: return finish<2048>(p);
+        case MODP3072: return finish<3072>(p);
+        default: break;
+      }
+
+      const auto answer = network::unpack<std::array<uint64_t, 4>>(p);
+      std::array<uint64_t, 4> shared;
+      for (size_t x = 0; x < 4; ++x) shared[x] = prime::raise(answer[x], k[x], sent[3 * x]);
+      return shared;
+    }
+  };
+
+
   /**
    * @brief Exchange keys on an established connection.
    * @param server: Whether this is the server.
@@ -64,50 +354,12 @@ namespace exchange {
    */
   uint64_t exchange_keys(const bool& server) {
     // Generate our private key, and the other user's intermediary.
-    uint64_t a = 0, k = std::rand(), p = 0, g = 0;
+    uint64_t a = 0, k = prime::random(), p = 0, g = 0;
 
     if (server) {
 
-      // Firstly, we generate our p, which will be our mod value
-      // (And public), and then generate a q value, which we'll
-      // use for g. These follows the relationship p = jq + 1,
-      // Where j = 2. See 2.2 of the Reference.
-      // This ensures that p is a "safe prime," which has the following
-      // helpful properties:
-      //  1. Every quadratic nonresidue is a primitive root (Which we need for g)
-      //  2. The least positive primitive root is a prime number.
-      // What does this mean? It basically lets us quickly find an associated g
-      // value, rather than going through an expensive algorithm to compute
-      // primitive roots for a number.
-      auto pair = prime::generate();
-      p = std::get<0>(pair);
-      auto q = std::get<1>(pair);
-
-      // Next, we calculate h, which we'll use to generate g.
-      // We simply need to find a number such that h^((p-1)/q) % p
-      // Is greater than one. (I think the Reference has a typo in
-      // this section were they are missing the raise ^).
-      //
-      // Any interesting tibit of knowledge for you:
-      // I've also found suggestions of generating g by omitting
-      // h, and simply taking the smallest primitive root of p.
-      // We take the smallest because g should usually be small.
-      // According to Wikipedia, this is:
-      // "Because of the random self-reducibility of the discrete
-      // logarithm problem a small g is equally secure as any other
-      // generator of the same group."
-      // - https://en.wikipedia.org/wiki/Diffie%E2%80%93Hellman_key_exchange
-      // That being said, I had an implementation to find a primitive
-      // root for a value p, which would ensure that g would be as small
-      // as possible, but it was so SLOW. This method is lightning quick
-      // Which is probably why the Reference suggests it. In fact,
-      // there are probably far more efficient ways of generating h,
-      // Since we're just brute forcing it here.
-      uint64_t h = 1;
-      while (prime::raise(h++, (p-1)/q, p) <= 1) {}
-
-      // With an h, we can generate g.
-      g = prime::raise(h, (p-1)/q, p);
+      // Get the public values; see exchange::parameters.
+      std::tie(p, g) = supply();
 
       // Send them across.
       if (network::send_value(p) == -1)
@@ -136,4 +388,37 @@ namespace exchange {
     auto sk = prime::raise(a, k, p);
     return sk;
   }
+
+
+  /**
+   * @brief Exchange all four words of a key at once.
+   * @param server: Whether this is the server.
+   * @returns The shared key.
+   * @throws std::runtime_error If the values couldn't be sent, or the peer's are malformed.
+   * @remarks This is exchange_keys, but once for every word of the key at the same time: the server sends
+   * p, g, and its intermediary for all four in a single frame, and the client answers with all four of its
+   * intermediaries in another, so the whole key takes one round trip rather than eight. In a standard group,
+   * the frames just hold each side's intermediary. See exchange::secret.
+   */
+  std::array<uint64_t, 4> handshake(const bool& server) {
+    secret ours;
+
+    if (server) {
+      if (network::send_packet(ours.offer()) == -1)
+        throw std::runtime_error("Failed to send key!");
+
+      const auto answer = network::recv_packet();
+      if (answer.m == network::meta::ERROR) throw std::runtime_error("Failed to read from socket!");
+      return ours.finish(answer);
+    }
+
+    // The server may generate four sets of parameters before it says anything, so we give it longer.
+    const auto offer = network::recv_packet(30);
+    if (offer.m == network::meta::ERROR) throw std::runtime_error("Failed to read from socket!");
+
+    std::array<uint64_t, 4> shared;
+    if (network::send_packet(ours.answer(offer, shared)) == -1)
+      throw std::runtime_error("Failed to send key!");
+    return shared;
+  }
 }
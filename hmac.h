@@ -2,9 +2,14 @@
 
 #include <stdexcept>      // For exceptions
 #include <string>         // For std::string.
+#include <string_view>    // For the pieces of a message.
+#include <array>          // For the key.
+#include <utility>        // For std::exchange
 
-#include <openssl/hmac.h> // For the HMAC function
-#include <openssl/evp.h>  // For EVP_sha256()
+#include "trace.h"        // For counting where the time goes.
+
+#include <openssl/evp.h>  // For EVP_MAC, and EVP_MAX_MD_SIZE
+#include <openssl/core_names.h> // For OSSL_MAC_PARAM_DIGEST
 
 /**
  * @brief This namespace includes the functions needed to generate an HMAC value
@@ -12,22 +17,15 @@
  * @remarks To compile, add -lssl -lcrypto to your compiler's arguments!
  */
 namespace  hmac {
-  // Create our buffer for OpenSSL to dump the value to.
-  unsigned char md_value[EVP_MAX_MD_SIZE];
-  unsigned int md_len = 0;
 
   /**
-   * @brief Generate an HMAC for a message.
-   * @param message: The string to compute the HMAC for.
+   * @brief Translate our key into the bytes HMAC is keyed with.
    * @param key: The set of prime numbers to use as the key.
    * @param rounds: The amount of AES rounds (To determine key size)
-   * @returns A string containing the HMAC value.
-   * @throws std::runtime_error if the HMAC could not be generated.
+   * @returns The bytes.
    * @throws std::runtime_error if the round amount is invalid.
-   * @remarks This function uses the OpenSSL implementation of HMAC-SHA256.
-   * @remarks https://docs.openssl.org/master/man3/HMAC/#synopsis
    */
-  std::string generate(const std::string& message, const std::array<uint64_t, 4>& key, const size_t& rounds) {
+  inline std::string derive(const std::array<uint64_t, 4>& key, const size_t& rounds) {
 
     // Get the size of the key we use based on the rounds.
     int key_size = sizeof(uint64_t);
@@ -49,15 +47,153 @@ namespace  hmac {
         key_bytes += char(num & 0xf);
       }
     }
+    return key_bytes;
+  }
+
+
+  /**
+   * @brief A key, ready to generate HMACs with.
+   * @remarks HMAC hashes the key, padded two different ways, before and after the message. That part never
+   * changes for a key, so a context does it once, and every HMAC then starts from a copy of it; see digest.
+   * @remarks A context is never changed once it's made, so any number of threads can use it at once.
+   */
+  class context {
+  private:
+    EVP_MAC_CTX* ctx = nullptr;
+
+
+    // OpenSSL's HMAC. Looking it up takes a lock, so we only do it once.
+    static EVP_MAC* mac() {
+      static EVP_MAC* const found = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+      if (found == nullptr) throw std::runtime_error("HMAC is not available!");
+      return found;
+    }
 
-    // Generate the HMAC. Since this is more auxiliary to the main program, I won't dwell too long explaining this,
-    // but in essence OpenSSL deals with character arrays, specifically unsigned character arrays. For convenience,
-    // We deal with std::strings, which are signed characters. Therefore, we need to do some reinterpret casting
-    // To convert these signed values to unsigned values.
-    if (HMAC(EVP_sha256(), reinterpret_cast<const unsigned char*>(key_bytes.c_str()), key_bytes.length(), reinterpret_cast<const unsigned char*>(message.c_str()), message.length(), &md_value[0], &md_len) == NULL)
-      throw std::runtime_error("Failed to generate HMAC!");
+  public:
 
-    // Same as above. We need to reinterpret the output values as "signed" characters
-    return std::string(reinterpret_cast<const char*>(&md_value[0]), md_len);
+    // An empty context, which can't generate anything until a key is assigned.
+    context() = default;
+
+
+    /**
+     * @brief Prepare a key.
+     * @param key: The set of prime numbers to use as the key.
+     * @param rounds: The amount of AES rounds (To determine key size)
+     * @throws std::runtime_error if the round amount is invalid, or OpenSSL fails.
+     */
+    context(const std::array<uint64_t, 4>& key, const size_t& rounds) {
+      TRACE_SCOPE(SCHEDULE, 8 * rounds + 8);
+      const auto key_bytes = derive(key, rounds);
+
+      char digest[] = "SHA256";
+      const OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end(),
+      };
+
+      ctx = EVP_MAC_CTX_new(mac());
+      if (ctx == nullptr || !EVP_MAC_init(ctx, reinterpret_cast<const unsigned char*>(key_bytes.data()), key_bytes.length(), params)) {
+        EVP_MAC_CTX_free(ctx);
+        throw std::runtime_error("Failed to prepare HMAC!");
+      }
+    }
+
+    context(const context& other) : ctx(other.ctx ? EVP_MAC_CTX_dup(other.ctx) : nullptr) {}
+    context(context&& other) : ctx(std::exchange(other.ctx, nullptr)) {}
+    context& operator=(context other) {std::swap(ctx, other.ctx); return *this;}
+    ~context() {EVP_MAC_CTX_free(ctx);}
+
+
+    /**
+     * @brief Generate an HMAC for a whole message.
+     * @param message: The message.
+     * @returns A string containing the HMAC value.
+     * @throws std::runtime_error if the HMAC could not be generated.
+     */
+    std::string generate(std::string_view message) const;
+
+
+    // Getter.
+    const EVP_MAC_CTX* get() const {return ctx;}
+  };
+
+
+  /**
+   * @brief An HMAC being generated a piece at a time, such as while a message is sent.
+   * @remarks Each digest has its own copy of its context's state, so it belongs to whichever thread made it.
+   */
+  class digest {
+  private:
+    EVP_MAC_CTX* ctx;
+
+  public:
+
+    /**
+     * @brief Start an HMAC.
+     * @param key: The key to generate it with.
+     * @throws std::runtime_error if the key is empty, or OpenSSL fails.
+     */
+    digest(const context& key) : ctx(key.get() ? EVP_MAC_CTX_dup(key.get()) : nullptr) {
+      if (ctx == nullptr) throw std::runtime_error("Failed to start HMAC!");
+    }
+
+    digest(const digest&) = delete;
+    digest& operator=(const digest&) = delete;
+    ~digest() {EVP_MAC_CTX_free(ctx);}
+
+
+    /**
+     * @brief Add the next piece of the message.
+     * @param piece: The piece.
+     * @throws std::runtime_error if OpenSSL fails.
+     */
+    void update(std::string_view piece) {
+      TRACE_SCOPE(MAC, piece.length());
+      if (!EVP_MAC_update(ctx, reinterpret_cast<const unsigned char*>(piece.data()), piece.length()))
+        throw std::runtime_error("Failed to generate HMAC!");
+    }
+
+
+    /**
+     * @brief Finish the HMAC.
+     * @returns A string containing the HMAC value.
+     * @throws std::runtime_error if OpenSSL fails.
+     * @warning Nothing more can be added afterwards.
+     */
+    std::string final() {
+      TRACE_SCOPE(MAC, 0);
+      unsigned char md_value[EVP_MAX_MD_SIZE];
+      size_t md_len = 0;
+      if (!EVP_MAC_final(ctx, md_value, &md_len, sizeof(md_value)))
+        throw std::runtime_error("Failed to generate HMAC!");
+
+      // OpenSSL deals with unsigned characters, so we need to reinterpret them as "signed" characters.
+      return std::string(reinterpret_cast<const char*>(&md_value[0]), md_len);
+    }
+  };
+
+
+  inline std::string context::generate(std::string_view message) const {
+    TRACE_SCOPE(MAC, message.length());
+    digest running(*this);
+    running.update(message);
+    return running.final();
+  }
+
+
+  /**
+   * @brief Generate an HMAC for a message.
+   * @param message: The string to compute the HMAC for.
+   * @param key: The set of prime numbers to use as the key.
+   * @param rounds: The amount of AES rounds (To determine key size)
+   * @returns A string containing the HMAC value.
+   * @throws std::runtime_error if the HMAC could not be generated.
+   * @throws std::runtime_error if the round amount is invalid.
+   * @remarks This function uses the OpenSSL implementation of HMAC-SHA256.
+   * @remarks This prepares the key from scratch; for more than one message, keep a context instead.
+   * @remarks https://docs.openssl.org/master/man3/EVP_MAC/
+   */
+  std::string generate(const std::string& message, const std::array<uint64_t, 4>& key, const size_t& rounds) {
+    return context(key, rounds).generate(message);
   }
 }
@@ -1,13 +1,15 @@
 #include <iostream>   // For input and output.
-#include <cstdlib>    // For the standard library
-#include <ctime>      // To seed the RNG.
 #include <string>     // For std::string
 #include <vector>     // For std::vector
 #include <limits>     // For the upper limits to clear the input buffer.
 #include <sstream>    // For string streams.
 #include <stdexcept>  // For std::runtime_error
+#include <fstream>    // For streaming a file of messages.
 
 #include "util.h"     // For utilities
+#include "server.h"   // For serving many peers.
+#include "store.h"    // For ready-made key exchange groups.
+#include "pipeline.h" // For streaming messages.
 
 
 // The status of the program.
@@ -25,16 +27,24 @@ std::string stat(const status& s) {
 constexpr char
   Initialize[] = "Request New Connection",
   Listen[] = "Listen for New Connection",
+  Serve[] = "Serve Many Peers",
   Terminate[] = "Terminate Connection",
   Request[] = "Listen for Request",
   Reexchange[] = "Re-Exchange Keys",
   Send[] = "Send an Encrypted Message",
+  Stream[] = "Stream Messages from a File",
+  Group[] = "Choose Key Exchange Group",
   Quit[] = "Quit";
 
 
+// The groups exchange::standard can hold, in the order of exchange::group.
+const std::vector<std::string> group_names = {"Generated (64 bit)", "MODP 2048 (RFC 3526)", "MODP 3072 (RFC 3526)"};
+
+
 int main() {
-  // Seed RNG.
-  std::srand(std::time(0));
+  // Keep Diffie-Hellman groups ready, so handshakes needn't wait on finding a prime.
+  store::cache groups("groups.bin");
+  exchange::supply = [&groups]() {return groups.take();};
 
   // The state
   status s = IDLE;
@@ -42,8 +52,9 @@ int main() {
   // The shared key. AES Can be 128, 192, of 256 bits.
   // A single prime key is 64 bits, so we exchange 4 keys
   // To get a max of 256 bits.
-  uint64_t nonce = std::rand();
-  std::array<uint64_t, 4> sk = {0, 0, 0, 0};
+  uint64_t nonce = prime::random();
+  util::keyring keys;
+  const auto& sk = keys.get_key();
 
   // ECB Test
   size_t Nr = 10;
@@ -61,10 +72,12 @@ int main() {
   }
   std::cout << "\t(CTR)\n";
 
-  // GCM Test
+  // GCM Test, with a 96 bit IV, as messages are sent with.
   Nr = 10;
+  const auto iv = nonce::make(prime::random(), nonce);
   for (const auto& welcome : {"Then you need ", "to recompile ", "the app!"}) {
-    std::cout << aes::gcm::Dec(aes::gcm::Enc(welcome, sk, Nr, nonce), sk, Nr, nonce);
+    const aes::context ctx(sk, Nr);
+    std::cout << aes::gcm::Dec(aes::gcm::Enc(welcome, ctx, iv), ctx, iv);
     Nr += 2;
   }
   std::cout << "\t(GCM)\n";
@@ -76,6 +89,7 @@ int main() {
 
     util::clear();
     std::cout << "Status: " << stat(s) << std::endl;
+    std::cout << "Group: " << group_names[exchange::standard] << std::endl;
 
     // Populate valid choices given the state.
     std::stringstream in;
@@ -85,14 +99,17 @@ int main() {
     if (s == IDLE) {
       choices.emplace_back(Initialize);
       choices.emplace_back(Listen);
+      choices.emplace_back(Serve);
     }
     else if (s == CONNECTED) {
       in << "Shared Key (Mod 100): " << sk[0] % 100 <<  sk[1] % 100 << sk[2] % 100 << sk[3] % 100 << '\n';
       choices.emplace_back(Request);
       choices.emplace_back(Send);
+      choices.emplace_back(Stream);
       choices.emplace_back(Reexchange);
       choices.emplace_back(Terminate);
     }
+    choices.emplace_back(Group);
     choices.emplace_back(Quit);
 
     // Generate the choices, and prompt the user.
@@ -137,7 +154,7 @@ int main() {
       // Otherwise, exchange keys and change the status.
       else {
         try {
-          util::construct_shared_key(sk, command == Initialize);
+          util::construct_shared_key(keys, command == Initialize);
           s = CONNECTED;
         }
         catch (std::runtime_error&) {
@@ -148,6 +165,29 @@ int main() {
     }
 
 
+    /*
+     * Accept any number of peers at once, each of which requests a connection as usual, and
+     * print whatever they send until the user presses Enter.
+     */
+    else if (command == Serve) {
+      auto port = util::input<int>("Enter a port", 0);
+      if (port == 0) prompt_continue("Invalid port");
+
+      try {
+        server::engine e(port,
+          [](server::session& peer, const std::string& message) {std::cout << "Peer " << peer.get_id() << ": " << message << std::endl;},
+          [](server::session& peer, const std::string& error) {std::cout << "Dropped peer " << peer.get_id() << ": " << error << std::endl;}
+        );
+        std::thread loop([&e]() {e.run();});
+        std::cout << "Serving on port " << port << ". Press Enter to stop." << std::endl;
+        getchar();
+        e.stop();
+        loop.join();
+      }
+      catch (std::runtime_error& e) {util::prompt(e.what());}
+    }
+
+
     /*
      * Wait for the other peer to initiate an action.
      */
@@ -164,14 +204,31 @@ int main() {
         // A reexchange. Sometimes sending values across the network
         // will lead to silent corruption, leading to different shared keys.
         case network::meta::REEXCHANGE:
-          if (util::acknowledge("Peer is requesting to re-exchange keys"))
-            util::construct_shared_key(sk, true);
+          if (util::acknowledge("Peer is requesting to re-exchange keys")) {
+            try {util::construct_shared_key(keys, true);}
+            catch (std::runtime_error&) {util::prompt("Failed to exchange keys");}
+          }
           break;
 
-        // Receive a message
+        // Receive a stream of messages, which carries its window.
         case network::meta::MESSAGE:
-          if (util::acknowledge("Peer is sending a message")) {
-            try {util::receive_message(sk);}
+          if (!p.data.empty()) {
+            if (util::input<std::string>("Peer is streaming messages: Acknowledge? (y/n)") != "y") {
+              network::send_packet({.m = network::meta::REFUSED});
+              break;
+            }
+            try {
+              auto count = pipeline::receive(keys, p, [](const uint64_t& sequence, const std::string& message) {
+                std::cout << "Message " << sequence << ": " << message << '\n';
+              });
+              util::prompt("Received " + std::to_string(count) + " messages.");
+            }
+            catch (std::runtime_error& e) {util::prompt(e.what());}
+          }
+
+          // Receive a message
+          else if (util::acknowledge("Peer is sending a message")) {
+            try {util::receive_message(keys);}
             catch (std::runtime_error&) {util::prompt("Failed to receive message!");}
           }
           break;
@@ -186,11 +243,42 @@ int main() {
      * Send encrypted data.
      */
     else if (command == Send) {
-      try {util::send_message(sk);}
+      try {util::send_message(keys);}
       catch (std::runtime_error&) {util::prompt("Failed to send message!");}
     }
 
 
+    /*
+     * Send every line of a file as its own message, without waiting on the peer for each.
+     */
+    else if (command == Stream) {
+      auto path = util::input<std::string>("Enter the file to stream (One message per line)", "");
+      std::ifstream file(path);
+      if (!file) prompt_continue("Failed to open file!");
+
+      auto size = util::input<int>("What size key?\n1. 128\n2. 192\n3. 256\n", -1);
+      if (size < 1 || size > 3) prompt_continue("Invalid selection");
+      uint64_t Nr = size == 1 ? 10 : size == 2 ? 12 : 14;
+
+      auto option = util::input<int>("What mode?\n1. ECB\n2. CTR\n3. GCM", -1);
+      if (option < 1 || option > 3) prompt_continue("Invalid selection");
+
+      auto window = util::input<uint64_t>("How many messages may be unacknowledged at once?", 0);
+      if (window == 0) prompt_continue("Invalid window");
+
+      // Keys are rotated in the background, without pausing the stream.
+      auto every = util::input<uint64_t>("Rotate the key every how many messages? (0 for never)", 0);
+
+      try {
+        std::cout << "Reaching out to the Peer..." << std::endl;
+        pipeline::sender out(keys, window, every);
+        for (std::string line; std::getline(file, line);) out.send(line, Nr, static_cast<util::mode>(option - 1));
+        util::prompt("Sent " + std::to_string(out.close()) + " messages.");
+      }
+      catch (std::runtime_error& e) {util::prompt(e.what());}
+    }
+
+
     /*
      * Either party can request to generate new keys; however, the second peer must confirm such an
      * exchange, and should they confirm, they are the ones that generate the new p and g values.
@@ -212,7 +300,7 @@ int main() {
 
         // If yes, then re-exchange new keys.
         case network::meta::ACK:
-          try {util::construct_shared_key(sk, false);}
+          try {util::construct_shared_key(keys, false);}
           catch (std::runtime_error&) {util::prompt("Failed to exchange keys");}
           break;
 
@@ -241,10 +329,23 @@ int main() {
       }
 
       // Clear the private key and reset the state.
-      sk[0] = 0; sk[1] = 0; sk[2] = 0; sk[3] = 0;
+      keys.clear();
       s = IDLE;
     }
 
+    /*
+     * Pick the group we offer when we generate. The peer follows whichever group it's offered, so this
+     * only matters when we Request a New Connection, or accept a peer's Re-Exchange.
+     */
+    else if (command == Group) {
+      std::stringstream list;
+      list << "Which group?\n";
+      for (size_t x = 0; x < group_names.size(); ++x) list << x << ": " << group_names[x] << '\n';
+      auto selection = util::input<uint>(list.str(), group_names.size());
+      if (selection >= group_names.size()) prompt_continue("Invalid selection");
+      exchange::standard = static_cast<exchange::group>(selection);
+    }
+
     // Exit.
     else if (command == Quit) break;
   }
@@ -5,7 +5,23 @@
 #include <unistd.h>       // For various functions.
 #include <string.h>       // For strings.
 #include <poll.h>         // For the poll function for timeouts.
+#include <sys/uio.h>      // For struct iovec.
+#include <netinet/in.h>   // For IP_RECVERR.
+#include <netinet/tcp.h>  // For TCP_NODELAY.
+#include <linux/errqueue.h> // For MSG_ZEROCOPY completions.
+#include <cerrno>         // For errno.
 #include <stdexcept>      // For exceptions.
+#include <string>         // For packet data.
+#include <string_view>    // For framing received bytes.
+#include <sstream>        // For sending values.
+#include <cstdint>        // For fixed width integers.
+#include <type_traits>    // To choose how values are encoded.
+#include <bit>            // For std::endian
+#include <algorithm>      // For std::reverse
+#include <array>          // For sending arrays.
+#include <functional>     // For watching strings as they're sent.
+
+#include "trace.h"        // For counting where the time goes.
 
 /**
  * @brief The namespace for communication along a socket.
@@ -43,37 +59,269 @@ namespace network {
     FINAL, MESSAGE, ACK, REFUSED, REEXCHANGE,
   } meta;
 
-  // The size of the buffer
-  #define PACKET_SIZE 1024
+  /**
+   * @brief The most payload a single frame may carry.
+   * @remarks Strings longer than this are split across frames. A peer announcing a larger frame is treated
+   * as an error, since we'd otherwise have to trust it with how much memory to allocate.
+   */
+  size_t max_frame = 1 << 16;
 
   /**
    * @brief The basic object sent between peers.
    * @var m: A metadata tag for what the packet contains.
-   * @var data: Arbitrary data.
-   * @remarks data's size is defined by PACKET_SIZE. Setting this value
-   * to large numbers can cause problems when sending numbers.
+   * @var data: Arbitrary data, of at most max_frame bytes.
+   * @remarks On the wire, a packet is a frame: a byte for m, the length of data as a varint, and then
+   * data itself. A packet without data, such as an ACK, is just two bytes.
    */
   typedef struct {
     meta m = EMPTY;                   // Describe what the packet is.
-    char data[PACKET_SIZE] = {0};     // The actual data.
+    std::string data;                 // The actual data.
   } packet;
 
 
+  /**
+   * @brief Whether send_string sends large frames with MSG_ZEROCOPY.
+   * @remarks Set by enable_zerocopy, for the current connection.
+   */
+  bool zerocopy = false;
+
+  // Payloads at least this large are sent without copying them, if zerocopy is set. Pinning
+  // the pages has a cost of its own, which for anything smaller is more than the copy.
+  size_t zerocopy_min = 1 << 14;
+
+  // How many MSG_ZEROCOPY sends we've made on the connection, and how many the kernel has
+  // finished with. It numbers them from 0, for each socket.
+  uint32_t zerocopy_sent = 0, zerocopy_done = 0;
+
+
+  /**
+   * @brief Let send_string send large frames on the connection without copying them into the kernel.
+   * @returns Whether the kernel supports it.
+   * @remarks The kernel reads the frames straight from the string, so send_string waits for the kernel to
+   * say it's done with all of them before returning. Waiting once per string, rather than once per frame,
+   * lets the frames after the first go out while the kernel is still reading the ones before. Only large
+   * frames are worth it; see zerocopy_min. get_client and get_server call this for every connection.
+   */
+  bool enable_zerocopy() {
+#ifdef SO_ZEROCOPY
+    int one = 1;
+    zerocopy = setsockopt(connection, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+    return zerocopy;
+  }
+
+
+  /**
+   * @brief Send small packets on the connection as soon as they're written.
+   * @remarks By default, TCP holds back a small write while an earlier one is unacknowledged (Nagle's
+   * algorithm), and the peer holds back its acknowledgement for a while in the hope of sending it with a
+   * reply. A peer that waits on the end of a message then waits on both, for around 40ms; see pipeline,
+   * which does so once per window. Every packet is a single write already, so there's little to combine.
+   */
+  void nodelay() {
+    int one = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+
+  /**
+   * @brief Wait until the kernel has finished with every MSG_ZEROCOPY send.
+   * @param timeout: How long to wait (seconds) before giving up.
+   * @returns 0 once they're all done, -1 on error.
+   * @remarks The kernel reports these on the socket's error queue, as ranges of send numbers.
+   */
+  int zerocopy_wait(const size_t& timeout=5) {
+#ifdef SO_ZEROCOPY
+    while (zerocopy_done != zerocopy_sent) {
+
+      // With no events asked for, poll only wakes for the error queue, or a hangup.
+      struct pollfd fd = {.fd = connection, .events = 0};
+      if (poll(&fd, 1, timeout * 1000) <= 0 || !(fd.revents & POLLERR)) return -1;
+
+      char control[128];
+      struct msghdr message = {.msg_control = control, .msg_controllen = sizeof(control)};
+      if (recvmsg(connection, &message, MSG_ERRQUEUE) == -1) {
+        if (errno == EAGAIN || errno == EINTR) continue;
+        return -1;
+      }
+
+      for (auto* c = CMSG_FIRSTHDR(&message); c != nullptr; c = CMSG_NXTHDR(&message, c)) {
+        const auto* error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(c));
+        if (c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR && error->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+          zerocopy_done = error->ee_data + 1;
+      }
+    }
+#endif
+    return 0;
+  }
+
+
+  /**
+   * @brief Send every byte of a set of buffers, as few calls as the socket allows.
+   * @param iov: The buffers, which are consumed as they're sent.
+   * @param count: How many buffers there are.
+   * @param timeout: How long to wait (seconds) for the socket, each time it's full.
+   * @param flags: Extra flags for sendmsg, such as MSG_ZEROCOPY.
+   * @returns 0 if everything was sent, -1 otherwise.
+   * @remarks A single sendmsg usually takes everything, but TCP is free to take only part of it; we then
+   * pick up from wherever it stopped.
+   */
+  int send_all(struct iovec* iov, size_t count, const size_t& timeout, int flags = 0) {
+    while (count > 0) {
+      struct pollfd fd = {.fd = connection, .events = POLLOUT};
+      if (poll(&fd, 1, timeout * 1000) <= 0) return -1;
+
+      struct msghdr message = {.msg_iov = iov, .msg_iovlen = count};
+      auto sent = sendmsg(connection, &message, MSG_NOSIGNAL | flags);
+      if (sent == -1) {
+        if (errno == EINTR || errno == EAGAIN) continue;
+
+#ifdef MSG_ZEROCOPY
+        // The kernel may run out of memory to pin pages with; just copy instead.
+        if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {flags &= ~MSG_ZEROCOPY; continue;}
+#endif
+        return -1;
+      }
+#ifdef MSG_ZEROCOPY
+      if (flags & MSG_ZEROCOPY) ++zerocopy_sent;
+#endif
+
+      // Skip whatever has been sent.
+      while (count > 0 && static_cast<size_t>(sent) >= iov->iov_len) {
+        sent -= iov->iov_len;
+        ++iov; --count;
+      }
+      if (count > 0) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + sent;
+        iov->iov_len -= sent;
+      }
+    }
+    return 0;
+  }
+
+
+  /**
+   * @brief Receive exactly as many bytes as asked.
+   * @param bytes: Where to write them.
+   * @param length: How many to receive.
+   * @param timeout: How long to wait (seconds) for each piece.
+   * @returns Whether they all arrived.
+   * @remarks TCP can split a frame wherever it likes, so a single recv may return only part of it.
+   */
+  bool recv_all(void* bytes, size_t length, const size_t& timeout) {
+    auto* at = static_cast<char*>(bytes);
+    while (length > 0) {
+      struct pollfd fd = {.fd = connection, .events = POLLIN};
+      if (poll(&fd, 1, timeout * 1000) <= 0) return false;
+
+      auto got = recv(connection, at, length, 0);
+      if (got == -1 && (errno == EINTR || errno == EAGAIN)) continue;
+      if (got <= 0) return false;
+      at += got;
+      length -= got;
+    }
+    return true;
+  }
+
+
+  // The longest a frame header can be: the type, and ten bytes of varint for a 64 bit length.
+  constexpr size_t MAX_HEADER = 11;
+
+
+  /**
+   * @brief Write the header of a packet's frame.
+   * @param p: The packet.
+   * @param header: Where to write it.
+   * @returns How many bytes the header is.
+   * @remarks The length is a varint: seven bits at a time, lowest first, with the top bit set on all but the last.
+   */
+  inline size_t header(const meta& m, uint64_t length, char (&header)[MAX_HEADER]) {
+    header[0] = static_cast<char>(m);
+    size_t size = 1;
+    do {
+      const uint8_t low = length & 0x7f;
+      length >>= 7;
+      header[size++] = static_cast<char>(length ? low | 0x80 : low);
+    } while (length);
+    return size;
+  }
+  inline size_t header(const packet& p, char (&head)[MAX_HEADER]) {return header(p.m, p.data.length(), head);}
+
+
+  /**
+   * @brief Take a frame from the front of whatever has been received so far.
+   * @param bytes: The received bytes.
+   * @param p: Where to put the packet.
+   * @returns How many bytes the frame took, or 0 if it hasn't all arrived yet.
+   * @throws std::runtime_error If the frame is larger than max_frame.
+   * @remarks This is for non-blocking sockets, which read whatever is there and then frame it; see recv_packet for the blocking version.
+   */
+  inline size_t parse(std::string_view bytes, packet& p) {
+    if (bytes.size() < 2) return 0;
+
+    uint64_t length = 0;
+    size_t at = 1;
+    for (size_t shift = 0;; shift += 7) {
+      if (at == bytes.size()) return 0;
+      if (shift > 63) throw std::runtime_error("Received a malformed frame!");
+      const auto byte = static_cast<uint8_t>(bytes[at++]);
+      length |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) break;
+    }
+    if (length > max_frame) throw std::runtime_error("Received a malformed frame!");
+    if (bytes.size() - at < length) return 0;
+
+    p.m = static_cast<meta>(bytes[0]);
+    p.data.assign(bytes.substr(at, length));
+    return at + length;
+  }
+
+
+  /**
+   * @brief Send a frame.
+   * @param m: The frame's type.
+   * @param data: The frame's data.
+   * @param timeout: How long to wait (seconds) before throwing an error.
+   * @param borrow: Whether the kernel may read data from our memory, rather than copying it, if zerocopy is set.
+   * @returns How many bytes were sent, or -1 if they couldn't all be, or the data is larger than max_frame.
+   * @remarks The header and the data go out in one sendmsg, without being copied together first.
+   * @warning If borrowed, data must be left as it is until zerocopy_wait returns.
+   */
+  int send_frame(const meta& m, std::string_view data, const size_t& timeout=5, const bool& borrow=false) {
+    TRACE_SCOPE(SEND, data.length());
+    if (data.length() > max_frame) return -1;
+
+    char head[MAX_HEADER];
+    const size_t size = header(m, data.length(), head);
+
+    struct iovec iov[2] = {
+      {.iov_base = head, .iov_len = size},
+      {.iov_base = const_cast<char*>(data.data()), .iov_len = data.length()},
+    };
+
+    // The kernel would borrow the header too, which is gone once we return; so it's copied on its own,
+    // and held back until the data follows it.
+#ifdef MSG_ZEROCOPY
+    if (borrow && zerocopy && data.length() >= zerocopy_min) {
+      if (send_all(iov, 1, timeout, MSG_MORE) == -1 || send_all(iov + 1, 1, timeout, MSG_ZEROCOPY) == -1) return -1;
+      return size + data.length();
+    }
+#endif
+
+    if (send_all(iov, data.empty() ? 1 : 2, timeout) == -1) return -1;
+    return size + data.length();
+  }
+
+
   /**
    * @brief Send a packet.
    * @param p: The packet to send.
    * @param timeout: How long to wait (seconds) before throwing an error.
-   * @returns The return code of send.
+   * @returns How many bytes were sent, or -1 if they couldn't all be, or the data is larger than max_frame.
+   * @remarks The data is always copied into the kernel, so p can go as soon as this returns.
    */
   int send_packet(const packet& p, const size_t& timeout=5) {
-    struct pollfd fd;
-    fd.fd = connection;
-    fd.events = POLLOUT;
-
-    switch (poll(&fd, 1, timeout * 1000)) {
-      case -1: case 0: return -1;
-      default: return send(connection, reinterpret_cast<const void*>(&p), sizeof(p), 0);
-    }
+    return send_frame(p.m, p.data, timeout);
   }
 
 
@@ -82,22 +330,159 @@ namespace network {
    * @param timeout: How long to wait (seconds) before throwing an error.
    * @returns The packet.
    * @remarks If an error occured, the packet will have type network::meta::ERROR.
-   * Causes of this include the peer hanging up the connection or a timeout.
+   * Causes of this include the peer hanging up the connection, a timeout, or a frame larger than max_frame.
    */
   packet recv_packet(const size_t& timeout=5) {
-    packet p;
-    struct pollfd fd;
-    fd.fd = connection;
-    fd.events = POLLIN;
-
-    switch (poll(&fd, 1, timeout * 1000)) {
-      case -1: case 0: p.m = network::meta::ERROR; break;
-      default: recv(connection, reinterpret_cast<void*>(&p), sizeof(p), 0); break;
+    const packet error = {.m = network::meta::ERROR};
+
+    // Every frame has at least its type, and the first byte of its length.
+    uint8_t header[2];
+    if (!recv_all(header, sizeof(header), timeout)) return error;
+
+    packet p = {.m = static_cast<meta>(header[0])};
+    uint64_t length = header[1] & 0x7f;
+    for (size_t shift = 7; header[1] & 0x80; shift += 7) {
+      if (shift > 63 || !recv_all(&header[1], 1, timeout)) return error;
+      length |= static_cast<uint64_t>(header[1] & 0x7f) << shift;
     }
+    if (length > max_frame) return error;
+
+    p.data.resize(length);
+    if (!recv_all(p.data.data(), length, timeout)) return error;
     return p;
   }
 
 
+  /**
+   * @brief Whether anything has arrived on the connection, without waiting for it.
+   * @returns Whether recv_packet would find something, or the peer has hung up.
+   * @remarks A frame is written in one go, so once its first byte is here, the rest is right behind it.
+   */
+  bool waiting() {
+    struct pollfd fd = {.fd = connection, .events = POLLIN};
+    return poll(&fd, 1, 0) > 0;
+  }
+
+
+  /**
+   * @brief How send_value encodes a type.
+   * @tparam T: The type.
+   * @var binary: Whether T is sent as its bytes, rather than formatted as text.
+   * @remarks Anything trivially copyable is sent as its bytes, and anything else, such as a std::string, as
+   * text through a stream. Specialize this to choose differently for a type, or define NETWORK_TEXT to send
+   * everything as text, which makes a packet capture readable while debugging. Both peers must agree.
+   */
+  template <typename T> struct encoding {
+#ifdef NETWORK_TEXT
+    static constexpr bool binary = false;
+#else
+    static constexpr bool binary = std::is_trivially_copyable_v<T>;
+#endif
+  };
+
+
+  /**
+   * @brief Whether a type is a std::array, which is sent as each of its elements in turn.
+   * @tparam T: The type.
+   */
+  template <typename T> struct array_of : std::false_type {};
+  template <typename E, size_t N> struct array_of<std::array<E, N>> : std::true_type {using element = E;};
+
+
+  /**
+   * @brief Convert the bytes of a value between the host's order and the network's.
+   * @tparam T: The type of the value.
+   * @param bytes: The sizeof(T) bytes of the value, which are modified in place.
+   * @remarks Numbers (and enums) are big-endian on the wire, like every other network protocol, so swapping
+   * is its own inverse. Arrays are converted an element at a time, and other types, like structs, are sent
+   * as they're laid out in memory.
+   */
+  template <typename T> inline void network_order(char* bytes) {
+    if constexpr (array_of<T>::value) {
+      using E = typename array_of<T>::element;
+      for (size_t x = 0; x < sizeof(T) / sizeof(E); ++x) network_order<E>(bytes + x * sizeof(E));
+    }
+    else if constexpr ((std::is_arithmetic_v<T> || std::is_enum_v<T>) && std::endian::native == std::endian::little)
+      std::reverse(bytes, bytes + sizeof(T));
+  }
+
+
+  /**
+   * @brief Put a value into a packet.
+   * @tparam T: The datatype of the value.
+   * @param value: The value.
+   * @param type: What to tag the packet with.
+   * @returns The packet.
+   * @throws std::runtime_error If the value, as text, is larger than max_frame.
+   * @remarks See network::encoding for what the data is.
+   */
+  template <typename T> inline packet pack(const T& value, const network::meta& type = DATA) {
+    packet p = {.m = type};
+
+    if constexpr (encoding<T>::binary) {
+      p.data.assign(reinterpret_cast<const char*>(&value), sizeof(T));
+      network_order<T>(p.data.data());
+    }
+
+    // Pack the value into a string, with a space after each element of an array.
+    else {
+      std::stringstream in;
+      if constexpr (array_of<T>::value) for (const auto& x : value) in << x << ' ';
+      else in << value;
+      p.data = in.str();
+      if (p.data.length() > max_frame) {
+        throw std::runtime_error("Value exceeds packet size!");
+      }
+    }
+    return p;
+  }
+
+
+  /**
+   * @brief Take a value out of a packet.
+   * @tparam T: The datatype of the value.
+   * @param p: The packet, as pack made it.
+   * @returns The value.
+   * @throws std::runtime_error If a binary value is the wrong size.
+   */
+  template <typename T> inline T unpack(const packet& p) {
+    T ret = {};
+    if constexpr (encoding<T>::binary) {
+      if (p.data.length() != sizeof(T)) throw std::runtime_error("Received a malformed value!");
+      std::copy_n(p.data.data(), sizeof(T), reinterpret_cast<char*>(&ret));
+      network_order<T>(reinterpret_cast<char*>(&ret));
+    }
+
+    // Get the value from the string.
+    else {
+      std::istringstream out(p.data);
+      if constexpr (array_of<T>::value) for (auto& x : ret) out >> x;
+      else out >> ret;
+    }
+    return ret;
+  }
+
+
+  /**
+   * @brief Whether a packet holds a value of a type, as pack would make it.
+   * @tparam T: The type.
+   * @param p: The packet.
+   * @returns Whether it's the right size, or as text, has the right number of elements.
+   * @remarks This tells apart values of different sizes sent in the same place, such as an old peer's
+   * value and a new one's.
+   */
+  template <typename T> inline bool holds(const packet& p) {
+    if constexpr (encoding<T>::binary) return p.data.length() == sizeof(T);
+    else {
+      size_t count = 0, expected = 1;
+      if constexpr (array_of<T>::value) expected = std::tuple_size_v<T>;
+      std::istringstream in(p.data);
+      for (std::string word; in >> word;) ++count;
+      return count == expected;
+    }
+  }
+
+
   /**
    * @brief Send a value.
    * @tparam T: The datatype of the value.
@@ -105,19 +490,10 @@ namespace network {
    * @param type: Whether to tag the data with something.
    * @param timeout: A listening timeout before aborting.
    * @returns 0 if success, -1 if error.
+   * @remarks See network::encoding for what is sent.
    */
   template <typename T> inline int send_value(const T& value, const network::meta& type = DATA, const size_t& timeout=5) {
-    packet p = {.m = type};
-
-    // Pack the value into a string.
-    std::stringstream in; in << value;
-    auto str = in.str();
-    if (str.length() > PACKET_SIZE) {
-      throw std::runtime_error("Value exceeds packet size!");
-    }
-    strncpy(&p.data[0], str.c_str(), PACKET_SIZE);
-
-    return send_packet(p, timeout);
+    return send_packet(pack(value, type), timeout);
   }
 
 
@@ -126,57 +502,60 @@ namespace network {
    * @tparam T: The datatype of the value.
    * @param timeout: A listening timeout before aborting.
    * @returns The send value.
-   * @throws std::runtime_error if an ERROR packet is sent.
+   * @throws std::runtime_error if an ERROR packet is sent, or a binary value is the wrong size.
    */
   template <typename T> inline const T recv_value(const size_t& timeout=5) {
     auto p = recv_packet(timeout);
-    if (p.m = network::meta::ERROR) throw std::runtime_error("Failed to read from socket!");
-
-    // Get the value from the string.
-    auto str = std::string(&p.data[0], PACKET_SIZE);
-    T ret = {};
-    std::istringstream (str) >> ret;
-    return ret;
+    if (p.m == network::meta::ERROR) throw std::runtime_error("Failed to read from socket!");
+    return unpack<T>(p);
   }
 
 
   /**
-   * @brief Send a string of any size.
+   * @brief Send a string of any size, handing each frame to a function as it goes.
    * @param message The string to send.
+   * @param each: What to call with each frame's data, once it's been sent.
    * @param type: Whether you want to tag this data with something other than DATA.
    * @param timeout: A listening timeout before aborting.
    * @returns 0 if the string was sent succesfully. -1 Otherwise.
-   * @remarks This function simply breaks the string into packet sized blocks, and sends them
-   * across one at a time. The last package will be sent with a FINAL type, which will terminate the exchange.
-   * @remarks A length package will be sent to trim excessive 0's.
+   * @remarks This function simply breaks the string into frames of max_frame bytes, and sends them
+   * across one at a time. The last frame will be sent with a FINAL type, which will terminate the exchange.
+   * Each frame carries its own length, so nothing else needs to be sent.
+   * @remarks each sees the frame while it's still in the cache, such as to HMAC the string as it's sent,
+   * rather than reading the whole of it again afterwards.
+   * @remarks Frames are sent straight from message, rather than copied out of it first. With zerocopy, the
+   * kernel reads them from there too, so we wait for it to finish with them all once, at the end.
    */
-  inline int send_string(const std::string& message, const network::meta& type = DATA, const size_t& timeout=5) {
+  inline int send_string(const std::string& message, const std::function<void(std::string_view)>& each, const network::meta& type = DATA, const size_t& timeout=5) {
+    const std::string_view view(message);
 
-    // Send the length of the message, so that we can trim the string accordingly.
-    send_value<uint64_t>(message.length(), DATA, timeout);
-
-    // We'll reuse this packet with the correct type
-    packet p = {.m = type};
+    // Every frame but the last is full. The last holds the rest, which is only empty if the message is.
     size_t x = 0;
-    p.data[0] = message[0];
-
-    // Simply increment through the message, and once we hit PACKET_SIZE,
-    // send the package before overwriting the old data.
-    for (x = 1; x < message.length(); ++x) {
-      if (x % PACKET_SIZE == 0) {
-        if (send_packet(p, timeout) == -1)
-          return -1;
+    for (; view.length() - x > max_frame; x += max_frame) {
+      if (send_frame(type, view.substr(x, max_frame), timeout, true) == -1) {
+        zerocopy_wait(timeout);
+        return -1;
       }
-      p.data[x % PACKET_SIZE] = message[x];
+      each(view.substr(x, max_frame));
     }
 
-    // Fill the remainder of the packet with 0's (Since previous data will be there)
-    // And then send a FINAL packet.
-    p.m = FINAL;
-    while (x % PACKET_SIZE != 0) p.data[x++ % PACKET_SIZE] = 0;
-    if (send_packet(p, timeout) == -1)
-      return -1;
-    return 0;
+    const bool sent = send_frame(FINAL, view.substr(x), timeout, true) != -1;
+    if (sent) each(view.substr(x));
+
+    // The kernel may still be reading message, which the caller is free to change once we return.
+    return zerocopy_wait(timeout) == -1 || !sent ? -1 : 0;
+  }
+
+
+  /**
+   * @brief Send a string of any size.
+   * @param message The string to send.
+   * @param type: Whether you want to tag this data with something other than DATA.
+   * @param timeout: A listening timeout before aborting.
+   * @returns 0 if the string was sent succesfully. -1 Otherwise.
+   */
+  inline int send_string(const std::string& message, const network::meta& type = DATA, const size_t& timeout=5) {
+    return send_string(message, [](std::string_view) {}, type, timeout);
   }
 
 
@@ -184,27 +563,21 @@ namespace network {
    * @brief Receive a string
    * @param timeout: A listening timeout before aborting.
    * @returns: The string.
+   * @throws std::runtime_error if a packet couldn't be received.
    */
   inline std::string recv_string(const size_t& timeout=5) {
-
-    // Get the string ready, and receive the size.
     std::string ret;
-    packet p;
-
-    auto length = recv_value<uint64_t>();
 
     // Simply receive packets until the sender provides a FINAL packet.
     while (true) {
-      p = recv_packet();
+      auto p = recv_packet(timeout);
       if (p.m == ERROR) throw std::runtime_error("Failure recieving packet!");
 
       // Just append it.
-      ret.append(p.data, PACKET_SIZE);
+      ret += p.data;
       if (p.m == FINAL) break;
     }
-
-    // Trim to length and return.
-    return std::string(ret.c_str(), length);
+    return ret;
   }
 
 
@@ -256,6 +629,12 @@ namespace network {
     sockaddr_in clientAddress;
     socklen_t clientSize = sizeof(clientAddress);
     connection = accept(sock, (struct sockaddr *)&clientAddress, &clientSize);
+    zerocopy = false;
+    zerocopy_sent = zerocopy_done = 0;
+    if (connection != -1) {
+      nodelay();
+      enable_zerocopy();
+    }
   }
 
 
@@ -276,6 +655,8 @@ namespace network {
       close(connection);
 
     connection = socket(AF_INET, SOCK_STREAM, 0);
+    zerocopy = false;
+    zerocopy_sent = zerocopy_done = 0;
     if (connection == -1) return;
 
     // Connect to the server
@@ -289,5 +670,9 @@ namespace network {
       close(connection);
       connection = -1;
     }
+    else {
+      nodelay();
+      enable_zerocopy();
+    }
   }
 }
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>       // For the counter.
+#include <array>        // For the words of an IV.
+#include <cstdint>      // For fixed width integers.
+#include <limits>       // For the end of the counter.
+#include <stdexcept>    // For exceptions.
+
+#include "aes.h"        // For aes::gcm::iv
+#include "network.h"    // To send IVs.
+#include "prime.h"      // For prime::random
+
+/**
+ * @brief Nonces and IVs that never repeat under a key.
+ * @remarks CTR and GCM are only secure so long as no counter block is ever used twice with the same key,
+ * and picking each nonce with std::rand() only makes that likely. Here, each peer counts instead: every
+ * message takes the next values from a counter, so within a key, one peer never repeats itself. Both
+ * peers share the key, so each starts its counter somewhere random, and a GCM IV also carries a random
+ * fixed field, which keeps the two peers' IVs apart. See 8.2.1 of NIST SP 800-38D.
+ * @remarks GCM's counter blocks end in 32 bits of counter that start from 1, and CTR's end in 64 bits of
+ * 0s, so a GCM message and a CTR message can never share a counter block, even when their values overlap.
+ */
+namespace nonce {
+
+  /**
+   * @brief Build an IV.
+   * @param fixed: The fixed field.
+   * @param invocation: The count.
+   * @returns The fixed field, then the count, both big-endian.
+   */
+  inline aes::gcm::iv make(const uint32_t& fixed, const uint64_t& invocation) {
+    aes::gcm::iv ret;
+    for (size_t x = 0; x < 4; ++x) ret[x] = fixed >> (24 - 8 * x);
+    for (size_t x = 0; x < 8; ++x) ret[4 + x] = invocation >> (56 - 8 * x);
+    return ret;
+  }
+
+
+  /**
+   * @brief A run of values reserved from a counter, for one thread to hand out without asking it again.
+   */
+  class range {
+  private:
+    uint32_t fixed;
+    uint64_t at, end;
+
+  public:
+
+    /**
+     * @brief Take over a run of values.
+     * @param fixed: The fixed field of the counter.
+     * @param first: The first value.
+     * @param count: How many there are.
+     */
+    range(const uint32_t& fixed, const uint64_t& first, const uint64_t& count) : fixed(fixed), at(first), end(first + count) {}
+
+
+    /**
+     * @brief Take the next IV.
+     * @returns The IV.
+     * @throws std::runtime_error If the range has been used up.
+     */
+    aes::gcm::iv next() {
+      if (at == end) throw std::runtime_error("Nonce range is exhausted!");
+      return make(fixed, at++);
+    }
+
+
+    // How many values are left.
+    uint64_t size() const {return end - at;}
+  };
+
+
+  /**
+   * @brief The nonces one peer uses under a key.
+   * @remarks The counter is atomic, so any number of threads can take from it at once. A thread that needs
+   * many can reserve a range in one go, and then not touch the counter again until it's used them.
+   */
+  class counter {
+  private:
+    uint32_t fixed;
+    std::atomic<uint64_t> value;
+
+  public:
+
+    // Start from somewhere random.
+    counter() {reset();}
+
+    counter(const counter&) = delete;
+    counter& operator=(const counter&) = delete;
+
+
+    /**
+     * @brief Start again from somewhere random, such as for a new key.
+     * @remarks The top bit of the start is clear, so there's always at least 2^63 values to go.
+     * @remarks Both come from prime::random, and so the kernel's CSPRNG; a start seeded from the clock could
+     * be guessed, and two peers started in the same second would share it.
+     * @warning Nothing may be taking from the counter meanwhile.
+     */
+    void reset() {
+      fixed = prime::random();
+      value = prime::random() >> 1;
+    }
+
+
+    /**
+     * @brief Reserve a run of values.
+     * @param count: How many.
+     * @returns The first of them.
+     * @throws std::runtime_error If the counter would wrap, after which the key must be exchanged again.
+     * @remarks For CTR, the values are the counters of each block, so a message takes its length in blocks,
+     * plus one.
+     * @remarks Nothing is stored unless the whole run fits, so an exhausted counter stays exhausted until reset.
+     */
+    uint64_t reserve(const uint64_t& count) {
+      auto first = value.load(std::memory_order_relaxed);
+      do {
+        if (first > std::numeric_limits<uint64_t>::max() - count) throw std::runtime_error("Nonces are exhausted! Re-exchange keys!");
+      } while (!value.compare_exchange_weak(first, first + count, std::memory_order_relaxed));
+      return first;
+    }
+
+
+    // Reserve a run of IVs; see range.
+    range block(const uint64_t& count) {return range(fixed, reserve(count), count);}
+
+
+    // Take the next IV.
+    aes::gcm::iv next() {return make(fixed, reserve(1));}
+  };
+
+
+  /**
+   * @brief Put an IV into a packet.
+   * @param nonce: The IV.
+   * @returns The IV packet, holding it as three big-endian words, so it's the IV's bytes in order.
+   */
+  inline network::packet pack(const aes::gcm::iv& nonce) {
+    std::array<uint32_t, 3> words = {};
+    for (size_t x = 0; x < nonce.size(); ++x) words[x / 4] = words[x / 4] << 8 | nonce[x];
+    return network::pack(words, network::meta::IV);
+  }
+
+
+  /**
+   * @brief Take an IV out of a packet.
+   * @param p: The packet, as pack made it.
+   * @returns The IV.
+   * @throws std::runtime_error If the packet is malformed.
+   */
+  inline aes::gcm::iv unpack(const network::packet& p) {
+    const auto words = network::unpack<std::array<uint32_t, 3>>(p);
+    aes::gcm::iv ret;
+    for (size_t x = 0; x < ret.size(); ++x) ret[x] = words[x / 4] >> (24 - 8 * (x % 4));
+    return ret;
+  }
+}
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <cstdint>      // For fixed width integers.
+#include <array>        // For the header of each message.
+#include <string>       // For messages.
+#include <stdexcept>    // For exceptions.
+#include <algorithm>    // For std::min
+#include <memory>       // For keys being prepared in the background.
+#include <atomic>       // For knowing when they're ready.
+#include <functional>   // For waiting on them elsewhere.
+
+#include "util.h"       // For the keyring, and sealing messages.
+#include "pool.h"       // To prepare the next key in the background.
+
+
+/**
+ * @brief Streaming many messages to a peer, without waiting on it for each.
+ * @remarks util::send_message waits for the peer to acknowledge every message before sending it, so
+ * at best one message goes across per round trip, and usually far fewer, since a person has to press
+ * a key. Here, the peer agrees to a stream once, and then messages go out back-to-back, each numbered
+ * in turn. The sender may be up to a window of messages ahead of what the peer has acknowledged, and
+ * the peer acknowledges once per window, with how many messages it's received so far, which covers
+ * every one before it. The sender only has to stop once a whole window is unacknowledged.
+ * @remarks Everything is sent with the existing packet types, and each message is what send_message
+ * sends after the key size; see util::send_sealed.
+ * @remarks A long stream can rotate its key without stopping. The sender offers a new exchange in the
+ * middle of the stream, and the recipient answers it, with both sides preparing the keys it gives on
+ * the pool while messages carry on under the old ones. Once the sender's are ready, it names the
+ * message from which it uses them, and every message says the epoch of the key it's under; see
+ * util::keyring. The recipient keeps the old key for a few messages past that, in case any were sealed
+ * under it before the sender switched; see overlap.
+ *
+ * INITIATOR                   RECIPIENT
+ *  MESSAGE(window)    -->
+ *                     <--     ACK(window)/REFUSED
+ *  MESSAGE(seq, Nr, epoch) -->
+ *  CIPHERTEXT...      -->
+ *    ...                      (Every window messages)
+ *                     <--     ACK(received)/REFUSED(received)
+ *    ...
+ *  REEXCHANGE, OFFER  -->     (To rotate keys)
+ *                     <--     ANSWER
+ *  REEXCHANGE(seq)    -->     (Switch from seq on)
+ *    ...
+ *  FINAL(sent)        -->
+ *                     <--     FINAL(received)
+ *
+ * @warning If either side fails mid-stream, the other may still be sending, so the connection is out of
+ * step and should be terminated.
+ */
+namespace pipeline {
+
+  /**
+   * @brief The largest window a recipient will agree to.
+   * @remarks The recipient can only slow the sender down by not acknowledging, so this bounds how many
+   * messages can be waiting on it in the socket.
+   */
+  uint64_t max_window = 1 << 10;
+
+
+  /**
+   * @brief How many messages past a switch the recipient still accepts under the old key.
+   * @remarks Afterwards, the old key is forgotten.
+   */
+  uint64_t overlap = 1 << 4;
+
+
+  /**
+   * @brief The keys a recipient decrypts a stream with: the current ones, the next ones while they're
+   * being prepared, and the previous ones during the overlap.
+   */
+  class epochs {
+  private:
+
+    // A keyring being prepared on the pool.
+    struct prepared {
+      util::keyring keys;
+      std::atomic<bool> ready = false;
+    };
+
+    util::keyring& keys;
+    std::unique_ptr<util::keyring> previous;
+    std::shared_ptr<prepared> upcoming;
+
+    // Once this many messages have arrived, the previous keys are forgotten.
+    uint64_t until = 0;
+
+  public:
+
+    /**
+     * @brief Decrypt a stream.
+     * @param keys: The shared key, which is replaced as the stream rotates it.
+     */
+    epochs(util::keyring& keys) : keys(keys) {}
+
+
+    /**
+     * @brief Answer the sender's offer of the next key, and start preparing it.
+     * @param offer: The offer.
+     * @returns The answer to send.
+     * @throws std::runtime_error If the offer is malformed.
+     */
+    network::packet answer(const network::packet& offer) {
+      exchange::secret ours;
+      std::array<uint64_t, 4> shared;
+      const auto ret = ours.answer(offer, shared);
+      prepare(shared);
+      return ret;
+    }
+
+
+    /**
+     * @brief Start preparing the next key, for an offer that's already been answered.
+     * @param shared: The key the answer gave.
+     * @remarks This is the second half of answer, for a caller that answers somewhere else, such as on the pool.
+     */
+    void prepare(const std::array<uint64_t, 4>& shared) {
+      upcoming = std::make_shared<prepared>();
+      pool::shared().submit([next = upcoming, shared, epoch = keys.get_epoch() + 1]() {
+        next->keys.set(shared, epoch);
+        next->ready = true;
+        next->ready.notify_all();
+      });
+    }
+
+
+    // Whether rotate can switch without waiting, because the next keys are ready, or there aren't any to wait on.
+    bool ready() const {return !upcoming || upcoming->ready;}
+
+
+    /**
+     * @brief Wait for the next keys, without touching anything else.
+     * @returns A function that waits for them.
+     * @remarks For a caller that mustn't block, such as the server's loop, to run on another thread before
+     * it calls rotate.
+     */
+    std::function<void()> waiter() const {
+      return [next = upcoming]() {if (next) next->ready.wait(false);};
+    }
+
+
+    /**
+     * @brief Switch to the next key.
+     * @param sequence: The first message under it.
+     * @throws std::runtime_error If there's no next key.
+     * @remarks The next keys started on the pool before the sender even had our answer, so they're
+     * almost always ready; otherwise, this waits for them. See ready.
+     */
+    void rotate(const uint64_t& sequence) {
+      if (!upcoming) throw std::runtime_error("Peer switched to a key it never offered!");
+      upcoming->ready.wait(false);
+
+      previous = std::make_unique<util::keyring>();
+      *previous = std::move(keys);
+      keys = std::move(upcoming->keys);
+      upcoming.reset();
+      until = sequence + overlap;
+    }
+
+
+    // Forget everything but the current keys, once a stream ends.
+    void end() {
+      previous.reset();
+      upcoming.reset();
+    }
+
+
+    /**
+     * @brief Get the keys a message is under.
+     * @param epoch: The epoch it's under.
+     * @param sequence: Its number.
+     * @returns The keys.
+     * @throws std::runtime_error If the epoch isn't the current one, or the previous one during the overlap.
+     */
+    const util::keyring& get(const uint64_t& epoch, const uint64_t& sequence) {
+      if (previous && sequence >= until) previous.reset();
+      if (epoch == keys.get_epoch()) return keys;
+      if (previous && epoch == previous->get_epoch()) return *previous;
+      throw std::runtime_error("Peer sent message under an unknown key!");
+    }
+  };
+
+
+  /**
+   * @brief Streams messages to the peer.
+   */
+  class sender {
+  private:
+
+    /**
+     * @brief Where a rotation is.
+     * @var OFFERING: Making our offer on the pool.
+     * @var ANSWERING: Waiting on the peer's answer.
+     * @var PREPARING: Finishing the exchange, and preparing the keys, on the pool.
+     */
+    typedef enum {OFFERING, ANSWERING, PREPARING} stage;
+
+    // A rotation underway, which the pool fills in.
+    struct rotation {
+      exchange::secret ours;
+      network::packet offer;
+      util::keyring keys;
+      std::string error;
+      std::atomic<bool> ready = false;
+      stage at = OFFERING;
+    };
+
+    util::keyring& keys;
+    uint64_t window, sent = 0, acked = 0;
+    bool open = true;
+
+    // How many messages to send under each key, or 0 to never rotate, and the first under the current one.
+    uint64_t rotate_every, since = 0;
+    std::shared_ptr<rotation> rotating;
+
+
+    // Move an acknowledgement forward; it can only go forward, and never past what we've sent.
+    void acknowledged(const network::packet& p) {
+      const auto received = network::unpack<uint64_t>(p);
+      if (received < acked || received > sent) throw std::runtime_error("Peer sent invalid acknowledgement!");
+      acked = received;
+    }
+
+
+    /**
+     * @brief Handle a packet from the peer, during the stream.
+     * @param p: The packet.
+     * @throws std::runtime_error If the peer refused a message, or sent something else.
+     */
+    void handle(const network::packet& p) {
+      switch (p.m) {
+        case network::meta::ACK: acknowledged(p); return;
+        case network::meta::REFUSED: throw std::runtime_error("Peer refused message " + std::to_string(network::unpack<uint64_t>(p)) + "!");
+        case network::meta::ERROR: throw std::runtime_error("Could not communicate with peer!");
+
+        // The answer to our offer; finish the exchange, and prepare the keys, on the pool.
+        case network::meta::DATA:
+          if (rotating && rotating->at == ANSWERING) {
+            rotating->at = PREPARING;
+            pool::shared().submit([r = rotating, answer = p, epoch = keys.get_epoch() + 1]() {
+              try {r->keys.set(r->ours.finish(answer), epoch);}
+              catch (std::runtime_error& e) {r->error = e.what();}
+              r->ready = true;
+            });
+            return;
+          }
+          [[fallthrough]];
+        default: throw std::runtime_error("Peer sent invalid response!");
+      }
+    }
+
+
+    /**
+     * @brief Move a rotation along, without waiting on anything.
+     * @throws std::runtime_error If a packet couldn't be sent, or the exchange failed.
+     */
+    void advance() {
+      if (!rotating) return;
+
+      // Whatever the peer has sent meanwhile, such as its answer.
+      while (rotating && rotating->at == ANSWERING && network::waiting()) handle(network::recv_packet());
+      if (!rotating->ready) return;
+      rotating->ready = false;
+      if (!rotating->error.empty()) throw std::runtime_error(rotating->error);
+
+      if (rotating->at == OFFERING) {
+        if (network::send_packet({.m = network::meta::REEXCHANGE}) == -1 || network::send_packet(rotating->offer) == -1)
+          throw std::runtime_error("Failed to offer keys!");
+        rotating->at = ANSWERING;
+      }
+
+      // The next message is the first under the new keys.
+      else if (rotating->at == PREPARING) {
+        if (network::send_value(sent, network::meta::REEXCHANGE) == -1)
+          throw std::runtime_error("Failed to switch keys!");
+        keys = std::move(rotating->keys);
+        rotating.reset();
+        since = sent;
+      }
+    }
+
+  public:
+
+    /**
+     * @brief Ask the peer for a stream.
+     * @param keys: The shared key, which is replaced as the stream rotates it.
+     * @param window: How many messages to send before the peer must acknowledge them.
+     * @param rotate_every: How many messages to send under a key before rotating it, or 0 to never.
+     * @throws std::runtime_error If the peer refuses, or couldn't be reached.
+     * @remarks The peer may agree to a smaller window than asked; see max_window.
+     */
+    sender(util::keyring& keys, const uint64_t& window, const uint64_t& rotate_every = 0) : keys(keys), rotate_every(rotate_every) {
+      if (window == 0) throw std::runtime_error("The window must hold a message!");
+      if (network::send_value(window, network::meta::MESSAGE) == -1)
+        throw std::runtime_error("Failed to communicate with peer!");
+
+      // Be generous, since a person may have to accept.
+      auto response = network::recv_packet(30);
+      switch (response.m) {
+        case network::meta::ACK: break;
+        case network::meta::REFUSED: throw std::runtime_error("Peer refused to accept messages!");
+        case network::meta::MESSAGE: throw std::runtime_error("Cannot send two messages at once! One peer must Listen!");
+        default: throw std::runtime_error("Could not communicate with peer!");
+      }
+
+      this->window = network::unpack<uint64_t>(response);
+      if (this->window == 0 || this->window > window) throw std::runtime_error("Peer sent invalid window!");
+    }
+
+    sender(const sender&) = delete;
+    sender& operator=(const sender&) = delete;
+
+
+    /**
+     * @brief Start rotating the key, if it isn't already.
+     * @remarks The offer is made on the pool, and nothing waits on the rotation; it moves along as
+     * messages are sent, which carry on under the current key until it's done.
+     */
+    void rotate() {
+      if (rotating) return;
+      rotating = std::make_shared<rotation>();
+      pool::shared().submit([r = rotating]() {
+        try {r->offer = r->ours.offer();}
+        catch (std::runtime_error& e) {r->error = e.what();}
+        r->ready = true;
+      });
+    }
+
+
+    /**
+     * @brief Send a message, once the window has room for it.
+     * @param message: The message.
+     * @param Nr: The number of rounds.
+     * @param m: The mode.
+     * @throws std::runtime_error If the message couldn't be sent, the peer refused one, or a rotation failed.
+     */
+    void send(const std::string& message, const uint64_t& Nr, const util::mode& m) {
+      if (!open) throw std::runtime_error("Stream is closed!");
+      if (rotate_every != 0 && sent - since >= rotate_every) rotate();
+      advance();
+      while (sent - acked >= window) handle(network::recv_packet(30));
+
+      if (network::send_value(std::array<uint64_t, 3>{sent, Nr, keys.get_epoch()}, network::meta::MESSAGE) == -1)
+        throw std::runtime_error("Failed to send message!");
+      util::send_sealed(keys, message, Nr, m);
+      ++sent;
+    }
+
+
+    /**
+     * @brief End the stream, once the peer has every message.
+     * @returns How many messages were sent.
+     * @throws std::runtime_error If the peer refused a message, or didn't get them all.
+     * @remarks A rotation that hasn't switched yet is abandoned, and both peers stay on the current key.
+     */
+    uint64_t close() {
+      if (!open) return sent;
+      open = false;
+      if (network::send_value(sent, network::meta::FINAL) == -1)
+        throw std::runtime_error("Failed to end stream!");
+
+      // An acknowledgement of the last window, or an answer, may still be on its way ahead of the end.
+      while (true) {
+        auto p = network::recv_packet(30);
+        if (p.m == network::meta::FINAL) {
+          if (network::unpack<uint64_t>(p) != sent) throw std::runtime_error("Peer did not receive every message!");
+          acked = sent;
+          rotating.reset();
+          return sent;
+        }
+        handle(p);
+      }
+    }
+
+
+    // Getters.
+    const auto& get_window() const {return window;}
+    const auto& get_sent() const {return sent;}
+    const auto& get_acked() const {return acked;}
+  };
+
+
+  /**
+   * @brief Receive a stream the peer has asked for.
+   * @tparam F: A function taking the number of a message, and the message.
+   * @param keys: The shared key, which is replaced as the stream rotates it.
+   * @param request: The MESSAGE packet the peer asked with.
+   * @param each: What to call with each message, as it arrives.
+   * @returns How many messages were received.
+   * @throws std::runtime_error If a message couldn't be received, or was altered, after telling the peer.
+   * @remarks Call this once the request has been accepted, instead of sending an ACK; the answer carries
+   * the window we agree to.
+   */
+  template <typename F> uint64_t receive(util::keyring& keys, const network::packet& request, F each) {
+    const auto window = std::min(network::unpack<uint64_t>(request), max_window);
+    if (window == 0) {
+      network::send_packet({.m = network::meta::REFUSED});
+      throw std::runtime_error("Peer sent invalid window!");
+    }
+    if (network::send_value(window, network::meta::ACK) == -1)
+      throw std::runtime_error("Failed to communicate with peer!");
+
+    epochs rings(keys);
+    uint64_t received = 0;
+    const auto refuse = [&received](const std::string& what) {
+      network::send_value(received, network::meta::REFUSED);
+      throw std::runtime_error(what);
+    };
+
+    while (true) {
+      auto p = network::recv_packet(30);
+
+      // The peer is done; it should have sent as many as we have.
+      if (p.m == network::meta::FINAL) {
+        if (network::unpack<uint64_t>(p) != received) refuse("Peer did not send every message!");
+        if (network::send_value(received, network::meta::FINAL) == -1)
+          throw std::runtime_error("Failed to end stream!");
+        return received;
+      }
+
+      // The peer offers the next key, and then later, says which message it starts from.
+      if (p.m == network::meta::REEXCHANGE) {
+        std::string failed;
+        try {
+          if (!p.data.empty()) {
+            const auto from = network::unpack<uint64_t>(p);
+            if (from != received) throw std::runtime_error("Peer switched keys out of order!");
+            rings.rotate(from);
+          }
+          else if (network::send_packet(rings.answer(network::recv_packet())) == -1)
+            throw std::runtime_error("Failed to answer keys!");
+        }
+        catch (std::runtime_error& e) {failed = e.what();}
+        if (!failed.empty()) refuse(failed);
+        continue;
+      }
+      if (p.m != network::meta::MESSAGE) refuse("Peer sent invalid packet!");
+
+      // Messages arrive in order, so anything else means one went missing.
+      const auto [sequence, Nr, epoch] = network::unpack<std::array<uint64_t, 3>>(p);
+      if (sequence != received) refuse("Peer sent message out of order!");
+
+      std::string message;
+      try {message = util::recv_sealed(rings.get(epoch, sequence), Nr);}
+      catch (std::runtime_error& e) {refuse(e.what());}
+      each(sequence, message);
+
+      // One acknowledgement covers the whole window.
+      if (++received % window == 0 && network::send_value(received, network::meta::ACK) == -1)
+        throw std::runtime_error("Failed to acknowledge messages!");
+    }
+  }
+}
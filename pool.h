@@ -0,0 +1,143 @@
+#pragma once
+
+#include <thread>              // For std::thread
+#include <mutex>               // For std::mutex
+#include <condition_variable>  // To wait for work.
+#include <functional>          // For std::function
+#include <queue>               // For the task queue.
+#include <vector>              // For the threads.
+#include <atomic>              // For the shared chunk index.
+#include <memory>              // For std::shared_ptr
+#include <algorithm>           // For std::min and std::max
+
+#include "trace.h"             // So the chunks of a traced call aren't counted again.
+
+/**
+ * @brief A pool of worker threads, shared by everything that runs in parallel.
+ * @remarks Starting a thread is expensive, far more so than encrypting a few kilobytes,
+ * so rather than spawning threads for every message, we start them once and hand them work.
+ */
+namespace pool {
+
+  /**
+   * @brief A fixed set of threads that run tasks from a queue.
+   */
+  class workers {
+  private:
+    std::vector<std::thread> threads;
+    std::queue<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable ready;
+    bool stopping = false;
+
+  public:
+
+    /**
+     * @brief Start the workers.
+     * @param count: How many threads to start.
+     */
+    workers(const size_t& count) {
+      for (size_t x = 0; x < count; ++x) {
+        threads.emplace_back([this]() {
+          while (true) {
+            std::function<void()> task;
+            {
+              std::unique_lock<std::mutex> guard(lock);
+              ready.wait(guard, [this]() {return stopping || !tasks.empty();});
+              if (stopping && tasks.empty()) return;
+              task = std::move(tasks.front());
+              tasks.pop();
+            }
+            task();
+          }
+        });
+      }
+    }
+
+
+    // Finish whatever is queued, then stop the workers.
+    ~workers() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+      }
+      ready.notify_all();
+      for (auto& thread : threads) thread.join();
+    }
+
+
+    /**
+     * @brief Queue a task.
+     * @param task: The task.
+     */
+    void submit(std::function<void()> task) {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.emplace(std::move(task));
+      }
+      ready.notify_one();
+    }
+
+
+    // Getter.
+    size_t size() const {return threads.size();}
+  };
+
+
+  /**
+   * @brief The pool everything shares, with one thread for every core.
+   * @remarks The threads are started the first time this is called.
+   */
+  workers& shared() {
+    static workers instance(std::max(1u, std::thread::hardware_concurrency()));
+    return instance;
+  }
+
+
+  /**
+   * @brief Split a range into chunks, and run them across the pool.
+   * @tparam F: A function taking the beginning and end of a chunk.
+   * @param count: The size of the range.
+   * @param chunk: The size of each chunk.
+   * @param body: The function to run on each chunk.
+   * @param on: The pool to run on.
+   * @remarks This returns once every chunk is done. The calling thread works on chunks as well,
+   * which means it's safe to call this from a worker; if every worker is busy, the caller simply
+   * does all of the work itself.
+   * @warning body must not throw.
+   */
+  template <typename F> void parallel_for(const size_t& count, const size_t& chunk, F body, workers& on = shared()) {
+    const size_t chunks = chunk == 0 ? 1 : (count + chunk - 1) / chunk;
+    if (chunks <= 1) {
+      if (count) body(0, count);
+      return;
+    }
+
+    // Workers claim the next chunk from a shared index, so that a slow thread doesn't hold up the rest.
+    struct progress {
+      std::atomic<size_t> next = 0, done = 0;
+      std::mutex lock;
+      std::condition_variable finished;
+    };
+    auto p = std::make_shared<progress>();
+
+    // A worker may only get to this after everything is done, so it can't touch body unless it claims a chunk.
+    auto* task = &body;
+    auto run = [p, task, chunks, count, chunk]() {
+      TRACE_INSIDE();
+      for (size_t x; (x = p->next++) < chunks;) {
+        (*task)(x * chunk, std::min(count, (x + 1) * chunk));
+        if (++p->done == chunks) {
+          std::lock_guard<std::mutex> guard(p->lock);
+          p->finished.notify_all();
+        }
+      }
+    };
+
+    for (size_t x = 0; x < std::min(on.size(), chunks - 1); ++x) on.submit(run);
+    run();
+
+    std::unique_lock<std::mutex> guard(p->lock);
+    p->finished.wait(guard, [&p, chunks]() {return p->done == chunks;});
+  }
+}
@@ -1,8 +1,11 @@
 #pragma once
 
-#include <cmath>    // For std::sqrt()
-#include <cstdlib>  // For randomness.
-#include <cstdint>  // For fixed width integers.
+#include <cstdint>      // For fixed width integers.
+#include <cerrno>       // For EINTR.
+#include <stdexcept>    // For std::runtime_error
+#include <sys/random.h> // For randomness.
+#include <array>        // For the small primes.
+#include <utility>      // For std::pair
 
 /**
  * @brief The namespace for prime number related operations.
@@ -13,41 +16,119 @@
  */
 namespace prime {
 
-  /**
-  * @brief Checks if any given number is prime.
-  * @param  num: The number.
-  * @returns True if the number is prime, False if it isn't.
-  */
-  inline bool is(const uint64_t& num) {
-    if (num == 1) return false;
+  // Twice the width of our numbers, so that multiplying two of them can't overflow.
+  typedef unsigned __int128 wide;
 
-    // We only need to check up to the square root of the number in order to know if it's prime.
-    auto root = static_cast<uint64_t>(std::sqrt(num)) + 1;
 
-    // Start at 2, so we don't get a 0/1 false positive.
-    for (size_t x = 2; x <= root; ++x) {
-      if (num % x == 0)
-        return false;
+  /**
+   * @brief Every prime below 256, found with the Sieve of Eratosthenes when compiling.
+   * @remarks Most numbers have a small factor, so dividing by these first throws out the vast majority
+   * of candidates before the more expensive test in is ever runs.
+   */
+  constexpr auto small = []() {
+    std::array<bool, 256> composite = {};
+    std::array<uint16_t, 54> primes = {};
+    size_t count = 0;
+    for (uint16_t x = 2; x < 256; ++x) {
+      if (composite[x]) continue;
+      primes[count++] = x;
+      for (uint16_t y = x * x; y < 256; y += x) composite[y] = true;
     }
-    return true;
+    return primes;
+  }();
+
+
+  /**
+   * @brief Multiply two numbers within a modulus.
+   * @param a: The first number.
+   * @param b: The second number.
+   * @param mod: The modulus.
+   * @returns a * b % mod, without overflowing.
+   */
+  inline uint64_t multiply(const uint64_t& a, const uint64_t& b, const uint64_t& mod) {
+    return static_cast<uint64_t>(static_cast<wide>(a) * b % mod);
   }
 
 
   /**
-   * @brief Find the next prime greater than the provided number.
-   * @tparam T: The type of number. Generating a prime uses half-width.
-   * @param num: The number (Does not need to be prime itself)
-   * @remarks This function is intended to overflow, since the datatype is unsigned. Since we are always dealing with
-   * odd numbers, an overflow will bring us to 1.
-   * @warning This function is done in-place. It modifies the number you pass to it.
+   * @brief Arithmetic within an odd modulus, in Montgomery form.
+   * @remarks Every multiplication within a modulus ends with a division, to find the remainder, and
+   * division is one of the slowest things a processor does. Montgomery's trick is to hold every number
+   * as x * R % n, where R = 2^64. Multiplying two such numbers gives x * y * R * R, and removing one of
+   * the Rs (The reduction) only takes multiplications and a shift, with no division at all. Numbers
+   * only need converting in and out at the start and end, so a raise, with its many multiplications,
+   * comes out well ahead.
+   * @remarks See Montgomery, "Modular Multiplication Without Trial Division" (1985).
+   * @warning The modulus must be odd, or there is no inverse of it modulo R.
    */
-  template <typename T = uint64_t> inline void next(T& num) {
-    // Get to an odd number.
-    if (num % 2 == 0) num++;
+  class montgomery {
+  private:
+    uint64_t n, inverse, r2;
+
+  public:
+
+    /**
+     * @brief Prepare for a modulus.
+     * @param n: The modulus, which must be odd.
+     */
+    montgomery(const uint64_t& n) : n(n) {
+
+      // Newton's method for n^-1 % R; an odd n is its own inverse in the lowest 3 bits, and every step
+      // doubles how many bits are right, so five steps get all 64. The reduction needs -n^-1.
+      uint64_t x = n;
+      for (size_t step = 0; step < 5; ++step) x *= 2 - n * x;
+      inverse = -x;
+
+      // R % n, squared, converts numbers into the form.
+      const uint64_t r = (0 - n) % n;
+      r2 = prime::multiply(r, r, n);
+    }
+
+
+    /**
+     * @brief Divide a product by R, within the modulus.
+     * @param t: The product, which must be less than n * R.
+     * @returns t / R % n.
+     * @remarks Adding the right multiple of n makes the bottom 64 bits 0, so the division is just taking
+     * the top half. The result is below 2n, which may not fit in 64 bits, so that's done wide.
+     */
+    uint64_t reduce(const wide& t) const {
+      const uint64_t m = static_cast<uint64_t>(t) * inverse;
+      const wide mn = static_cast<wide>(m) * n;
+      const uint64_t low = static_cast<uint64_t>(t) + static_cast<uint64_t>(mn);
+      wide high = (t >> 64) + (mn >> 64) + (low < static_cast<uint64_t>(t));
+      if (high >= n) high -= n;
+      return static_cast<uint64_t>(high);
+    }
 
-    // Loop until we find one.
-    for (; !prime::is(num); num += 2) {}
-  }
+
+    // Multiply two numbers in the form.
+    uint64_t multiply(const uint64_t& a, const uint64_t& b) const {return reduce(static_cast<wide>(a) * b);}
+
+    // Convert a number into the form, and back out.
+    uint64_t to(const uint64_t& a) const {return multiply(a % n, r2);}
+    uint64_t from(const uint64_t& a) const {return reduce(a);}
+
+
+    /**
+     * @brief Raise a number in the form.
+     * @param value: The value, in the form.
+     * @param exp: The exponent.
+     * @returns value ** exp, in the form.
+     */
+    uint64_t raise(uint64_t value, uint64_t exp) const {
+      uint64_t ret = to(1);
+      for (; exp > 0; exp >>= 1) {
+        if (exp & 1) ret = multiply(ret, value);
+        value = multiply(value, value);
+      }
+      return ret;
+    }
+
+
+    // Getter.
+    const auto& modulus() const {return n;}
+  };
 
 
   /**
@@ -59,10 +140,18 @@ namespace prime {
    * @note From https://www.geeksforgeeks.org/primitive-root-of-a-prime-number-n-modulo-n/
    * @remarks Because raising values is almost assured to overflow when using such large numbers.
    * We need to compute it piecemeal, applying the modulus on each self multiplication such
-   * that it remains bounded with our datatype.
+   * that it remains bounded with our datatype. Each multiplication is done at twice the width,
+   * so mod can be anything up to 2^64.
+   * @remarks Our moduli are primes, and so odd, which lets us use montgomery instead of dividing for
+   * every multiplication.
    */
   inline uint64_t raise(uint64_t value, uint64_t exp, const uint64_t& mod) {
-    uint64_t ret = 1;
+    if (mod % 2 == 1 && mod > 1) {
+      const montgomery m(mod);
+      return m.from(m.raise(m.to(value), exp));
+    }
+
+    uint64_t ret = 1 % mod;
 
     // Ensure it's bounded by the mod.
     value = value % mod;
@@ -71,11 +160,92 @@ namespace prime {
     while (exp > 0) {
 
       // If the current bit is 1, multiply ret by our value, and mod it.
-      if (exp & 1) ret = (ret*value) % mod;
+      if (exp & 1) ret = multiply(ret, value, mod);
 
       // Shift exp down.
       exp = exp >> 1;
-      value = (value*value) % mod;
+      value = multiply(value, value, mod);
+    }
+    return ret;
+  }
+
+
+  /**
+  * @brief Checks if any given number is prime.
+  * @param  num: The number.
+  * @returns True if the number is prime, False if it isn't.
+  * @remarks Numbers are first divided by the small primes, and anything left is put through Miller-Rabin.
+  * Write num - 1 = d * 2^s, with d odd. If num is prime, then for any a, either a^d = 1, or squaring it
+  * reaches num - 1 within s steps, since the only square roots of 1 modulo a prime are 1 and -1. A
+  * composite number fails this for most a. On its own, that makes the test probabilistic, but every
+  * composite number below 2^64 fails it for at least one of the first twelve primes, so testing all of
+  * them gives an exact answer.
+  * @remarks See Miller, "Riemann's Hypothesis and Tests for Primality" (1976), Rabin, "Probabilistic
+  * Algorithm for Testing Primality" (1980), and for the bases, Sorenson and Webster (2015).
+  */
+  inline bool is(const uint64_t& num) {
+    if (num < 2) return false;
+    for (const auto& x : small) {
+      if (num == x) return true;
+      if (num % x == 0) return false;
+    }
+
+    // Without a factor below 256, anything below 256^2 must be prime.
+    if (num < 256 * 256) return true;
+
+    uint64_t d = num - 1;
+    size_t s = 0;
+    for (; d % 2 == 0; d /= 2) ++s;
+
+    const montgomery m(num);
+    const auto one = m.to(1), minus_one = m.to(num - 1);
+    for (const uint64_t a : {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37}) {
+      auto x = m.raise(m.to(a), d);
+      if (x == one || x == minus_one) continue;
+
+      bool composite = true;
+      for (size_t y = 1; y < s && composite; ++y) {
+        x = m.multiply(x, x);
+        if (x == minus_one) composite = false;
+      }
+      if (composite) return false;
+    }
+    return true;
+  }
+
+
+  /**
+   * @brief Find the next prime greater than the provided number.
+   * @tparam T: The type of number.
+   * @param num: The number (Does not need to be prime itself)
+   * @remarks This function is intended to overflow, since the datatype is unsigned. Since we are always dealing with
+   * odd numbers, an overflow will bring us to 1.
+   * @warning This function is done in-place. It modifies the number you pass to it.
+   */
+  template <typename T = uint64_t> inline void next(T& num) {
+    // Get to an odd number.
+    if (num % 2 == 0) num++;
+
+    // Loop until we find one.
+    for (; !prime::is(num); num += 2) {}
+  }
+
+
+  /**
+   * @brief A random 64 bit number.
+   * @returns The number.
+   * @throws std::runtime_error if the kernel can't give us any.
+   * @remarks Private keys and nonces come from here, so it must be unpredictable, and threads call it at once,
+   * so it mustn't share any state; std::rand() is neither. getrandom(2) reads the kernel's CSPRNG, and only
+   * blocks before it has been seeded at boot.
+   */
+  inline uint64_t random() {
+    uint64_t ret = 0;
+    auto bytes = reinterpret_cast<char*>(&ret);
+    for (size_t read = 0; read < sizeof(ret);) {
+      auto got = getrandom(bytes + read, sizeof(ret) - read, 0);
+      if (got > 0) read += got;
+      else if (got == -1 && errno != EINTR) throw std::runtime_error("Failed to gather randomness");
     }
     return ret;
   }
@@ -84,22 +254,39 @@ namespace prime {
   /**
   * @brief Generates a prime number
   * @returns A prime number p, and the smaller prime q.
-  * @remarks This function will use std::rand() to find a starting value, and then find the nearest prime larger than it.
-  * There are some cavets to this approach for the sake of simplicity and readibility. Firstly, primes are confined from 3 - 2**64
-  * Secondly, std::rand() is not considered a cryptographically secure PRNG. However, this implemention makes it easier to
-  * understand, and allows us to work within the confines of standard integer types.
+  * @remarks This function will use random() to find a starting value, and then find the nearest safe
+  * prime larger than it. There are some cavets to this approach for the sake of simplicity and readibility.
+  * Primes are confined to 64 bits, which is far too small to resist a determined attacker; see
+  * exchange::standard for groups that are. However, this implemention makes it easier to understand, and
+  * allows us to work within the confines of standard integer types.
+  * @remarks A safe prime needs both q and p = 2q + 1 to be prime, which is rare, so rather than testing
+  * candidates one by one, we sieve a window of them at once: for each small prime, we cross out every q in
+  * the window that it divides, and every q whose p it divides, without dividing anything. Only the few that
+  * survive are put through is.
   * @remarks See 2.2 of the Diffie-Hellman Reference.
   */
   inline std::pair<uint64_t, uint64_t> generate() {
-    auto q = static_cast<uint32_t>(std::rand());
-    prime::next<uint32_t>(q);
-
-    // Sometime's q will not be prime, due to casting.
-    // We can just re-roll the number if that's the case.
-    auto p = (static_cast<uint64_t>(q) * 2) + 1;
-    if (!prime::is(p)) {
-      return prime::generate();
+    constexpr size_t window = 1 << 12;
+
+    while (true) {
+      // q has its top bit set, so that p is a full 64 bits, but leaves room for the window.
+      const uint64_t start = ((uint64_t(1) << 62) + random() % ((uint64_t(1) << 62) - 2 * window)) | 1;
+
+      // The window holds q = start + 2i. The small primes are odd, so 2 has an inverse, (s + 1) / 2.
+      std::array<bool, window> crossed = {};
+      for (size_t x = 1; x < small.size(); ++x) {
+        const uint64_t s = small[x], half = (s + 1) / 2, r = start % s;
+
+        // Where s divides q, and where it divides p, which is where q = (s - 1) / 2.
+        for (const auto& target : {uint64_t(0), (s - 1) / 2}) {
+          for (uint64_t i = (target + s - r) % s * half % s; i < window; i += s) crossed[i] = true;
+        }
+      }
+
+      for (size_t i = 0; i < window; ++i) {
+        const uint64_t q = start + 2 * i, p = 2 * q + 1;
+        if (!crossed[i] && is(q) && is(p)) return {p, q};
+      }
     }
-    return {p, q};
   }
 }
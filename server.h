@@ -0,0 +1,730 @@
+#pragma once
+
+#include <sys/epoll.h>      // For the event loop.
+#include <sys/eventfd.h>    // To wake the event loop from other threads.
+#include <fcntl.h>          // For non-blocking sockets.
+#include <unordered_map>    // For the sessions.
+#include <unordered_set>    // For sessions waiting on the pool.
+#include <memory>           // For std::unique_ptr and std::shared_ptr
+#include <functional>       // For the handlers.
+#include <deque>            // For messages waiting to be sent.
+#include <atomic>           // For stopping from another thread.
+#include <mutex>            // For posting tasks.
+
+#include "util.h"           // For the keyring.
+#include "pipeline.h"       // For streams the peer sends.
+#include "pool.h"           // To generate parameters off the event loop.
+#include "uring.h"          // To send to every peer at once.
+
+
+/**
+ * @brief One process serving many peers at once.
+ * @remarks The functions in util and network block on a single, global connection, which is fine
+ * for the interactive menu, but means a second peer waits until the first is done. Here, every
+ * connection is a session, with its own keys and its own place in the protocol, and a single
+ * thread moves all of them along as their bytes arrive, through epoll. Nothing in a session ever
+ * waits on its peer, so one slow peer doesn't hold up the rest.
+ * @remarks The protocol is exactly the one util speaks, so the interactive menu is just another
+ * peer: it connects, exchanges keys as the generating side, and then sends messages or asks to
+ * re-exchange whenever it likes.
+ */
+namespace server {
+
+  // The modes a session can send a message with; see util::mode.
+  using util::mode, util::ECB, util::CTR, util::GCM;
+
+
+  /**
+   * @brief The longest message a session will receive, in bytes of ciphertext.
+   * @remarks A message is only decrypted once all of it has arrived, so without a limit, a peer could have us
+   * hold as much of it as it likes. A peer sending a longer one is dropped.
+   */
+  size_t max_message = 1 << 26;
+
+
+  /**
+   * @brief The most a session will hold of what the peer has sent, but that hasn't been handled.
+   * @remarks Otherwise there's never more than a frame of it, which network::max_frame bounds; but nothing is
+   * handled while the pool is working, and a stream carries on meanwhile. A peer sending more is dropped.
+   */
+  size_t max_buffered = 1 << 26;
+
+
+  /**
+   * @brief Where a session is in the protocol.
+   * @var EXCHANGE: Answering the key exchange the peer started when it connected.
+   * @var READY: Waiting for the peer to ask for something.
+   * @var ROUNDS: Receiving a message; waiting on the key size.
+   * @var CIPHER: Receiving a message; waiting on the rest of the ciphertext.
+   * @var TAG: Receiving a message; waiting on the NONCE/IV/EMPTY packet.
+   * @var DIGEST: Receiving a message; waiting on the rest of the HMAC.
+   * @var WORKING: Waiting on the pool, which is generating, answering, or finishing an exchange, or waiting on
+   * the next keys of a stream.
+   * @var COLLECTING: Waiting on the peer's half of that re-exchange.
+   * @var AWAITING: Waiting on the peer to accept a message we want to send.
+   * @var ROTATING: Receiving a stream; waiting on the peer's offer of the next key.
+   */
+  typedef enum {
+    EXCHANGE, READY, ROUNDS, CIPHER, TAG, DIGEST, WORKING, COLLECTING, AWAITING, ROTATING,
+  } phase;
+
+
+  /**
+   * @brief A connection to a single peer.
+   * @remarks A session is fed whatever bytes have arrived, and queues whatever it wants to send; it
+   * never touches the socket itself. See engine for what drives it.
+   */
+  class session {
+  public:
+
+    // A handler, given the session and a decrypted message.
+    typedef std::function<void(session&, const std::string&)> handler;
+
+  private:
+
+    // The values of an exchange, which the pool fills in: our half of it, the frame we send, and the key it gives.
+    struct parameters {
+      exchange::secret ours;
+      network::packet reply;
+      std::array<uint64_t, 4> shared = {};
+      util::keyring keys;
+      std::string error;
+      std::atomic<bool> ready = false;
+    };
+
+    // A message we've been asked to send, while the peer decides whether to accept it.
+    struct outgoing {
+      std::string message;
+      uint64_t Nr;
+      mode m;
+    };
+
+    int fd;
+    int wake;
+    uint64_t id;
+    phase at = EXCHANGE;
+
+    // The shared key, and the nonces of the messages we send.
+    util::keyring keys;
+
+    // The keys of a stream the peer is sending, which it may rotate, and those of the message being received.
+    pipeline::epochs rings{keys};
+    const util::keyring* under = &keys;
+
+    // Whatever has arrived but not been handled, and whatever is waiting to go out.
+    std::string input, output;
+
+    // The values of an exchange the pool is working on, or we're waiting to finish, and what to do once it's done.
+    std::shared_ptr<parameters> generated;
+    std::function<void(std::shared_ptr<parameters>)> then;
+
+    // The message being received.
+    uint64_t Nr = 0;
+    std::string cipher, hmac;
+
+    // The NONCE/EMPTY packet of the message being received, until its HMAC arrives.
+    network::packet input_tag;
+
+    // The window of a stream the peer is sending, or 0 if it isn't, and how many of its messages have arrived.
+    uint64_t window = 0, streamed = 0;
+
+    std::deque<outgoing> queue;
+
+
+    // Queue a packet to be sent.
+    void queue_packet(const network::packet& p) {
+      char head[network::MAX_HEADER];
+      output.append(head, network::header(p, head));
+      output += p.data;
+    }
+
+
+    // Queue a string, as network::send_string would send it.
+    void queue_string(const std::string& message) {
+      size_t x = 0;
+      for (; message.length() - x > network::max_frame; x += network::max_frame)
+        queue_packet({.m = network::meta::DATA, .data = message.substr(x, network::max_frame)});
+      queue_packet({.m = network::meta::FINAL, .data = message.substr(x)});
+    }
+
+
+    /**
+     * @brief Decrypt the message we've received, and hand it over.
+     * @param tag: The NONCE/IV/EMPTY packet.
+     * @param received: The handler.
+     * @throws std::runtime_error If the HMAC or tag doesn't match, or the padding is wrong.
+     * @remarks This is what util::receive_message does.
+     */
+    void deliver(const network::packet& tag, const handler& received) {
+      const auto& ctx = under->get(Nr);
+      if (tag.m == network::meta::IV) {
+        received(*this, util::open(cipher, ctx, tag));
+        return;
+      }
+      if (hmac != under->get_mac(Nr).generate(cipher)) throw std::runtime_error("HMAC does not match! Message has been altered!");
+      if (tag.m == network::meta::NONCE) received(*this, aes::Ctr(cipher, ctx, network::unpack<uint64_t>(tag)));
+      else received(*this, aes::InvCipher(cipher, ctx));
+    }
+
+
+    /**
+     * @brief Hand over the message we've received, and acknowledge it if it ends a window of a stream.
+     * @param tag: The NONCE/IV/EMPTY packet.
+     * @param received: The handler.
+     * @throws std::runtime_error If the message failed to decrypt; see deliver.
+     */
+    void finish(const network::packet& tag, const handler& received) {
+      at = READY;
+      deliver(tag, received);
+      if (window != 0 && ++streamed % window == 0) queue_packet(network::pack(streamed, network::meta::ACK));
+    }
+
+
+    // Start sending the next message, if there is one and we're free to. The peer isn't listening during a stream.
+    void next() {
+      if (at == READY && window == 0 && !queue.empty()) {
+        queue_packet({.m = network::meta::MESSAGE});
+        at = AWAITING;
+      }
+    }
+
+
+    // The peer accepted a message: send the rest of it, as util::send_message does.
+    void send_accepted() {
+      const auto out = std::move(queue.front());
+      queue.pop_front();
+
+      const auto& ctx = keys.get(out.Nr);
+      queue_packet(network::pack<uint64_t>(out.Nr));
+
+      // GCM takes a single IV, and carries its own tag.
+      if (out.m == GCM) {
+        const auto iv = keys.get_nonces().next();
+        queue_string(aes::gcm::Enc(out.message, ctx, iv));
+        queue_packet(nonce::pack(iv));
+        return;
+      }
+
+      // CTR takes a counter for every block. ECB and CTR are encrypted, HMACed, and queued a frame at a
+      // time; see util::seal.
+      const auto used = out.m == CTR ? keys.get_nonces().reserve(out.message.length() / 16 + 1) : 0;
+      const auto queue_frame = [this](const network::packet& p) {queue_packet(p); return true;};
+      const auto mac = util::seal(out.message, ctx, keys.get_mac(out.Nr), out.m == CTR, used, queue_frame);
+      if (out.m == CTR) queue_packet(network::pack(used, network::meta::NONCE));
+      else queue_packet({.m = network::meta::EMPTY});
+      queue_string(mac);
+    }
+
+
+    /**
+     * @brief Run part of an exchange on the pool, so the event loop carries on with other peers meanwhile.
+     * @param values: What the pool works on.
+     * @param work: The work, which runs on the pool, and so mustn't touch the session.
+     * @param after: What to do with the values once they're ready, which runs on the event loop; see resume.
+     * @remarks Every step of an exchange raises numbers thousands of bits wide, which takes milliseconds;
+     * on the event loop, a burst of peers connecting would stall every other one. Nothing more from this
+     * peer is handled until the work is done.
+     */
+    void offload(std::shared_ptr<parameters> values, std::function<void(parameters&)> work, std::function<void(std::shared_ptr<parameters>)> after) {
+      at = WORKING;
+      generated = values;
+      then = std::move(after);
+      pool::shared().submit([values, work = std::move(work), wake = wake]() {
+        try {work(*values);}
+        catch (std::runtime_error& e) {values->error = e.what();}
+        values->ready = true;
+        const uint64_t one = 1;
+        if (write(wake, &one, sizeof(one))) {}
+      });
+    }
+
+
+    // Generate the values for a re-exchange the peer asked for, and offer them.
+    void generate() {
+      offload(std::make_shared<parameters>(), [](parameters& v) {v.reply = v.ours.offer();}, [this](std::shared_ptr<parameters> v) {
+        queue_packet(v->reply);
+        generated = std::move(v);
+        at = COLLECTING;
+      });
+    }
+
+
+    /**
+     * @brief Handle a single packet from the peer.
+     * @param p: The packet.
+     * @param received: The handler for messages.
+     * @throws std::runtime_error If the peer broke the protocol, or a message failed to decrypt.
+     */
+    void handle(const network::packet& p, const handler& received) {
+      switch (at) {
+
+        // The peer offers its half of the exchange; we answer with ours. See exchange::handshake.
+        case EXCHANGE:
+          offload(std::make_shared<parameters>(), [offer = p, epoch = keys.get_epoch() + 1](parameters& v) {
+            v.reply = v.ours.answer(offer, v.shared);
+            v.keys.set(v.shared, epoch);
+          }, [this](std::shared_ptr<parameters> v) {
+            queue_packet(v->reply);
+            keys = std::move(v->keys);
+          });
+          return;
+
+        case READY:
+          switch (p.m) {
+            case network::meta::MESSAGE:
+              if (p.data.empty()) {queue_packet({.m = network::meta::ACK}); under = &keys; at = ROUNDS; return;}
+
+              // A stream starts with its window, and then each message carries its number, and Nr. See pipeline.
+              if (window != 0) {
+                const auto [sequence, rounds, epoch] = network::unpack<std::array<uint64_t, 3>>(p);
+                if (sequence != streamed) throw std::runtime_error("Peer sent message out of order!");
+                Nr = rounds;
+                under = &rings.get(epoch, sequence);
+                under->get(Nr);
+                cipher.clear();
+                at = CIPHER;
+                return;
+              }
+              window = std::min(network::unpack<uint64_t>(p), pipeline::max_window);
+              if (window == 0) throw std::runtime_error("Peer sent invalid window!");
+              streamed = 0;
+              queue_packet(network::pack(window, network::meta::ACK));
+              return;
+
+            // The end of a stream.
+            case network::meta::FINAL:
+              if (window == 0 || network::unpack<uint64_t>(p) != streamed) throw std::runtime_error("Peer sent an invalid request!");
+              queue_packet(network::pack(streamed, network::meta::FINAL));
+              rings.end();
+              under = &keys;
+              window = 0;
+              return;
+
+            // During a stream, the peer rotates the key, offering the next one, and then saying which message it's
+            // from. Otherwise, whoever accepts a re-exchange generates the new values; see main.
+            case network::meta::REEXCHANGE:
+              if (window == 0) {queue_packet({.m = network::meta::ACK}); generate(); return;}
+              if (p.data.empty()) {at = ROTATING; return;}
+              if (network::unpack<uint64_t>(p) != streamed) throw std::runtime_error("Peer switched keys out of order!");
+
+              // The next keys are almost always ready; if not, the pool waits on them, rather than the loop.
+              if (rings.ready()) rings.rotate(streamed);
+              else offload(std::make_shared<parameters>(), [wait = rings.waiter()](parameters&) {wait();}, [this, sequence = streamed](std::shared_ptr<parameters>) {
+                rings.rotate(sequence);
+              });
+              return;
+            default: throw std::runtime_error("Peer sent an invalid request!");
+          }
+
+        case ROUNDS:
+          Nr = network::unpack<uint64_t>(p);
+          keys.get(Nr);
+          cipher.clear();
+          at = CIPHER;
+          return;
+
+        case CIPHER:
+          if (cipher.length() + p.data.length() > max_message) throw std::runtime_error("Peer sent a message that's too long!");
+          cipher += p.data;
+          if (p.m == network::meta::FINAL) at = TAG;
+          return;
+
+        case TAG:
+          if (p.m == network::meta::IV) {
+            finish(p, received);
+            return;
+          }
+          if (p.m != network::meta::NONCE && p.m != network::meta::EMPTY) throw std::runtime_error("Peer sent invalid packet!");
+          input_tag = p;
+          hmac.clear();
+          at = DIGEST;
+          return;
+
+        // An HMAC always fits in a single frame.
+        case DIGEST:
+          if (hmac.length() + p.data.length() > network::max_frame) throw std::runtime_error("Peer sent an HMAC that's too long!");
+          hmac += p.data;
+          if (p.m == network::meta::FINAL) finish(input_tag, received);
+          return;
+
+        // The answer is made on the pool, and then the next keys are prepared there too; see pipeline::epochs.
+        case ROTATING:
+          offload(std::make_shared<parameters>(), [offer = p](parameters& v) {v.reply = v.ours.answer(offer, v.shared);}, [this](std::shared_ptr<parameters> v) {
+            queue_packet(v->reply);
+            rings.prepare(v->shared);
+          });
+          return;
+
+        // The peer shouldn't say anything until it has our values.
+        case WORKING: throw std::runtime_error("Peer sent a packet during the exchange!");
+
+        case COLLECTING:
+          offload(generated, [answer = p, epoch = keys.get_epoch() + 1](parameters& v) {v.keys.set(v.ours.finish(answer), epoch);}, [this](std::shared_ptr<parameters> v) {
+            keys = std::move(v->keys);
+          });
+          return;
+
+        case AWAITING:
+          switch (p.m) {
+            case network::meta::ACK: send_accepted(); at = READY; return;
+            case network::meta::REFUSED: queue.pop_front(); at = READY; return;
+
+            // The peer tried to send at the same time; it gives up when it sees our MESSAGE, so
+            // we do the same, and try ours again.
+            case network::meta::MESSAGE: at = READY; return;
+            default: throw std::runtime_error("Peer gave invalid response!");
+          }
+      }
+    }
+
+  public:
+
+    /**
+     * @brief Start a session on a new connection.
+     * @param fd: The connection.
+     * @param wake: An eventfd to write to once the pool has finished something for this session.
+     * @param id: A number for the session, unique for the life of its engine.
+     */
+    session(const int& fd, const int& wake, const uint64_t& id) : fd(fd), wake(wake), id(id) {}
+
+
+    /**
+     * @brief Take whatever has arrived from the peer, and handle every whole packet in it.
+     * @param bytes: The bytes.
+     * @param received: The handler for messages.
+     * @throws std::runtime_error If the peer broke the protocol, sent more than max_buffered, or a message
+     * failed to decrypt.
+     */
+    void receive(std::string_view bytes, const handler& received) {
+      if (input.length() + bytes.length() > max_buffered) throw std::runtime_error("Peer sent too much at once!");
+      input += bytes;
+
+      size_t done = 0;
+      network::packet p;
+      for (size_t used; at != WORKING && (used = network::parse(std::string_view(input).substr(done), p)) > 0; done += used) {
+        handle(p, received);
+        next();
+      }
+      input.erase(0, done);
+    }
+
+
+    /**
+     * @brief Carry on once the pool has finished with an exchange.
+     * @param received: The handler, for anything that arrived meanwhile.
+     * @returns Whether the values were ready.
+     * @throws std::runtime_error If the exchange failed, such as on a malformed offer.
+     * @remarks Whatever arrived meanwhile may start more work on the pool, leaving the session WORKING again.
+     */
+    bool resume(const handler& received) {
+      if (at != WORKING || !generated->ready) return false;
+
+      auto values = std::move(generated);
+      if (!values->error.empty()) throw std::runtime_error(values->error);
+      at = READY;
+      std::exchange(then, {})(std::move(values));
+      next();
+      receive({}, received);
+      return true;
+    }
+
+
+    /**
+     * @brief Send the peer a message.
+     * @param message: The message.
+     * @param Nr: The number of rounds, which picks the key size.
+     * @param m: The mode.
+     * @throws std::runtime_error If the Nr rounds is not 10,12,14.
+     * @remarks The message goes out once the peer accepts it, after any others already waiting.
+     * @warning Only call this from the engine's thread, such as from a handler, or through engine::post.
+     */
+    void send(const std::string& message, const uint64_t& Nr, const mode& m) {
+      keys.get(Nr);
+      queue.push_back({message, Nr, m});
+      next();
+    }
+
+
+    /**
+     * @brief Take what's waiting to be sent.
+     * @returns The bytes, which the caller must send in order before anything else.
+     */
+    std::string& pending() {return output;}
+
+
+    // Getters
+    const auto& get_fd() const {return fd;}
+    const auto& get_id() const {return id;}
+    const auto& get_phase() const {return at;}
+    const auto& get_keys() const {return keys;}
+  };
+
+
+  /**
+   * @brief An epoll loop that accepts peers, and drives a session for each.
+   */
+  class engine {
+  private:
+    int sock = -1, events = -1, wake = -1;
+    uint64_t sessions_started = 0;
+    std::unordered_map<int, std::unique_ptr<session>> sessions;
+    std::unordered_set<int> waiting;
+
+    // Sessions that may have something to send, and the ring to send it with, if the kernel has io_uring.
+    std::unordered_set<int> dirty;
+    std::unique_ptr<uring::ring> ring;
+    session::handler received;
+    std::function<void(session&, const std::string&)> failed;
+
+    // Tasks from other threads, which run on the loop.
+    std::mutex lock;
+    std::vector<std::function<void()>> posted;
+    std::atomic<bool> stopping = false;
+
+
+    // Watch a descriptor.
+    void watch(const int& fd, const uint32_t& flags, const int& op = EPOLL_CTL_ADD) {
+      struct epoll_event event = {.events = flags, .data = {.fd = fd}};
+      epoll_ctl(events, op, fd, &event);
+    }
+
+
+    // Hang up on a peer.
+    void drop(const int& fd) {
+      epoll_ctl(events, EPOLL_CTL_DEL, fd, nullptr);
+      close(fd);
+      sessions.erase(fd);
+      waiting.erase(fd);
+      dirty.erase(fd);
+    }
+
+
+    // Accept every peer that is waiting.
+    void accept_all() {
+      while (true) {
+        const int fd = accept4(sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) return;
+        sessions.emplace(fd, std::make_unique<session>(fd, wake, sessions_started++));
+        watch(fd, EPOLLIN | EPOLLRDHUP);
+      }
+    }
+
+
+    /**
+     * @brief Send as much of what every session touched since the last flush has waiting, as their sockets take.
+     * @remarks With a ring, the sends for every session go to the kernel in a single syscall, rather than one
+     * each. Whatever doesn't fit waits for the socket to drain, which epoll tells us.
+     */
+    void flush() {
+      std::vector<int> broken;
+      auto sent = [this, &broken](const int& fd, const ssize_t& n) {
+        if (n > 0) sessions.at(fd)->pending().erase(0, n);
+        else if (n < 0 && n != -EAGAIN && n != -EINTR) broken.push_back(fd);
+      };
+
+      if (ring) {
+        size_t count = 0;
+        for (const auto& fd : dirty) {
+          const auto& out = sessions.at(fd)->pending();
+          if (out.empty()) continue;
+          ring->send(fd, out.data(), out.size(), MSG_NOSIGNAL, fd);
+          ++count;
+        }
+        for (uint64_t fd; count; --count) {
+          const auto n = ring->wait(fd);
+          sent(fd, n);
+        }
+      }
+
+      else for (const auto& fd : dirty) {
+        auto& out = sessions.at(fd)->pending();
+        while (!out.empty()) {
+          const auto n = ::send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+          sent(fd, n == -1 ? -errno : n);
+          if (n <= 0) break;
+        }
+      }
+
+      for (const auto& fd : broken) drop(fd);
+      for (const auto& fd : dirty) watch(fd, EPOLLIN | EPOLLRDHUP | (sessions.at(fd)->pending().empty() ? 0 : EPOLLOUT), EPOLL_CTL_MOD);
+      dirty.clear();
+    }
+
+
+    // Read everything that has arrived for a session, and move it along.
+    bool serve(session& s) {
+      char buffer[1 << 16];
+      while (true) {
+        const auto n = recv(s.get_fd(), buffer, sizeof(buffer), 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) break;
+        if (n <= 0) return false;
+        try {s.receive(std::string_view(buffer, n), received);}
+        catch (std::runtime_error& e) {
+          if (failed) failed(s, e.what());
+          return false;
+        }
+      }
+      if (s.get_phase() == WORKING) waiting.insert(s.get_fd());
+      return true;
+    }
+
+
+    // Run whatever other threads have posted, and resume the sessions the pool has finished with.
+    void wakeup() {
+      uint64_t count;
+      if (read(wake, &count, sizeof(count))) {}
+
+      std::vector<std::function<void()>> tasks;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.swap(posted);
+      }
+      for (auto& task : tasks) task();
+
+      for (auto it = waiting.begin(); it != waiting.end();) {
+        auto& s = *sessions.at(*it);
+        bool ok = true;
+        try {if (!s.resume(received)) {++it; continue;}}
+        catch (std::runtime_error& e) {
+          if (failed) failed(s, e.what());
+          ok = false;
+        }
+        const int fd = *it;
+        if (ok && s.get_phase() == WORKING) {
+          dirty.insert(fd);
+          ++it;
+          continue;
+        }
+        it = waiting.erase(it);
+        if (ok) dirty.insert(fd);
+        else drop(fd);
+      }
+    }
+
+
+  public:
+
+    /**
+     * @brief Listen for peers.
+     * @param port: The port to listen on.
+     * @param received: Called with every message a peer sends, once decrypted.
+     * @param failed: Called when a peer is dropped for breaking the protocol, or a message won't decrypt.
+     * @throws std::runtime_error If the port can't be listened on.
+     */
+    engine(const int& port, session::handler received, std::function<void(session&, const std::string&)> failed = {}) : received(std::move(received)), failed(std::move(failed)) {
+      sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      const int one = 1;
+      setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+      sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = {.s_addr = INADDR_ANY}
+      };
+      if (sock == -1 || bind(sock, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(sock, SOMAXCONN) == -1) {
+        if (sock != -1) close(sock);
+        throw std::runtime_error("Failed to listen on port " + std::to_string(port));
+      }
+
+      events = epoll_create1(EPOLL_CLOEXEC);
+      wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      watch(sock, EPOLLIN);
+      watch(wake, EPOLLIN);
+
+      if (uring::supported()) {
+        try {ring = std::make_unique<uring::ring>(256);}
+        catch (std::runtime_error&) {}
+      }
+    }
+
+
+    // Hang up on every peer.
+    ~engine() {
+      for (auto& [fd, s] : sessions) close(fd);
+      close(sock);
+      close(events);
+      close(wake);
+    }
+
+
+    /**
+     * @brief Run a task on the engine's thread.
+     * @param task: The task.
+     * @remarks This is safe to call from any thread; it's how other threads reach a session.
+     */
+    void post(std::function<void()> task) {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        posted.emplace_back(std::move(task));
+      }
+      const uint64_t one = 1;
+      if (write(wake, &one, sizeof(one))) {}
+    }
+
+
+    // Stop run, from any thread.
+    void stop() {
+      stopping = true;
+      post([]() {});
+    }
+
+
+    /**
+     * @brief Find a session.
+     * @param id: The session's id.
+     * @returns The session, or nullptr if it has hung up.
+     * @warning Only call this from the engine's thread.
+     */
+    session* find(const uint64_t& id) {
+      for (auto& [fd, s] : sessions) if (s->get_id() == id) return s.get();
+      return nullptr;
+    }
+
+
+    /**
+     * @brief Send a message to a peer.
+     * @param s: The peer's session.
+     * @param message: The message.
+     * @param Nr: The number of rounds.
+     * @param m: The mode.
+     * @remarks The request goes out with everything else once the events at hand are handled; see flush.
+     * @warning Only call this from the engine's thread.
+     */
+    void send(session& s, const std::string& message, const uint64_t& Nr, const mode& m) {
+      s.send(message, Nr, m);
+      dirty.insert(s.get_fd());
+    }
+
+
+    /**
+     * @brief Serve peers until stop is called.
+     */
+    void run() {
+      struct epoll_event ready[64];
+      while (!stopping) {
+        const int count = epoll_wait(events, ready, 64, -1);
+        for (int x = 0; x < count; ++x) {
+          const int fd = ready[x].data.fd;
+          if (fd == sock) accept_all();
+          else if (fd == wake) wakeup();
+          else if (sessions.count(fd)) {
+            auto& s = *sessions.at(fd);
+            const auto flags = ready[x].events;
+
+            // Read whatever is left before noticing a hangup, since the peer may have said something first.
+            bool ok = !(flags & EPOLLERR);
+            if (ok && (flags & (EPOLLIN | EPOLLRDHUP))) ok = serve(s) && !(flags & EPOLLHUP);
+            if (ok) dirty.insert(fd);
+            else drop(fd);
+          }
+        }
+        flush();
+      }
+    }
+
+
+    // Getter.
+    size_t size() const {return sessions.size();}
+  };
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <sys/mman.h>   // To load the file.
+#include <sys/stat.h>   // To find how long it is.
+#include <fcntl.h>      // To open it.
+#include <unistd.h>     // To close it.
+#include <cstdio>       // For std::rename
+#include <fstream>      // To save the file.
+#include <string>       // For the path.
+#include <deque>        // For the groups.
+#include <thread>       // For the refill thread.
+#include <mutex>        // For std::mutex
+#include <condition_variable> // To wake the refill thread.
+#include <algorithm>    // For std::equal
+
+#include "exchange.h"   // To generate groups.
+
+/**
+ * @brief A store of Diffie-Hellman groups, generated ahead of time.
+ * @remarks Generating p and g is by far the slowest part of a handshake: prime::generate sieves for a
+ * safe prime, and exchange::parameters then searches for h. None of it depends on the
+ * peer, so a store keeps groups ready, and a thread in the background replaces them as handshakes use them
+ * up. The groups are kept in a file between runs, so even the first handshake doesn't wait.
+ * @remarks Each group is only handed out once, just as each handshake would otherwise generate its own.
+ */
+namespace store {
+
+  /**
+   * @brief A single group.
+   * @var p: The safe prime.
+   * @var g: The generator.
+   */
+  typedef struct {
+    uint64_t p, g;
+  } group;
+
+
+  /**
+   * @brief What a store's file begins with.
+   * @remarks The magic is followed by how many groups there are, and then the groups themselves, all in the
+   * host's byte order, since the file never leaves the machine.
+   */
+  constexpr char MAGIC[8] = {'D', 'H', 'G', 'R', 'O', 'U', 'P', 'S'};
+
+
+  /**
+   * @brief Check that a group is one exchange::parameters could have made.
+   * @param x: The group.
+   * @returns Whether p is a safe prime, and g generates its subgroup of order q.
+   * @remarks The file could have been damaged, or replaced, so we don't take its groups on faith. Our primes
+   * are small enough that checking them this way is quick.
+   */
+  inline bool valid(const group& x) {
+    if (x.p < 5 || x.p % 2 == 0 || x.g <= 1 || x.g >= x.p) return false;
+    const auto q = (x.p - 1) / 2;
+    return prime::is(x.p) && prime::is(q) && prime::raise(x.g, q, x.p) == 1;
+  }
+
+
+  /**
+   * @brief Groups ready for handshakes, and a thread to keep them topped up.
+   */
+  class cache {
+  private:
+    std::string path;
+    size_t target;
+    std::deque<group> groups;
+
+    std::mutex lock;
+    std::condition_variable wanted;
+    bool stopping = false;
+    std::thread refiller;
+
+
+    // Read the groups saved in the file, if there are any.
+    void load() {
+      const int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (file == -1) return;
+
+      struct stat info;
+      if (fstat(file, &info) == 0 && size_t(info.st_size) >= sizeof(MAGIC) + sizeof(uint64_t)) {
+        auto* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data != MAP_FAILED) {
+          const auto* bytes = static_cast<const char*>(data);
+          uint64_t count;
+          std::copy_n(bytes + sizeof(MAGIC), sizeof(count), reinterpret_cast<char*>(&count));
+
+          // Anything that doesn't add up is ignored; we'll just generate new groups.
+          if (std::equal(MAGIC, MAGIC + sizeof(MAGIC), bytes) && count == (info.st_size - sizeof(MAGIC) - sizeof(count)) / sizeof(group)) {
+            for (uint64_t x = 0; x < count; ++x) {
+              group next;
+              std::copy_n(bytes + sizeof(MAGIC) + sizeof(count) + x * sizeof(group), sizeof(group), reinterpret_cast<char*>(&next));
+              if (valid(next)) groups.push_back(next);
+            }
+          }
+          munmap(data, info.st_size);
+        }
+      }
+      close(file);
+    }
+
+
+    /**
+     * @brief Write groups to the file.
+     * @param snapshot: A copy of the groups, taken under the lock.
+     * @remarks They're written to a temporary file first, and then moved over the old one, so a crash halfway
+     * through never leaves a file that's only partly written.
+     * @remarks The lock mustn't be held: writing the file can take a while, and take mustn't wait on it.
+     * Only the refill thread, and the destructor once it has stopped, ever save, so two never race for the
+     * temporary file.
+     */
+    void save(const std::deque<group>& snapshot) const {
+      const auto temporary = path + ".tmp";
+      {
+        std::ofstream out(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        const uint64_t count = snapshot.size();
+        out.write(MAGIC, sizeof(MAGIC));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (const auto& x : snapshot) out.write(reinterpret_cast<const char*>(&x), sizeof(group));
+        if (!out) return;
+      }
+      std::rename(temporary.c_str(), path.c_str());
+    }
+
+
+    // Generate groups whenever there are fewer than the target, and save them once there are enough.
+    void refill() {
+      std::unique_lock<std::mutex> guard(lock);
+      while (true) {
+        wanted.wait(guard, [this]() {return stopping || groups.size() < target;});
+        if (stopping) return;
+
+        // Generating takes a while, so let handshakes take what's already there meanwhile.
+        guard.unlock();
+        const auto [p, g] = exchange::parameters();
+        guard.lock();
+
+        groups.push_back({p, g});
+        if (groups.size() >= target) {
+          const auto snapshot = groups;
+          guard.unlock();
+          save(snapshot);
+          guard.lock();
+        }
+      }
+    }
+
+  public:
+
+    /**
+     * @brief Load the groups saved at a path, and start keeping them topped up.
+     * @param path: The file to keep the groups in. It's created if it doesn't exist.
+     * @param target: How many groups to keep ready.
+     */
+    cache(const std::string& path, const size_t& target = 16) : path(path), target(target) {
+      load();
+      refiller = std::thread([this]() {refill();});
+    }
+
+    cache(const cache&) = delete;
+    cache& operator=(const cache&) = delete;
+
+
+    // Stop refilling, and save what's left for next time.
+    ~cache() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+      }
+      wanted.notify_all();
+      refiller.join();
+
+      std::unique_lock<std::mutex> guard(lock);
+      const auto snapshot = groups;
+      guard.unlock();
+      save(snapshot);
+    }
+
+
+    /**
+     * @brief Take a group for a handshake.
+     * @returns The prime p, and the generator g, as exchange::parameters returns them.
+     * @remarks If the store has run dry, the group is generated on the spot, as it would be without one.
+     * @remarks This is safe to call from any thread.
+     */
+    std::pair<uint64_t, uint64_t> take() {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!groups.empty()) {
+          const auto next = groups.front();
+          groups.pop_front();
+          wanted.notify_one();
+          return {next.p, next.g};
+        }
+      }
+      return exchange::parameters();
+    }
+
+
+    // Getter.
+    size_t size() {
+      std::lock_guard<std::mutex> guard(lock);
+      return groups.size();
+    }
+  };
+}
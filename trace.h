@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>   // For the counters.
+#include <array>    // For a counter per phase.
+#include <cstdint>  // For fixed width integers.
+#include <chrono>   // For time, without a cycle counter.
+#include <sstream>  // For the report.
+#include <iomanip>  // For formatting it.
+#include <string>   // For the report.
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#endif
+
+/**
+ * @brief Counters for where the time of each call goes.
+ * @remarks Define TRACE to count every call of the hot paths: expanding keys (SCHEDULE), encrypting and
+ * decrypting (ENCRYPT), HMACs (MAC), and sending packets (SEND), with how many bytes each call took and
+ * how many cycles it spent. Without TRACE, the macros are empty, and nothing is counted at all.
+ * @remarks Only the outermost traced call on a thread counts, so a string function that calls the span
+ * function isn't counted twice, and neither are the chunks pool::parallel_for hands to other threads,
+ * which the call that split them already covers.
+ * @remarks The counters are atomic, so they can be read from any thread, such as to export them; see report.
+ */
+namespace trace {
+
+  /**
+   * @brief What a call does.
+   * @var SCHEDULE: Deriving a key schedule, or an HMAC key.
+   * @var ENCRYPT: Encrypting or decrypting, in any mode.
+   * @var MAC: Generating an HMAC.
+   * @var SEND: Sending a packet.
+   */
+  typedef enum {SCHEDULE, ENCRYPT, MAC, SEND, PHASES} phase;
+
+
+  // The names of each phase, for the report.
+  constexpr const char* names[PHASES] = {"schedule", "encrypt", "mac", "send"};
+
+
+  /**
+   * @brief The totals for a phase.
+   */
+  struct counter {
+    std::atomic<uint64_t> calls = 0, bytes = 0, cycles = 0;
+  };
+  inline std::array<counter, PHASES> counters;
+
+
+  // How deep the current thread is in traced calls.
+  inline thread_local size_t depth = 0;
+
+
+  /**
+   * @brief Read the cycle counter.
+   * @returns The count.
+   * @remarks On x86, this is the timestamp counter, which ticks at a fixed rate, rather than the core's own
+   * clock; elsewhere, it's nanoseconds.
+   */
+  inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+
+  /**
+   * @brief Counts a call, from when it's made until it goes out of scope.
+   */
+  class scope {
+  private:
+    phase p;
+    uint64_t bytes, start;
+    bool outer;
+
+  public:
+
+    /**
+     * @brief Start counting.
+     * @param p: What the call does.
+     * @param bytes: How many bytes it's given.
+     */
+    scope(const phase& p, const uint64_t& bytes) : p(p), bytes(bytes), start(0), outer(depth++ == 0) {
+      if (outer) start = cycles();
+    }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+    ~scope() {
+      --depth;
+      if (!outer) return;
+      auto& c = counters[p];
+      c.cycles.fetch_add(cycles() - start, std::memory_order_relaxed);
+      c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+      c.calls.fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+
+
+  /**
+   * @brief Marks work as part of a call that's already counted, so that nothing within it counts again.
+   */
+  class inside {
+  public:
+    inside() {++depth;}
+    ~inside() {--depth;}
+    inside(const inside&) = delete;
+    inside& operator=(const inside&) = delete;
+  };
+
+
+  // Zero every counter.
+  inline void reset() {
+    for (auto& c : counters) c.calls = c.bytes = c.cycles = 0;
+  }
+
+
+  /**
+   * @brief Report the counters.
+   * @returns A line for each phase: its calls, bytes, cycles, and cycles per byte.
+   */
+  inline std::string report() {
+    std::ostringstream out;
+    out << std::left << std::setw(10) << "phase" << std::right << std::setw(14) << "calls" << std::setw(16) << "bytes"
+        << std::setw(18) << "cycles" << std::setw(12) << "cycles/B" << '\n';
+    for (size_t x = 0; x < PHASES; ++x) {
+      const auto& c = counters[x];
+      const uint64_t bytes = c.bytes, cycles = c.cycles;
+      out << std::left << std::setw(10) << names[x] << std::right << std::setw(14) << c.calls << std::setw(16) << bytes
+          << std::setw(18) << cycles << std::setw(12) << std::fixed << std::setprecision(2) << (bytes ? double(cycles) / bytes : 0.0) << '\n';
+    }
+    return out.str();
+  }
+}
+
+
+// Count the rest of the enclosing block as a call, with TRACE.
+#ifdef TRACE
+  #define TRACE_SCOPE(p, bytes) trace::scope trace_scope(trace::p, bytes)
+  #define TRACE_INSIDE() trace::inside trace_inside
+#else
+  #define TRACE_SCOPE(p, bytes)
+  #define TRACE_INSIDE()
+#endif
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <linux/io_uring.h> // For the ring's layout.
+#include <sys/syscall.h>    // There's no library for io_uring here, so we make the calls ourselves.
+#include <sys/mman.h>       // To map the ring.
+#include <sys/uio.h>        // For struct iovec.
+#include <unistd.h>         // For syscall and close.
+#include <cerrno>           // For errno.
+#include <cstdint>          // For fixed width integers.
+#include <cstring>          // For std::memset
+#include <algorithm>        // For std::max
+#include <atomic>           // For the ordering of the ring's head and tail.
+#include <span>             // For the registered buffers.
+#include <stdexcept>        // For exceptions.
+
+/**
+ * @brief A minimal interface to io_uring, for the file and socket paths.
+ * @remarks Every read, write, and send is normally its own syscall, and the caller waits for it
+ * to finish. io_uring is a pair of queues shared with the kernel: we put requests on one, the
+ * kernel puts their results on the other, and a single syscall can both submit any number of
+ * requests and wait for any number of results. That lets the caller keep reading and writing in
+ * flight while it does something else, such as encrypt.
+ * @remarks The kernel may not have io_uring, or may forbid it, so everything that uses a ring
+ * checks supported first, and falls back to the plain syscalls otherwise.
+ */
+namespace uring {
+
+  /**
+   * @brief A submission and completion queue.
+   */
+  class ring {
+  private:
+    int fd = -1;
+    io_uring_params params;
+
+    // The mapped queues, and the array of submissions.
+    void* sq = MAP_FAILED;
+    void* cq = MAP_FAILED;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+
+    // Pointers into the queues. The kernel moves sq_head and cq_tail; we move the others.
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe* cqes;
+
+    // Submissions we've queued but not yet told the kernel about.
+    unsigned queued = 0;
+
+
+    // The kernel reads the tail, and writes the head, from another thread, in effect.
+    static unsigned load(unsigned* value) {return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire);}
+    static void store(unsigned* value, const unsigned& to) {std::atomic_ref<unsigned>(*value).store(to, std::memory_order_release);}
+
+
+    // Get a free submission, submitting what's queued if there isn't one.
+    io_uring_sqe* next() {
+      const auto tail = *sq_tail;
+      if (tail - load(sq_head) == params.sq_entries) {
+        submit();
+        if (tail - load(sq_head) == params.sq_entries) throw std::runtime_error("The submission queue is full!");
+      }
+
+      const auto index = tail & *sq_mask;
+      auto* sqe = &sqes[index];
+      std::memset(sqe, 0, sizeof(io_uring_sqe));
+      sq_array[index] = index;
+      store(sq_tail, tail + 1);
+      ++queued;
+      return sqe;
+    }
+
+
+    // Fill out a submission for a read or write.
+    io_uring_sqe* prepare(const uint8_t& op, const int& file, const void* data, const size_t& length, const uint64_t& offset, const uint64_t& user) {
+      auto* sqe = next();
+      sqe->opcode = op;
+      sqe->fd = file;
+      sqe->addr = reinterpret_cast<uint64_t>(data);
+      sqe->len = length;
+      sqe->off = offset;
+      sqe->user_data = user;
+      return sqe;
+    }
+
+
+    // Tear down whatever has been set up.
+    void release() {
+      if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+      if (cq != MAP_FAILED && cq != sq) munmap(cq, cq_size);
+      if (sq != MAP_FAILED) munmap(sq, sq_size);
+      if (fd != -1) close(fd);
+    }
+
+  public:
+
+    /**
+     * @brief Set up a ring.
+     * @param entries: How many submissions can be queued at once.
+     * @throws std::runtime_error If the kernel refuses.
+     */
+    ring(const unsigned& entries) {
+      std::memset(&params, 0, sizeof(params));
+      fd = syscall(__NR_io_uring_setup, entries, &params);
+      if (fd == -1) throw std::runtime_error("io_uring is not available!");
+
+      // Newer kernels put both queues in a single mapping.
+      sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      if (params.features & IORING_FEAT_SINGLE_MMAP) sq_size = cq_size = std::max(sq_size, cq_size);
+
+      sq = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      cq = params.features & IORING_FEAT_SINGLE_MMAP ? sq : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+      sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+      if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        release();
+        throw std::runtime_error("Failed to map the ring!");
+      }
+
+      auto* s = static_cast<char*>(sq);
+      sq_head = reinterpret_cast<unsigned*>(s + params.sq_off.head);
+      sq_tail = reinterpret_cast<unsigned*>(s + params.sq_off.tail);
+      sq_mask = reinterpret_cast<unsigned*>(s + params.sq_off.ring_mask);
+      sq_array = reinterpret_cast<unsigned*>(s + params.sq_off.array);
+
+      auto* c = static_cast<char*>(cq);
+      cq_head = reinterpret_cast<unsigned*>(c + params.cq_off.head);
+      cq_tail = reinterpret_cast<unsigned*>(c + params.cq_off.tail);
+      cq_mask = reinterpret_cast<unsigned*>(c + params.cq_off.ring_mask);
+      cqes = reinterpret_cast<io_uring_cqe*>(c + params.cq_off.cqes);
+    }
+
+    ring(const ring&) = delete;
+    ring& operator=(const ring&) = delete;
+    ~ring() {release();}
+
+
+    /**
+     * @brief Pin buffers in the kernel, so reads and writes into them needn't map them each time.
+     * @param buffers: The buffers. Their index is what read and write take as index.
+     * @throws std::runtime_error If the kernel refuses, such as if it would pin too much memory.
+     * @remarks The buffers must outlive the ring, or be unregistered first.
+     */
+    void register_buffers(std::span<const iovec> buffers) {
+      if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) == -1)
+        throw std::runtime_error("Failed to register buffers!");
+    }
+
+
+    // Unpin the buffers.
+    void unregister_buffers() {syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);}
+
+
+    /**
+     * @brief Queue a read.
+     * @param file: The file to read from.
+     * @param data: Where to read to.
+     * @param length: How many bytes to read.
+     * @param offset: Where in the file to read from.
+     * @param user: A value to identify the read by, when it completes.
+     * @param index: The registered buffer data is in, or -1 if it isn't registered.
+     */
+    void read(const int& file, void* data, const size_t& length, const uint64_t& offset, const uint64_t& user, const int& index = -1) {
+      auto* sqe = prepare(index == -1 ? IORING_OP_READ : IORING_OP_READ_FIXED, file, data, length, offset, user);
+      if (index != -1) sqe->buf_index = index;
+    }
+
+
+    /**
+     * @brief Queue a write.
+     * @param file: The file to write to.
+     * @param data: What to write.
+     * @param length: How many bytes to write.
+     * @param offset: Where in the file to write to.
+     * @param user: A value to identify the write by, when it completes.
+     * @param index: The registered buffer data is in, or -1 if it isn't registered.
+     */
+    void write(const int& file, const void* data, const size_t& length, const uint64_t& offset, const uint64_t& user, const int& index = -1) {
+      auto* sqe = prepare(index == -1 ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED, file, data, length, offset, user);
+      if (index != -1) sqe->buf_index = index;
+    }
+
+
+    /**
+     * @brief Queue a send on a socket.
+     * @param file: The socket.
+     * @param data: What to send.
+     * @param length: How many bytes to send.
+     * @param flags: The flags, as for send.
+     * @param user: A value to identify the send by, when it completes.
+     */
+    void send(const int& file, const void* data, const size_t& length, const int& flags, const uint64_t& user) {
+      prepare(IORING_OP_SEND, file, data, length, 0, user)->msg_flags = flags;
+    }
+
+
+    /**
+     * @brief Tell the kernel about everything queued, and optionally wait for results.
+     * @param wait: How many completions to wait for.
+     * @throws std::runtime_error If the kernel refuses.
+     */
+    void submit(const unsigned& wait = 0) {
+      while (true) {
+        const auto done = syscall(__NR_io_uring_enter, fd, queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (done >= 0) {
+          queued -= done;
+          return;
+        }
+        if (errno != EINTR) throw std::runtime_error("Failed to submit to the ring!");
+      }
+    }
+
+
+    /**
+     * @brief Take a completion.
+     * @param user: Set to the value the request was queued with.
+     * @returns What the request returned, as its syscall would, but with -errno for errors.
+     * @remarks This submits anything queued, and waits if nothing has completed.
+     */
+    int32_t wait(uint64_t& user) {
+      auto head = *cq_head;
+      if (queued || head == load(cq_tail)) submit(head == load(cq_tail) ? 1 : 0);
+      while (head == load(cq_tail)) submit(1);
+
+      const auto& cqe = cqes[head & *cq_mask];
+      user = cqe.user_data;
+      const auto result = cqe.res;
+      store(cq_head, head + 1);
+      return result;
+    }
+  };
+
+
+  /**
+   * @brief Whether io_uring can be used.
+   * @returns Whether a ring could be set up.
+   * @remarks The answer is found once, and remembered. Define NO_URING to always use the plain syscalls.
+   */
+  bool supported() {
+#ifdef NO_URING
+    return false;
+#endif
+    static const bool available = []() {
+      try {ring test(1); return true;}
+      catch (std::runtime_error&) {return false;}
+    }();
+    return available;
+  }
+}
@@ -2,10 +2,12 @@
 
 #include <iostream>   // For writing to console.
 #include <array>      // For std::array
+#include <utility>    // For std::exchange
 
 #include "exchange.h" // To exchange the DH keys.
 #include "aes.h"      // For AES Encryption.
 #include "hmac.h"     // To generate an HMAC for the message.
+#include "nonce.h"    // For the nonces of the messages we send.
 
 
 /**
@@ -73,86 +75,294 @@ namespace util {
   }
 
 
+  /**
+  * @brief The shared key, alongside an AES and HMAC context for every key size, and our nonces.
+  * @remarks The sender picks the key size of each message, so we derive all three contexts as soon
+  * as the key is known, rather than expanding the key again for every message.
+  * @remarks The nonces start again somewhere new with every key; see nonce::counter.
+  * @remarks Every key is numbered with an epoch, which counts up from 1 as keys are exchanged. Both peers
+  * exchange the same number of times, so they agree on it, and a message can name the key it's under.
+  */
+  class keyring {
+  private:
+    std::array<uint64_t, 4> sk = {0, 0, 0, 0};
+    std::array<aes::context, 3> contexts;
+    std::array<hmac::context, 3> macs;
+    nonce::counter nonces;
+    uint64_t epoch = 0;
+
+  public:
+
+    keyring() = default;
+
+
+    /**
+    * @brief Take over another keyring's key, such as one prepared in the background.
+    * @param other: The keyring, which is left empty.
+    * @remarks The nonces start again, as they do for any new key.
+    */
+    keyring& operator=(keyring&& other) {
+      sk = std::exchange(other.sk, {0, 0, 0, 0});
+      contexts = std::exchange(other.contexts, {});
+      macs = std::exchange(other.macs, {});
+      epoch = std::exchange(other.epoch, 0);
+      nonces.reset();
+      return *this;
+    }
+
+
+    /**
+    * @brief Replace the shared key.
+    * @param key: The new key.
+    * @param number: The epoch of the key.
+    */
+    void set(const std::array<uint64_t, 4>& key, const uint64_t& number) {
+      sk = key;
+      for (size_t x = 0; x < contexts.size(); ++x) {
+        contexts[x] = aes::context(sk, 10 + 2 * x);
+        macs[x] = hmac::context(sk, 10 + 2 * x);
+      }
+      nonces.reset();
+      epoch = number;
+    }
+
+
+    // Replace the shared key, with the next epoch.
+    void set(const std::array<uint64_t, 4>& key) {set(key, epoch + 1);}
+
+
+    // Forget the key.
+    void clear() {
+      sk = {0, 0, 0, 0};
+      contexts = {};
+      macs = {};
+      nonces.reset();
+      epoch = 0;
+    }
+
+
+    /**
+    * @brief Get the context for a key size.
+    * @param Nr: The number of rounds.
+    * @returns The context.
+    * @throws std::runtime_error If the Nr rounds is not 10,12,14.
+    */
+    const aes::context& get(const uint64_t& Nr) const {
+      if (Nr != 10 && Nr != 12 && Nr != 14) throw std::runtime_error("Invalid key size:" + std::to_string(Nr));
+      return contexts[(Nr - 10) / 2];
+    }
+
+
+    /**
+    * @brief Get the HMAC context for a key size.
+    * @param Nr: The number of rounds.
+    * @returns The context.
+    * @throws std::runtime_error If the Nr rounds is not 10,12,14.
+    */
+    const hmac::context& get_mac(const uint64_t& Nr) const {
+      get(Nr);
+      return macs[(Nr - 10) / 2];
+    }
+
+    // Getters.
+    const auto& get_key() const {return sk;}
+    const auto& get_epoch() const {return epoch;}
+    auto& get_nonces() {return nonces;}
+  };
+
+
+  /**
+  * @brief Decrypt a GCM message, with the IV its packet carries.
+  * @param cipher: The ciphertext, and tag.
+  * @param ctx: The context of the key.
+  * @param iv: The IV packet.
+  * @returns The plaintext.
+  * @throws std::runtime_error If the message has been modified, or the packet is malformed.
+  * @remarks We send 96 bit IVs, but an older peer sends 64 bit ones, which still decrypt.
+  */
+  inline std::string open(const std::string& cipher, const aes::context& ctx, const network::packet& iv) {
+    if (network::holds<std::array<uint32_t, 3>>(iv)) return aes::gcm::Dec(cipher, ctx, nonce::unpack(iv));
+    return aes::gcm::Dec(cipher, ctx, network::unpack<uint64_t>(iv));
+  }
+
+
   /**
   * @brief Genreate a shared key over a connection.
-  * @param sk: The shared key array to populate.
+  * @param keys: The keyring to populate.
   * @param server: Whether we are the server or not.
   * @remarks AES requires key sizes of 128, 192, or 256 bits, but our uint64_t is just 64.
-  * So, we just perform 4 key exchanges to get 256 bits.
+  * So, we just perform 4 key exchanges to get 256 bits, all at once; see exchange::handshake.
   * @warning Selecting different modes of AES merely truncates this key (IE AES-128 uses sk[0,1],
   * AES-192 uses sk[0,1,2], AES-256 uses all of them).
   * @warning This is not the cryptographically secure way of doing things. We should almost certainly
   * Exchange a single, massive 256 bit prime instead of four 64 bit ones, but for the sake of not
-  * needing to create our own 256 bit number classes, we just key exchange quadrice.
+  * needing to create our own 256 bit number classes, we just key exchange quadrice. Setting
+  * exchange::standard does the proper thing, with one of the standard groups.
   */
-  void construct_shared_key(std::array<uint64_t, 4>& sk, const bool& server) {
+  void construct_shared_key(keyring& keys, const bool& server) {
     std::cout << "Exchanging Keys..." << std::endl;
-    for (size_t x = 0; x < 4; ++x) {
-      sk[x] = exchange::exchange_keys(server);
-    }
+    keys.set(exchange::handshake(server));
 
     prompt("Complete! Ensure that the Shared Key matches!");
   }
 
 
+  /**
+  * @brief Receive a message the peer has encrypted: the ciphertext, its nonce, and for ECB and CTR, its HMAC.
+  * @param keys: The shared key
+  * @param Nr: The number of rounds the peer used.
+  * @returns The plaintext.
+  * @throws std::runtime_error If anything couldn't be received, the key size is invalid, or the message has been altered.
+  * @remarks The mode is whatever the nonce packet says; see send_sealed.
+  */
+  std::string recv_sealed(const keyring& keys, const uint64_t& Nr) {
+    const auto& ctx = keys.get(Nr);
+    auto message = network::recv_string();
+    auto nonce_packet = network::recv_packet();
+
+    // GCM doesn't include an HMAC.
+    if (nonce_packet.m == network::meta::IV) return open(message, ctx, nonce_packet);
+
+    // Something else means the peer did something wrong.
+    if (nonce_packet.m != network::meta::NONCE && nonce_packet.m != network::meta::EMPTY)
+      throw std::runtime_error("Peer sent invalid packet!");
+
+    // Check that the HMAC matches what we expect. Refuse to decrypt unless it matches.
+    auto hmac = network::recv_string();
+    if (hmac != keys.get_mac(Nr).generate(message))
+      throw std::runtime_error("HMAC does not match! Message has been altered!");
+
+    // A NONCE means we're using CTR, and an EMPTY means we're using ECB, which doesn't carry one.
+    if (nonce_packet.m == network::meta::NONCE) return aes::Ctr(message, ctx, network::unpack<uint64_t>(nonce_packet));
+    return aes::InvCipher(message, ctx);
+  }
+
+
   /**
   * @brief Receive an encrypted message from the peer.
-  * @param sk: The shared key
+  * @param keys: The shared key
+  * @throws std::runtime_error If the peer sent an invalid key size.
   */
-  void receive_message(const std::array<uint64_t, 4>& sk) {
+  void receive_message(const keyring& keys) {
 
     std::cout << "Receiving Key Size..." << std::endl;
     auto Nr = network::recv_value<uint64_t>();
+    keys.get(Nr);
 
-    std::cout << "Receiving Ciphertext..." << std::endl;
-    auto message = network::recv_string();
+    std::cout << "Receiving Message..." << std::endl;
+    try {
+      std::cout << "Message: " << recv_sealed(keys, Nr) << std::endl;
+    }
+    catch (std::runtime_error& e) {prompt_return(e.what());}
 
-    std::cout << "Receiving Nonce..." << std::endl;
-    auto nonce_packet = network::recv_packet();
+    std::cout << "Press Enter to Continue" << std::endl;
+    getchar();
+  }
 
-    // Get the actual Nonce.
-    auto str = std::string(&nonce_packet.data[0], PACKET_SIZE);
-    uint64_t nonce = 0;
-    std::istringstream (str) >> nonce;
 
-    // GCM doesn't include an HMAC.
-    if (nonce_packet.m == network::meta::IV) {
-      try {
-        std::cout << "Message: " << aes::gcm::Dec(message, sk, Nr, nonce) << std::endl;
-      }
-      catch (std::runtime_error& e) {prompt_return(e.what());}
+  /**
+  * @brief Encrypt a message with ECB or CTR, and HMAC it, a frame at a time.
+  * @tparam F: A function that sends a frame, given the packet, and returns whether it could.
+  * @param message: The message.
+  * @param ctx: The context of the key.
+  * @param key: The HMAC context of the same key.
+  * @param ctr: Whether to use CTR, rather than ECB.
+  * @param nonce: The nonce, for CTR.
+  * @param each: The function, called with the ciphertext framed as network::send_string frames it.
+  * @returns The HMAC of the ciphertext.
+  * @throws std::runtime_error If a frame couldn't be sent, or network::max_frame can't hold a block.
+  * @remarks Encrypting the whole message, then reading all of it again to HMAC it, and then again to send
+  * it, moves every byte through memory three times. Here each frame is encrypted, added to the HMAC, and
+  * sent while it's still in the cache, and only one frame of ciphertext is ever held at once. The frames,
+  * and the HMAC, are exactly what the three passes would have sent.
+  */
+  template <typename F> std::string seal(const std::string& message, const aes::context& ctx, const hmac::context& key, const bool& ctr, const uint64_t& nonce, F each) {
+    const size_t piece = network::max_frame / 16 * 16;
+    if (piece == 0) throw std::runtime_error("Frames are too small to hold a block!");
+
+    hmac::digest mac(key);
+    const auto in = std::as_bytes(std::span(message));
+    network::packet p = {.m = network::meta::DATA};
+    const auto send = [&]() {
+      mac.update(p.data);
+      if (!each(p)) throw std::runtime_error("Failed to send ciphertext!");
+    };
+
+    // ECB pads the end, so a whole piece left over still needs a frame after it for the padding.
+    size_t x = 0;
+    for (; message.length() - x > piece || (!ctr && message.length() - x == piece); x += piece) {
+      p.data.resize(piece);
+      auto* out = reinterpret_cast<uint8_t*>(p.data.data());
+      if (ctr) aes::Ctr(in.subspan(x, piece), std::as_writable_bytes(std::span(p.data)), ctx, nonce + x / 16);
+      else aes::encrypt(ctx, reinterpret_cast<const uint8_t*>(message.data()) + x, out, piece / 16);
+      send();
     }
 
-    else {
-      std::cout << "Receiving HMAC..." << std::endl;
-      auto hmac = network::recv_string();
+    // The counter of the last frame carries on from the others.
+    const auto rest = in.subspan(x);
+    p.m = network::meta::FINAL;
+    p.data.resize(ctr ? rest.size() : rest.size() / 16 * 16 + 16);
+    if (ctr) aes::Ctr(rest, std::as_writable_bytes(std::span(p.data)), ctx, nonce + x / 16);
+    else aes::Cipher(rest, std::as_writable_bytes(std::span(p.data)), ctx);
+    send();
+
+    return mac.final();
+  }
 
-      // Check that the HMAC matches what we expect. Refuse to decrypt unless it matches.
-      if (hmac != hmac::generate(message, sk, Nr))
-        prompt_return("HMAC does not match! Message has been altered!");
 
-      // A NONCE means we're using CTR.
-      if (nonce_packet.m == network::meta::NONCE) {
-        std::cout << "Message: " << aes::Ctr(message, sk, Nr, nonce) << std::endl;
-      }
-      // An EMPTY means we're using ECB.
-      else if (nonce_packet.m == network::meta::EMPTY) {
-        std::cout << "Message: " << aes::InvCipher(message, sk, Nr) << std::endl;
-      }
+  /**
+   * @brief The modes a message can be sent with.
+   * @var ECB: AES-ECB, with an HMAC.
+   * @var CTR: AES-CTR, with an HMAC.
+   * @var GCM: AES-GCM, which carries its own tag.
+   */
+  typedef enum {ECB, CTR, GCM} mode;
+
 
-      // Something else means the peer did something wrong.
-      else prompt_return("Peer sent invalid packet!");
+  /**
+  * @brief Encrypt a message, and send it: the ciphertext, its nonce, and for ECB and CTR, its HMAC.
+  * @param keys: The shared key.
+  * @param message: The message.
+  * @param Nr: The number of rounds.
+  * @param m: The mode.
+  * @throws std::runtime_error If anything couldn't be sent, the key size is invalid, or the nonces are exhausted.
+  * @remarks The peer must already know Nr; see recv_sealed for the other side.
+  */
+  void send_sealed(keyring& keys, const std::string& message, const uint64_t& Nr, const mode& m) {
+    const auto& ctx = keys.get(Nr);
+
+    // GCM does not generate an HMAC, so just return once we've sent the IV.
+    if (m == GCM) {
+      const auto iv = keys.get_nonces().next();
+      if (network::send_string(aes::gcm::Enc(message, ctx, iv)) == -1)
+        throw std::runtime_error("Failed to send ciphertext!");
+      if (network::send_packet(nonce::pack(iv)) == -1)
+        throw std::runtime_error("Failed to send IV!");
+      return;
     }
-    std::cout << "Press Enter to Continue" << std::endl;
-    getchar();
+
+    // CTR takes a counter for every block. ECB needs none.
+    const uint64_t nonce = m == CTR ? keys.get_nonces().reserve(message.length() / 16 + 1) : 0;
+
+    // ECB and CTR generate the HMAC as they go; see seal.
+    auto hmac = seal(message, ctx, keys.get_mac(Nr), m == CTR, nonce, [](const network::packet& p) {return network::send_packet(p) != -1;});
+
+    // ECB sends an empty packet as there is no nonce.
+    const auto nonce_packet = m == CTR ? network::pack(nonce, network::meta::NONCE) : network::packet{.m = network::meta::EMPTY};
+    if (network::send_packet(nonce_packet) == -1)
+      throw std::runtime_error("Failed to send nonce!");
+
+    // Send the HMAC across.
+    if (network::send_string(hmac) == -1)
+      throw std::runtime_error("Failed to send HMAC!");
   }
 
 
   /**
   * @brief Send an encrypted message to a peer.
-  * @param sk: The shared key.
+  * @param keys: The shared key.
   */
-  void send_message(const std::array<uint64_t, 4>& sk) {
+  void send_message(keyring& keys) {
     // Get the message to encrypt.
     std::string message;
     std::cout << "Enter the message:" << std::endl;
@@ -196,46 +406,11 @@ namespace util {
       default: prompt_return("Peer sent invalid response!");
     }
 
-    // Even though ECB doesn't use this, we generate it for the others.
-    const uint64_t nonce = std::rand();
-
-    // Get the cipher.
-    auto cipher = option == 1 ?
-      aes::Cipher(message, sk, Nr) : option == 2 ?
-      aes::Ctr(message, sk, Nr, nonce) :
-      aes::gcm::Enc(message, sk, Nr, nonce);
-
     if (network::send_value<uint64_t>(Nr) == -1)
       prompt_return("Failed to send Key Size!");
 
-    // Send that cipher across.
-    if (network::send_string(cipher) == -1)
-       prompt_return("Failed to send ciphertext!");
-
-    // ECB; we send an empty packet as there is no nonce.
-    if (option == 1) {
-      if (network::send_packet({.m = network::meta::EMPTY}) == -1)
-        prompt_return("Failed to send empty packet!");
-    }
-
-    //CTR; we need to create and send the NONCE.
-    else if (option == 2) {
-      if (network::send_value(nonce, network::meta::NONCE) == -1)
-        prompt_return("Failed to send nonce!");
-    }
-
-    // GCM does not generate an HMAC, so just return once we've sent the IV.
-    if (option == 3) {
-      if (network::send_value(nonce, network::meta::IV) == -1)
-        prompt_return("Failed to send IV!");
-    }
-    else {
-      // Generate the HMAC and send it across.
-      auto hmac = hmac::generate(cipher, sk, Nr);
-
-      if (network::send_string(hmac) == -1)
-        prompt_return("Failed to send HMAC!");
-    }
+    try {send_sealed(keys, message, Nr, static_cast<mode>(option - 1));}
+    catch (std::runtime_error& e) {prompt_return(e.what());}
   }
 
 